@@ -8,6 +8,32 @@
 #include <algorithm>
 #include <chrono>
 #include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <array>
+#include <map>
+#include <type_traits>
+#include <bitset>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <regex>
+#include <random>
+#include <limits>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define HAVE_SSE2 1
+#endif
 
 namespace fs = std::filesystem;
 using namespace std;
@@ -16,50 +42,291 @@ using namespace std;
 #ifdef _WIN32
     #define WIN32_LEAN_AND_MEAN
     #include <windows.h>
+    #include <psapi.h>
     #include <direct.h>
     #include <conio.h>
+    #include <io.h>
+    #ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+    #define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+    #endif
     
-    void setConsoleColor(int color) {
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-        SetConsoleTextAttribute(hConsole, color);
-    }
     #define COLOR_RESET 7
     #define COLOR_GREEN 10
     #define COLOR_RED 12
     #define COLOR_YELLOW 14
     #define COLOR_CYAN 11
-    
-    void setupConsole() {
-        SetConsoleOutputCP(CP_UTF8);
-    }
-    void clearScreen() {
-        system("cls");
-    }
 #else
-    // ANSI color codes for Linux/Unix
-    void setConsoleColor(int color) {
-        switch(color) {
-            case 10: cout << "\033[1;32m"; break; // Green
-            case 12: cout << "\033[1;31m"; break; // Red
-            case 14: cout << "\033[1;33m"; break; // Yellow
-            case 11: cout << "\033[1;36m"; break; // Cyan
-            case 15: cout << "\033[0m"; break;    // Reset
-            default: cout << "\033[0m"; break;
-        }
-    }
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <dirent.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <sys/resource.h>
+    #ifdef __linux__
+    #include <sys/syscall.h>
+    #include <sys/inotify.h>
+    #include <sys/vfs.h>
+    #include <sys/ioctl.h>
+    #include <sys/sendfile.h>
+    #include <sys/sysmacros.h>
+    #ifndef FICLONE
+    #define FICLONE _IOW(0x94, 9, int)
+    #endif
+    #endif
+    
     #define COLOR_RESET 15
     #define COLOR_GREEN 10
     #define COLOR_RED 12
     #define COLOR_YELLOW 14
     #define COLOR_CYAN 11
+#endif
+
+// What commands spend their time on. Every thread counts into its own
+// block, so pool workers never contend on a shared counter, and a snapshot
+// sums the live blocks plus whatever exited threads left behind.
+enum class Metric { BytesRead, BytesWritten, EntriesVisited, StatCalls, OutputBytes, Count };
+
+class Metrics {
+public:
+    static constexpr size_t count = static_cast<size_t>(Metric::Count);
+    using Snapshot = array<uint64_t, count>;
+    
+private:
+    struct Block {
+        atomic<uint64_t> values[count] = {};
+    };
+    
+    // Registers the thread's block on first use and retires it at thread exit
+    struct Registration {
+        Block* block = new Block;
+        
+        Registration() {
+            Metrics& metrics = instance();
+            lock_guard<mutex> guard(metrics.lock);
+            metrics.live.push_back(block);
+        }
+        
+        ~Registration() {
+            Metrics& metrics = instance();
+            lock_guard<mutex> guard(metrics.lock);
+            for (size_t i = 0; i < count; i++) {
+                metrics.retired[i] += block->values[i].load(memory_order_relaxed);
+            }
+            metrics.live.erase(find(metrics.live.begin(), metrics.live.end(), block));
+            delete block;
+        }
+    };
+    
+    mutex lock;
+    vector<Block*> live;
+    Snapshot retired{};
+    
+    // Never destroyed: pool threads can still exit during static destruction
+    static Metrics& instance() {
+        static Metrics* metrics = new Metrics;
+        return *metrics;
+    }
     
-    void setupConsole() {
-        // UTF-8 should work by default on Linux
+public:
+    static void add(Metric metric, uint64_t amount = 1) {
+        thread_local Registration registration;
+        // Only the owning thread writes a block, so load plus store is enough
+        atomic<uint64_t>& value = registration.block->values[static_cast<size_t>(metric)];
+        value.store(value.load(memory_order_relaxed) + amount, memory_order_relaxed);
+    }
+    
+    static Snapshot snapshot() {
+        Metrics& metrics = instance();
+        lock_guard<mutex> guard(metrics.lock);
+        Snapshot total = metrics.retired;
+        for (const Block* block : metrics.live) {
+            for (size_t i = 0; i < count; i++) {
+                total[i] += block->values[i].load(memory_order_relaxed);
+            }
+        }
+        return total;
     }
-    void clearScreen() {
-        system("clear");
+    
+    static Snapshot since(const Snapshot& before) {
+        Snapshot delta = snapshot();
+        for (size_t i = 0; i < count; i++) delta[i] -= before[i];
+        return delta;
     }
-#endif
+    
+    // Field names used in the trace file
+    static const char* key(size_t metric) {
+        static const char* const keys[count] = {"bytes_read", "bytes_written", "entries", "stat_calls", "output_bytes"};
+        return keys[metric];
+    }
+};
+
+// Stream buffer installed under cout. Output accumulates in one reusable
+// buffer and reaches the terminal in a single write when cout is flushed
+// (cin is tied to cout, so that happens once per prompt or pager page).
+// Color changes are applied lazily, so back-to-back switches collapse into
+// one escape, and escapes are dropped when stdout is not a terminal.
+class ConsoleRenderer : public streambuf {
+private:
+    static constexpr size_t flushThreshold = 64 * 1024;
+    
+    string buffer;
+    streambuf* original = nullptr;
+    int pendingColor = COLOR_RESET;
+    int activeColor = -1;
+    bool colorsEnabled = false;
+    #ifdef _WIN32
+    bool useConsoleApi = false;     // console without ANSI escape support
+    #endif
+    
+    static const char* escapeFor(int color) {
+        switch (color) {
+            case COLOR_GREEN: return "\033[1;32m";
+            case COLOR_RED: return "\033[1;31m";
+            case COLOR_YELLOW: return "\033[1;33m";
+            case COLOR_CYAN: return "\033[1;36m";
+            default: return "\033[0m";
+        }
+    }
+    
+    void applyColor() {
+        if (pendingColor == activeColor) {
+            return;
+        }
+        activeColor = pendingColor;
+        if (!colorsEnabled) {
+            return;
+        }
+        
+        #ifdef _WIN32
+        if (useConsoleApi) {
+            writeBuffer();
+            SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), static_cast<WORD>(activeColor));
+            return;
+        }
+        #endif
+        buffer += escapeFor(activeColor);
+    }
+    
+    void writeBuffer() {
+        if (buffer.empty()) {
+            return;
+        }
+        
+        #ifdef _WIN32
+        fwrite(buffer.data(), 1, buffer.size(), stdout);
+        fflush(stdout);
+        #else
+        const char* data = buffer.data();
+        size_t remaining = buffer.size();
+        while (remaining > 0) {
+            ssize_t written = ::write(STDOUT_FILENO, data, remaining);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            data += written;
+            remaining -= static_cast<size_t>(written);
+        }
+        #endif
+        buffer.clear();     // keeps its capacity for the next command
+    }
+    
+protected:
+    int_type overflow(int_type ch) override {
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            applyColor();
+            buffer += traits_type::to_char_type(ch);
+            Metrics::add(Metric::OutputBytes);
+            if (buffer.size() >= flushThreshold) writeBuffer();
+        }
+        return traits_type::not_eof(ch);
+    }
+    
+    streamsize xsputn(const char* text, streamsize count) override {
+        applyColor();
+        buffer.append(text, static_cast<size_t>(count));
+        Metrics::add(Metric::OutputBytes, static_cast<uint64_t>(count));
+        if (buffer.size() >= flushThreshold) writeBuffer();
+        return count;
+    }
+    
+    int sync() override {
+        // Flush points are where the user sees the terminal, so the pending
+        // color (e.g. red for typed input) has to be in effect there
+        applyColor();
+        writeBuffer();
+        return 0;
+    }
+    
+public:
+    ConsoleRenderer() {
+        buffer.reserve(flushThreshold);
+    }
+    
+    ~ConsoleRenderer() {
+        uninstall();
+    }
+    
+    static ConsoleRenderer& instance() {
+        static ConsoleRenderer renderer;
+        return renderer;
+    }
+    
+    void install() {
+        if (original) {
+            return;
+        }
+        #ifdef _WIN32
+        colorsEnabled = _isatty(_fileno(stdout)) != 0;
+        DWORD mode = 0;
+        HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+        if (colorsEnabled && GetConsoleMode(console, &mode)) {
+            useConsoleApi = !SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+        }
+        #else
+        colorsEnabled = isatty(STDOUT_FILENO) != 0;
+        #endif
+        original = cout.rdbuf(this);
+    }
+    
+    void uninstall() {
+        if (original) {
+            pendingColor = COLOR_RESET;
+            sync();
+            cout.rdbuf(original);
+            original = nullptr;
+        }
+    }
+    
+    void setColor(int color) {
+        pendingColor = color;
+    }
+    
+    bool isTerminal() const { return colorsEnabled; }
+};
+
+void setConsoleColor(int color) {
+    ConsoleRenderer::instance().setColor(color);
+}
+
+void setupConsole() {
+    #ifdef _WIN32
+    SetConsoleOutputCP(CP_UTF8);
+    #endif
+    ConsoleRenderer::instance().install();
+}
+
+void clearScreen() {
+    #ifdef _WIN32
+    cout.flush();
+    system("cls");
+    #else
+    // Same sequence `clear` emits, without starting a process
+    if (ConsoleRenderer::instance().isTerminal()) {
+        cout << "\033[H\033[2J\033[3J";
+    }
+    #endif
+}
 
 // Helper function to draw centered ASCII box header
 void drawBoxHeader(const string& title) {
@@ -74,651 +341,8088 @@ void drawBoxHeader(const string& title) {
     setConsoleColor(COLOR_RESET);
 }
 
-// File Explorer class
-class FileExplorer {
+// How much metadata a directory read has to fetch for each entry
+enum class FetchLevel {
+    TypeOnly,   // names and file/directory type
+    FileSizes,  // plus sizes of regular files (short listing)
+    Full        // size, mtime and permissions of every entry (long listing)
+};
+
+// Metadata of a single directory entry, fetched in one pass
+struct EntryInfo {
+    string name;
+    bool isDirectory = false;
+    bool isHidden = false;
+    bool hasMetadata = false;
+    bool isLink = false;        // possibly a symlink: the attributes are its target's
+    uintmax_t size = 0;
+    time_t modified = 0;
+    unsigned int mode = 0;      // POSIX permission bits (synthesized on Windows)
+};
+
+// Struct-of-arrays listing: every name is stored NUL-terminated in one
+// arena and each attribute in its own array, so an entry costs its name
+// plus 25 bytes and no allocation of its own. clear() keeps the capacity,
+// so a table reused across commands stops allocating once it has grown to
+// the largest directory seen.
+class EntryTable {
 private:
-    fs::path currentPath;
-    fs::path copiedPath;
-    bool isCut = false;
+    enum : uint8_t { DirectoryFlag = 1, HiddenFlag = 2, MetadataFlag = 4, LinkFlag = 8 };
+    
+    string names;
+    vector<uint32_t> nameOffsets;
+    vector<uint64_t> sizes;
+    vector<int64_t> modifiedTimes;
+    vector<uint32_t> modes;
+    vector<uint8_t> flags;
+    
+    void addRow(const char* name, size_t length, uint64_t size, int64_t modified, uint32_t mode, uint8_t flag) {
+        nameOffsets.push_back(static_cast<uint32_t>(names.size()));
+        names.append(name, length);
+        names += '\0';
+        sizes.push_back(size);
+        modifiedTimes.push_back(modified);
+        modes.push_back(mode);
+        flags.push_back(flag);
+    }
     
 public:
-    FileExplorer() {
-        // Start in the user's home directory
-        #ifdef _WIN32
-        const char* userProfile = getenv("USERPROFILE");
-        if (userProfile) {
-            currentPath = fs::path(userProfile);
-        } else {
-            currentPath = fs::current_path();
-        }
-        #else
-        const char* home = getenv("HOME");
-        if (home) {
-            currentPath = fs::path(home);
-        } else {
-            currentPath = fs::current_path();
-        }
-        #endif
+    void clear() {
+        names.clear();
+        nameOffsets.clear();
+        sizes.clear();
+        modifiedTimes.clear();
+        modes.clear();
+        flags.clear();
     }
     
-    // Helper function to format file size in human-readable format
-    string formatFileSize(uintmax_t size) const {
-        const char* units[] = {"B", "KB", "MB", "GB", "TB"};
-        int unitIndex = 0;
-        double displaySize = static_cast<double>(size);
-        
-        while (displaySize >= 1024.0 && unitIndex < 4) {
-            displaySize /= 1024.0;
-            unitIndex++;
+    size_t size() const { return flags.size(); }
+    bool empty() const { return flags.empty(); }
+    
+    void add(const char* name, size_t length, const EntryInfo& info) {
+        uint8_t flag = (info.isDirectory ? DirectoryFlag : 0) | (info.isHidden ? HiddenFlag : 0) |
+                       (info.hasMetadata ? MetadataFlag : 0) | (info.isLink ? LinkFlag : 0);
+        addRow(name, length, info.size, static_cast<int64_t>(info.modified), info.mode, flag);
+    }
+    
+    // Replaces the attributes of row `i` with freshly fetched ones
+    void refresh(size_t i, const EntryInfo& info) {
+        sizes[i] = info.size;
+        modifiedTimes[i] = static_cast<int64_t>(info.modified);
+        modes[i] = info.mode;
+        flags[i] = (flags[i] & (HiddenFlag | LinkFlag)) | (info.isDirectory ? DirectoryFlag : 0) |
+                   (info.hasMetadata ? MetadataFlag : 0);
+    }
+    
+    void add(const EntryInfo& info) {
+        add(info.name.data(), info.name.size(), info);
+    }
+    
+    // Copies row `i` of another table
+    void addFrom(const EntryTable& other, size_t i) {
+        addRow(other.name(i), other.nameLength(i), other.sizes[i], other.modifiedTimes[i], other.modes[i], other.flags[i]);
+    }
+    
+    const char* name(size_t i) const { return names.data() + nameOffsets[i]; }
+    size_t nameLength(size_t i) const {
+        size_t end = i + 1 < nameOffsets.size() ? nameOffsets[i + 1] : names.size();
+        return end - nameOffsets[i] - 1;
+    }
+    bool isDirectory(size_t i) const { return flags[i] & DirectoryFlag; }
+    bool isHidden(size_t i) const { return flags[i] & HiddenFlag; }
+    bool hasMetadata(size_t i) const { return flags[i] & MetadataFlag; }
+    bool isLink(size_t i) const { return flags[i] & LinkFlag; }
+    uint64_t fileSize(size_t i) const { return sizes[i]; }
+    time_t modified(size_t i) const { return static_cast<time_t>(modifiedTimes[i]); }
+    unsigned int mode(size_t i) const { return modes[i]; }
+    
+    // Puts old row order[k] at row k; the scratch table keeps its capacity too
+    void reorder(const vector<uint32_t>& order) {
+        static thread_local EntryTable scratch;
+        scratch.clear();
+        for (uint32_t row : order) scratch.addFrom(*this, row);
+        swap(scratch);
+    }
+    
+    void swap(EntryTable& other) {
+        names.swap(other.names);
+        nameOffsets.swap(other.nameOffsets);
+        sizes.swap(other.sizes);
+        modifiedTimes.swap(other.modifiedTimes);
+        modes.swap(other.modes);
+        flags.swap(other.flags);
+    }
+    
+    size_t bytes() const {
+        return sizeof(EntryTable) + names.capacity() + nameOffsets.capacity() * sizeof(uint32_t) +
+               sizes.capacity() * sizeof(uint64_t) + modifiedTimes.capacity() * sizeof(int64_t) +
+               modes.capacity() * sizeof(uint32_t) + flags.capacity();
+    }
+};
+
+// Reports a failed system call the way every engine does: a filesystem_error
+// carrying errno
+[[noreturn]] void fail(const string& what, const fs::path& path, int error) {
+    throw fs::filesystem_error(what, path, error_code(error, system_category()));
+}
+
+// Flushes a finished file to disk before a rename makes it the only copy,
+// so a crash cannot leave an empty or partial file in place of a good one.
+// For files written through a stream, which exposes no descriptor.
+void syncFile(const fs::path& path) {
+    #ifdef _WIN32
+    HANDLE handle = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) fail("Cannot open file", path, EIO);
+    bool flushed = FlushFileBuffers(handle) != 0;
+    CloseHandle(handle);
+    if (!flushed) fail("Cannot sync file", path, EIO);
+    #else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) fail("Cannot open file", path, errno);
+    bool synced = fdatasync(fd) == 0;
+    int error = errno;
+    close(fd);
+    if (!synced) fail("Cannot sync file", path, error);
+    #endif
+}
+
+// Reads a directory once and fetches every attribute the caller needs,
+// never touching the same path twice
+class DirectoryReader {
+private:
+    static bool isHiddenName(const char* name) {
+        return name[0] == '.';
+    }
+    
+    static bool needsMetadata(FetchLevel level, bool typeKnown, bool isDirectory) {
+        if (!typeKnown || level == FetchLevel::Full) return true;
+        return level == FetchLevel::FileSizes && !isDirectory;
+    }
+    
+public:
+#ifdef _WIN32
+    // FindFirstFileEx returns type, size, mtime and attributes in the same
+    // record. visit(name, EntryInfo&) returns false to stop early.
+    template <typename Visitor>
+    static void stream(const fs::path& dirPath, bool showHidden, bool dirsOnly, FetchLevel level, Visitor&& visit) {
+        WIN32_FIND_DATAW data;
+        fs::path pattern = dirPath / L"*";
+        HANDLE handle = FindFirstFileExW(pattern.c_str(), FindExInfoBasic, &data,
+                                         FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+        if (handle == INVALID_HANDLE_VALUE) {
+            fail("Cannot open directory", dirPath, static_cast<int>(GetLastError()));
         }
         
-        stringstream ss;
-        ss << fixed << setprecision(1) << displaySize << " " << units[unitIndex];
-        return ss.str();
+        uint64_t visited = 0;
+        do {
+            if (wcscmp(data.cFileName, L".") == 0 || wcscmp(data.cFileName, L"..") == 0) {
+                continue;
+            }
+            visited++;
+            
+            EntryInfo info;
+            info.isDirectory = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+            info.isHidden = (data.dwFileAttributes & (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM)) != 0;
+            if ((!showHidden && info.isHidden) || (dirsOnly && !info.isDirectory)) {
+                continue;
+            }
+            
+            string name = fs::path(data.cFileName).string();
+            info.hasMetadata = true;
+            info.size = info.isDirectory ? 0 : (static_cast<uintmax_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+            ULARGE_INTEGER ticks;
+            ticks.LowPart = data.ftLastWriteTime.dwLowDateTime;
+            ticks.HighPart = data.ftLastWriteTime.dwHighDateTime;
+            info.modified = static_cast<time_t>((ticks.QuadPart - 116444736000000000ULL) / 10000000ULL);
+            info.mode = (data.dwFileAttributes & FILE_ATTRIBUTE_READONLY) ? 0444 : 0666;
+            if (!visit(name.c_str(), info)) break;
+        } while (FindNextFileW(handle, &data));
+        
+        FindClose(handle);
+        Metrics::add(Metric::EntriesVisited, visited);
+    }
+#else
+    // Fills size, mtime, mode and (resolved) type of `name` relative to dirfd
+    static bool statEntry(int dirfd, const char* name, EntryInfo& info) {
+        Metrics::add(Metric::StatCalls);
+        #ifdef __linux__
+        struct statx stx;
+        unsigned int mask = STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME;
+        if (statx(dirfd, name, AT_NO_AUTOMOUNT, mask, &stx) != 0 &&
+            statx(dirfd, name, AT_NO_AUTOMOUNT | AT_SYMLINK_NOFOLLOW, mask, &stx) != 0) {
+            return false;
+        }
+        info.isDirectory = S_ISDIR(stx.stx_mode);
+        info.size = stx.stx_size;
+        info.modified = static_cast<time_t>(stx.stx_mtime.tv_sec);
+        info.mode = stx.stx_mode & 07777;
+        #else
+        struct stat st;
+        if (fstatat(dirfd, name, &st, 0) != 0 && fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            return false;
+        }
+        info.isDirectory = S_ISDIR(st.st_mode);
+        info.size = st.st_size;
+        info.modified = st.st_mtime;
+        info.mode = st.st_mode & 07777;
+        #endif
+        info.hasMetadata = true;
+        return true;
     }
     
-    // Helper function to get file permissions (simplified for Windows)
-    string getPermissions(const fs::path& path) const {
-        string perms = "";
+    // Calls visit(name, dtype) for every entry except "." and ".." without
+    // allocating; dtype is DT_UNKNOWN when the filesystem does not report it.
+    // A visitor that returns bool stops the scan by returning false.
+    // The visitor must not scan another directory on the same thread.
+    template <typename Visitor>
+    static void scan(int dirfd, const fs::path& dirPath, Visitor&& visit) {
+        auto proceed = [&](const char* name, unsigned char type) {
+            if constexpr (is_same<decltype(visit(name, type)), bool>::value) {
+                return visit(name, type);
+            } else {
+                visit(name, type);
+                return true;
+            }
+        };
         
-        if (fs::is_directory(path)) {
-            perms += "d";
-        } else {
-            perms += "-";
-        }
+        #ifdef __linux__
+        struct LinuxDirent64 {
+            ino64_t d_ino;
+            off64_t d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+            char d_name[];
+        };
         
-        #ifdef _WIN32
-        DWORD attrs = GetFileAttributesW(path.c_str());
-        if (attrs != INVALID_FILE_ATTRIBUTES) {
-            if (attrs & FILE_ATTRIBUTE_READONLY) {
-                perms += "r--r--r--";
-            } else {
-                perms += "rw-rw-rw-";
+        // A large buffer keeps getdents round trips low on network filesystems
+        alignas(8) static thread_local char buffer[64 * 1024];
+        uint64_t visited = 0;
+        bool stopped = false;
+        while (!stopped) {
+            long bytes = syscall(SYS_getdents64, dirfd, buffer, sizeof(buffer));
+            if (bytes < 0) fail("Cannot read directory", dirPath, errno);
+            if (bytes == 0) break;
+            
+            for (long offset = 0; offset < bytes && !stopped;) {
+                auto* record = reinterpret_cast<LinuxDirent64*>(buffer + offset);
+                offset += record->d_reclen;
+                const char* name = record->d_name;
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                    continue;
+                }
+                visited++;
+                stopped = !proceed(name, record->d_type);
             }
-        } else {
-            perms += "rw-rw-rw-";
         }
+        Metrics::add(Metric::EntriesVisited, visited);
         #else
-        perms += "rw-rw-rw-"; // Simplified for non-Windows
+        int fd = dup(dirfd);
+        DIR* dir = fd >= 0 ? fdopendir(fd) : nullptr;
+        if (!dir) fail("Cannot read directory", dirPath, errno);
+        uint64_t visited = 0;
+        while (struct dirent* record = readdir(dir)) {
+            const char* name = record->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            visited++;
+            if (!proceed(name, record->d_type)) break;
+        }
+        closedir(dir);
+        Metrics::add(Metric::EntriesVisited, visited);
         #endif
-        
-        return perms;
     }
     
-    // Helper function to format file time
-    string formatFileTime(const fs::file_time_type& ftime) const {
-        auto sctp = chrono::time_point_cast<chrono::system_clock::duration>(
-            ftime - fs::file_time_type::clock::now() + chrono::system_clock::now()
-        );
-        auto time = chrono::system_clock::to_time_t(sctp);
-        char buffer[80];
-        strftime(buffer, sizeof(buffer), "%b %d %H:%M", localtime(&time));
-        return string(buffer);
+    static int openDirectory(const fs::path& dirPath) {
+        int fd = open(dirPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) fail("Cannot open directory", dirPath, errno);
+        return fd;
     }
     
-    // Advanced listing function with flags
-    void listDirectory(bool showHidden = false, bool longFormat = false, bool dirsOnly = false, bool recursive = false, const fs::path& dirPath = fs::path(), int depth = 0) const {
-        fs::path targetPath = dirPath.empty() ? currentPath : dirPath;
-        
-        if (depth == 0) {
-            if (!longFormat) {
-                cout << "\nFiles and folders in: " << targetPath.string() << "\n";
-            }
-        } else {
-            cout << "\n" << targetPath.string() << ":\n";
-        }
-        
-        int index = 1;
+    // getdents plus at most one stat per entry, skipped entirely when the
+    // directory record already answers everything `level` asks for. Entries
+    // go to visit(name, EntryInfo&) as they are read, with info.name left
+    // empty so nothing is allocated per entry; returning false stops early.
+    template <typename Visitor>
+    static void stream(const fs::path& dirPath, bool showHidden, bool dirsOnly, FetchLevel level, Visitor&& visit) {
+        int dirfd = openDirectory(dirPath);
         
         try {
-            vector<fs::directory_entry> entries;
-            
-            // Collect all entries
-            for (const auto& entry : fs::directory_iterator(targetPath)) {
-                string filename = entry.path().filename().string();
+            scan(dirfd, dirPath, [&](const char* name, unsigned char type) {
+                bool hidden = isHiddenName(name);
+                if (!showHidden && hidden) return true;
                 
-                // Skip hidden files if not showing all
-                if (!showHidden) {
-                    bool isHidden = false;
-                    
-                    #ifdef _WIN32
-                    // On Windows, check file attributes for hidden flag
-                    DWORD attrs = GetFileAttributesW(entry.path().c_str());
-                    if (attrs != INVALID_FILE_ATTRIBUTES) {
-                        if (attrs & FILE_ATTRIBUTE_HIDDEN || attrs & FILE_ATTRIBUTE_SYSTEM) {
-                            isHidden = true;
-                        }
-                    }
-                    #else
-                    // On Linux/Unix, files starting with . are hidden
-                    if (!filename.empty() && filename[0] == '.') {
-                        isHidden = true;
-                    }
-                    #endif
-                    
-                    if (isHidden) {
-                        continue;
-                    }
-                }
+                // Symlinks are followed like fs::directory_entry::is_directory()
+                bool typeKnown = type != DT_UNKNOWN && type != DT_LNK;
+                EntryInfo info;
+                info.isDirectory = type == DT_DIR;
+                info.isHidden = hidden;
+                info.isLink = !typeKnown;
                 
-                // Skip non-directories if only showing directories
-                if (dirsOnly && !entry.is_directory()) {
-                    continue;
+                // A known non-directory never makes it into a dirs-only listing
+                if (dirsOnly && typeKnown && !info.isDirectory) return true;
+                
+                if (needsMetadata(level, typeKnown, info.isDirectory) && !statEntry(dirfd, name, info)) {
+                    return true;  // vanished between getdents and stat
                 }
+                if (dirsOnly && !info.isDirectory) return true;
                 
-                entries.push_back(entry);
-            }
-            
-            // Sort entries alphabetically
-            sort(entries.begin(), entries.end(), [](const fs::directory_entry& a, const fs::directory_entry& b) {
-                return a.path().filename().string() < b.path().filename().string();
+                return static_cast<bool>(visit(name, info));
             });
-            
-            // Display entries
-            for (const auto& entry : entries) {
-                if (longFormat) {
-                    // Long format: permissions, size, date, name
-                    string perms = getPermissions(entry.path());
-                    auto ftime = fs::last_write_time(entry.path());
-                    string timeStr = formatFileTime(ftime);
-                    
-                    if (entry.is_directory()) {
-                        setConsoleColor(COLOR_CYAN);
-                        cout << perms << "  " << setw(10) << right << "<DIR>" << "  " 
-                             << timeStr << "  " << entry.path().filename().string() << endl;
-                        setConsoleColor(COLOR_RESET);
-                    } else {
-                        auto fileSize = fs::file_size(entry.path());
-                        setConsoleColor(COLOR_GREEN);
-                        cout << perms << "  " << setw(10) << right << formatFileSize(fileSize) << "  " 
-                             << timeStr << "  " << entry.path().filename().string() << endl;
-                        setConsoleColor(COLOR_RESET);
-                    }
-                } else {
-                    // Short format with index
-                    cout << setfill(' ') << setw(2) << right << index << ". ";
-                    if (entry.is_directory()) {
-                        setConsoleColor(COLOR_CYAN);
-                        cout << "📁  " << entry.path().filename().string() << endl;
-                        setConsoleColor(COLOR_RESET);
-                    } else {
-                        setConsoleColor(COLOR_GREEN);
-                        auto fileSize = fs::file_size(entry.path());
-                        cout << "📄  " << entry.path().filename().string();
-                        cout << " (" << formatFileSize(fileSize) << ")" << endl;
-                        setConsoleColor(COLOR_RESET);
-                    }
-                }
-                index++;
-            }
-            
-            // Recursive listing
-            if (recursive) {
-                for (const auto& entry : entries) {
-                    if (entry.is_directory()) {
-                        listDirectory(showHidden, longFormat, dirsOnly, recursive, entry.path(), depth + 1);
-                    }
-                }
-            }
-            
-        } catch (const fs::filesystem_error& e) {
-            setConsoleColor(COLOR_RED);
-            cout << "Error accessing directory: " << e.what() << endl;
-            setConsoleColor(COLOR_RESET);
+        } catch (...) {
+            close(dirfd);
+            throw;
         }
         
-        if (depth == 0) {
-            cout << endl;
-        }
+        close(dirfd);
     }
+#endif
     
-    // Backward compatibility wrapper
-    void displayCurrentDirectory() const {
-        listDirectory(false, false, false, false);
+    // Replaces the contents of `table` with the listing
+    static void read(const fs::path& dirPath, bool showHidden, bool dirsOnly, FetchLevel level, EntryTable& table) {
+        table.clear();
+        stream(dirPath, showHidden, dirsOnly, level, [&](const char* name, const EntryInfo& info) {
+            table.add(name, strlen(name), info);
+            return true;
+        });
     }
+};
+
+// In-memory cache of directory listings keyed by path. Every cached
+// directory carries an inotify watch, and pending events are drained before
+// each lookup. A watch follows the inode, not the path, so a hit also
+// checks with one stat that the path still names the same directory; a
+// renamed ancestor sends no event. Nor does the watch see a symlink's
+// target change, or a file created inside a subdirectory (which moves the
+// subdirectory's mtime), so those rows are statted again on every hit:
+// links always, subdirectories when the listing holds their metadata.
+// Listings are evicted least-recently-used once the memory cap is reached.
+class DirectoryCache {
+private:
+    struct CachedListing {
+        string key;
+        EntryTable entries;
+        bool showHidden;
+        bool dirsOnly;
+        FetchLevel level;
+        size_t bytes;
+        int watch;
+        uint64_t device;
+        uint64_t inode;
+    };
     
-    bool navigate(const string& dirName) {
-        fs::path newPath;
-        
-        // Handle special case: staying in current directory
-        if (dirName == ".") {
-            return true;
+    list<CachedListing> lru;    // most recently used first
+    unordered_map<string, list<CachedListing>::iterator> byPath;
+    unordered_map<int, list<CachedListing>::iterator> byWatch;
+    size_t usedBytes = 0;
+    size_t capacityBytes;
+    int notifyFd = -1;
+    
+    static size_t estimateBytes(const string& key, const EntryTable& entries) {
+        return sizeof(CachedListing) + key.capacity() + entries.bytes();
+    }
+    
+    void erase(list<CachedListing>::iterator it, bool removeWatch) {
+        #ifdef __linux__
+        if (removeWatch) {
+            inotify_rm_watch(notifyFd, it->watch);
         }
-        
-        if (dirName == "..") {
-            newPath = currentPath.parent_path();
-        } else if (dirName == "~") {
-            // Navigate to user home directory
+        #endif
+        usedBytes -= it->bytes;
+        byWatch.erase(it->watch);
+        byPath.erase(it->key);
+        lru.erase(it);
+    }
+    
+    // Invalidates every listing touched by a queued event
+    void drainEvents() {
+        #ifdef __linux__
+        alignas(struct inotify_event) char buffer[16 * 1024];
+        while (true) {
+            ssize_t bytes = ::read(notifyFd, buffer, sizeof(buffer));
+            if (bytes <= 0) {
+                return;
+            }
+            
+            for (ssize_t offset = 0; offset < bytes;) {
+                auto* event = reinterpret_cast<struct inotify_event*>(buffer + offset);
+                offset += sizeof(struct inotify_event) + event->len;
+                
+                if (event->mask & IN_Q_OVERFLOW) {
+                    clear();
+                    continue;
+                }
+                auto it = byWatch.find(event->wd);
+                if (it != byWatch.end()) {
+                    // The kernel already dropped the watch when it sends IN_IGNORED
+                    erase(it->second, !(event->mask & IN_IGNORED));
+                }
+            }
+        }
+        #endif
+    }
+    
+    #ifdef __linux__
+    // Re-fetches the rows the watch cannot vouch for; false when the
+    // directory cannot be opened
+    static bool refreshUnwatched(CachedListing& cached) {
+        bool subdirectories = cached.level == FetchLevel::Full;
+        int dirfd = -1;
+        for (size_t i = 0; i < cached.entries.size(); i++) {
+            if (!cached.entries.isLink(i) && !(subdirectories && cached.entries.isDirectory(i))) {
+                continue;
+            }
+            if (dirfd < 0) {
+                dirfd = open(cached.key.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (dirfd < 0) return false;
+            }
+            // A vanished entry also queued an event, so the next lookup drops it
+            EntryInfo info;
+            if (DirectoryReader::statEntry(dirfd, cached.entries.name(i), info)) {
+                cached.entries.refresh(i, info);
+            }
+        }
+        if (dirfd >= 0) close(dirfd);
+        return true;
+    }
+    
+    static bool identify(const string& key, uint64_t& device, uint64_t& inode) {
+        struct stat st;
+        Metrics::add(Metric::StatCalls);
+        if (stat(key.c_str(), &st) != 0) {
+            return false;
+        }
+        device = static_cast<uint64_t>(st.st_dev);
+        inode = static_cast<uint64_t>(st.st_ino);
+        return true;
+    }
+    
+    // Remote changes never reach inotify on network filesystems
+    static bool isNetworkFilesystem(const fs::path& dirPath) {
+        struct statfs info;
+        if (statfs(dirPath.c_str(), &info) != 0) {
+            return true;
+        }
+        switch (static_cast<unsigned long>(info.f_type)) {
+            case 0x6969:        // NFS
+            case 0x517B:        // SMB
+            case 0xFF534D42:    // CIFS
+            case 0xFE534D42:    // SMB2
+            case 0x65735546:    // FUSE
+            case 0x01021997:    // 9P
+                return true;
+            default:
+                return false;
+        }
+    }
+    #endif
+    
+public:
+    explicit DirectoryCache(size_t capacityBytes = 64 * 1024 * 1024) : capacityBytes(capacityBytes) {
+        #ifdef __linux__
+        notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        #endif
+    }
+    
+    ~DirectoryCache() {
+        clear();
+        #ifdef __linux__
+        if (notifyFd >= 0) {
+            close(notifyFd);
+        }
+        #endif
+    }
+    
+    DirectoryCache(const DirectoryCache&) = delete;
+    DirectoryCache& operator=(const DirectoryCache&) = delete;
+    
+    bool enabled() const { return notifyFd >= 0; }
+    
+    void clear() {
+        while (!lru.empty()) {
+            erase(prev(lru.end()), true);
+        }
+    }
+    
+    // Copies a cached listing that covers the request into `entries`
+    bool lookup(const fs::path& dirPath, bool showHidden, bool dirsOnly, FetchLevel level, EntryTable& entries) {
+        if (!enabled()) {
+            return false;
+        }
+        drainEvents();
+        
+        auto it = byPath.find(dirPath.string());
+        if (it == byPath.end()) {
+            return false;
+        }
+        
+        CachedListing& cached = *it->second;
+        if ((showHidden && !cached.showHidden) || (cached.dirsOnly && !dirsOnly) || cached.level < level) {
+            return false;
+        }
+        #ifdef __linux__
+        uint64_t device = 0;
+        uint64_t inode = 0;
+        if (!identify(cached.key, device, inode) || device != cached.device || inode != cached.inode ||
+            !refreshUnwatched(cached)) {
+            erase(it->second, true);
+            return false;
+        }
+        #endif
+        
+        entries.clear();
+        for (size_t i = 0; i < cached.entries.size(); i++) {
+            if ((!showHidden && cached.entries.isHidden(i)) || (dirsOnly && !cached.entries.isDirectory(i))) {
+                continue;
+            }
+            entries.addFrom(cached.entries, i);
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        return true;
+    }
+    
+    // Reads through the cache; the watch is placed before the directory is
+    // read so that changes racing with the read still invalidate it
+    void read(const fs::path& dirPath, bool showHidden, bool dirsOnly, FetchLevel level, EntryTable& entries) {
+        if (lookup(dirPath, showHidden, dirsOnly, level, entries)) {
+            return;
+        }
+        
+        #ifdef __linux__
+        if (!enabled() || isNetworkFilesystem(dirPath)) {
+            DirectoryReader::read(dirPath, showHidden, dirsOnly, level, entries);
+            return;
+        }
+        
+        string key = dirPath.string();
+        auto stale = byPath.find(key);
+        if (stale != byPath.end()) {
+            erase(stale->second, false);
+        }
+        
+        // Identified before the watch is placed, so a directory swapped in
+        // between the two fails the check on its next lookup
+        uint64_t device = 0;
+        uint64_t inode = 0;
+        bool identified = identify(key, device, inode);
+        uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB |
+                        IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+        int watch = identified ? inotify_add_watch(notifyFd, key.c_str(), mask) : -1;
+        try {
+            DirectoryReader::read(dirPath, showHidden, dirsOnly, level, entries);
+        } catch (...) {
+            if (watch >= 0 && !byWatch.count(watch)) {
+                inotify_rm_watch(notifyFd, watch);
+            }
+            throw;
+        }
+        
+        // Out of watches, or the same inode is already cached under another path
+        if (watch < 0 || byWatch.count(watch)) {
+            return;
+        }
+        
+        size_t bytes = estimateBytes(key, entries);
+        if (bytes > capacityBytes) {
+            inotify_rm_watch(notifyFd, watch);
+            return;
+        }
+        while (usedBytes + bytes > capacityBytes && !lru.empty()) {
+            erase(prev(lru.end()), true);
+        }
+        
+        lru.push_front(CachedListing{key, entries, showHidden, dirsOnly, level, bytes, watch, device, inode});
+        byPath[key] = lru.begin();
+        byWatch[watch] = lru.begin();
+        usedBytes += bytes;
+        #else
+        DirectoryReader::read(dirPath, showHidden, dirsOnly, level, entries);
+        #endif
+    }
+};
+
+// Fixed set of worker threads, each with its own task deque. Workers pop
+// their own newest task first and steal the oldest task of another worker
+// when they run dry, so deep and wide trees both keep every thread busy.
+class WorkStealingPool {
+private:
+    struct Worker {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+    
+    vector<unique_ptr<Worker>> workers;
+    vector<thread> threads;
+    mutex idleLock;
+    condition_variable idleSignal;
+    atomic<size_t> queued{0};
+    atomic<size_t> nextWorker{0};
+    bool stopping = false;
+    
+    static thread_local WorkStealingPool* currentPool;
+    static thread_local size_t currentIndex;
+    
+    bool popTask(size_t index, function<void()>& task) {
+        // Own deque from the back (depth-first, cache friendly)
+        {
+            Worker& self = *workers[index];
+            lock_guard<mutex> guard(self.lock);
+            if (!self.tasks.empty()) {
+                task = move(self.tasks.back());
+                self.tasks.pop_back();
+                queued--;
+                return true;
+            }
+        }
+        
+        // Steal from the front of the others (oldest, usually the biggest subtree)
+        for (size_t offset = 1; offset < workers.size(); offset++) {
+            Worker& victim = *workers[(index + offset) % workers.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    void workerLoop(size_t index) {
+        currentPool = this;
+        currentIndex = index;
+        
+        function<void()> task;
+        while (true) {
+            if (popTask(index, task)) {
+                task();
+                task = nullptr;
+                continue;
+            }
+            
+            unique_lock<mutex> guard(idleLock);
+            idleSignal.wait(guard, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0) {
+                return;
+            }
+        }
+    }
+    
+public:
+    explicit WorkStealingPool(size_t threadCount) {
+        threadCount = max<size_t>(threadCount, 1);
+        for (size_t i = 0; i < threadCount; i++) {
+            workers.push_back(make_unique<Worker>());
+        }
+        for (size_t i = 0; i < threadCount; i++) {
+            threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+        }
+    }
+    
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> guard(idleLock);
+            stopping = true;
+        }
+        idleSignal.notify_all();
+        for (auto& worker : threads) {
+            worker.join();
+        }
+    }
+    
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+    
+    // Tasks submitted from a worker go to that worker's own deque
+    void submit(function<void()> task) {
+        size_t index = (currentPool == this) ? currentIndex : nextWorker++ % workers.size();
+        {
+            lock_guard<mutex> guard(workers[index]->lock);
+            workers[index]->tasks.push_back(move(task));
+        }
+        {
+            lock_guard<mutex> guard(idleLock);
+            queued++;
+        }
+        idleSignal.notify_one();
+    }
+    
+    size_t size() const { return threads.size(); }
+    
+    // True on this pool's own workers, which must not block on its tasks
+    bool isWorkerThread() const { return currentPool == this; }
+    
+    // Directory reads block on I/O far more than on CPU, so the shared pool
+    // oversubscribes the cores to keep network filesystems saturated
+    static WorkStealingPool& shared() {
+        static WorkStealingPool pool(clamp<size_t>(thread::hardware_concurrency() * 2, 4, 64));
+        return pool;
+    }
+};
+
+thread_local WorkStealingPool* WorkStealingPool::currentPool = nullptr;
+thread_local size_t WorkStealingPool::currentIndex = 0;
+
+// Tracks one batch of tasks on a pool so callers can wait for just their own
+// work; the first exception thrown by a task is rethrown from wait(). The
+// destructor waits for pending tasks, so owners declare their group last:
+// it then drains before the members its tasks use are destroyed.
+class TaskGroup {
+private:
+    WorkStealingPool& pool;
+    size_t pending = 0;
+    exception_ptr firstError;
+    mutex lock;
+    condition_variable finished;
+    
+public:
+    explicit TaskGroup(WorkStealingPool& pool) : pool(pool) {}
+    
+    ~TaskGroup() {
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [this] { return pending == 0; });
+    }
+    
+    void submit(function<void()> task) {
+        {
+            lock_guard<mutex> guard(lock);
+            pending++;
+        }
+        pool.submit([this, task = move(task)] {
+            exception_ptr error;
+            try {
+                task();
+            } catch (...) {
+                error = current_exception();
+            }
+            
+            lock_guard<mutex> guard(lock);
+            if (error && !firstError) {
+                firstError = error;
+            }
+            if (--pending == 0) {
+                finished.notify_all();
+            }
+        });
+    }
+    
+    // Waits up to `timeout`; returns true (or rethrows) once everything is done
+    bool waitFor(chrono::milliseconds timeout) {
+        unique_lock<mutex> guard(lock);
+        if (!finished.wait_for(guard, timeout, [this] { return pending == 0; })) {
+            return false;
+        }
+        if (firstError) {
+            exception_ptr error = firstError;
+            firstError = nullptr;
+            rethrow_exception(error);
+        }
+        return true;
+    }
+    
+    // Must not be called from a task of the same pool
+    void wait() {
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [this] { return pending == 0; });
+        if (firstError) {
+            exception_ptr error = firstError;
+            firstError = nullptr;
+            rethrow_exception(error);
+        }
+    }
+};
+
+// Thrown by an engine that noticed its TransferProgress was cancelled
+class OperationCancelled : public runtime_error {
+public:
+    OperationCancelled() : runtime_error("Operation cancelled") {}
+};
+
+// Counters shared between a running transfer and whoever reports on it
+struct TransferProgress {
+    atomic<uint64_t> bytes{0};
+    atomic<uint64_t> files{0};
+    atomic<uint64_t> directories{0};
+    atomic<uint64_t> totalBytes{0};     // expected totals, 0 while unknown
+    atomic<uint64_t> totalFiles{0};
+    atomic<bool> cancelled{false};      // engines stop at their next safe point
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    
+    double seconds() const {
+        return chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    }
+    
+    double bytesPerSecond() const {
+        double elapsed = seconds();
+        return elapsed > 0 ? bytes / elapsed : 0;
+    }
+    
+    // Seconds left at the average rate so far, by bytes when the total size
+    // is known and by files otherwise; negative while there is no estimate
+    double secondsLeft() const {
+        double elapsed = seconds();
+        uint64_t done = totalBytes ? bytes.load() : files.load();
+        uint64_t total = totalBytes ? totalBytes.load() : totalFiles.load();
+        if (total == 0 || done == 0 || elapsed <= 0) {
+            return -1;
+        }
+        return done >= total ? 0 : (total - done) * elapsed / done;
+    }
+    
+    void checkCancelled() const {
+        if (cancelled) {
+            throw OperationCancelled();
+        }
+    }
+};
+
+// XXH64 from the xxHash family, built in. Input is consumed in 32-byte
+// stripes by four independent lanes, which keeps several multipliers busy
+// at once and lets the compiler vectorize; data may arrive in pieces.
+class XxHash64 {
+private:
+    static constexpr uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    static constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    static constexpr uint64_t prime3 = 0x165667B19E3779F9ULL;
+    static constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+    static constexpr uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+    
+    uint64_t seed;
+    uint64_t lanes[4];
+    unsigned char pending[32];
+    size_t pendingLength = 0;
+    uint64_t totalLength = 0;
+    
+    static uint64_t rotate(uint64_t value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+    
+    // Little-endian loads, as on every platform the explorer targets
+    static uint64_t load64(const unsigned char* data) {
+        uint64_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    
+    static uint32_t load32(const unsigned char* data) {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    
+    static uint64_t round(uint64_t accumulator, uint64_t input) {
+        accumulator += input * prime2;
+        return rotate(accumulator, 31) * prime1;
+    }
+    
+    static uint64_t merge(uint64_t hash, uint64_t lane) {
+        hash ^= round(0, lane);
+        return hash * prime1 + prime4;
+    }
+    
+    void consume(const unsigned char* stripe) {
+        lanes[0] = round(lanes[0], load64(stripe));
+        lanes[1] = round(lanes[1], load64(stripe + 8));
+        lanes[2] = round(lanes[2], load64(stripe + 16));
+        lanes[3] = round(lanes[3], load64(stripe + 24));
+    }
+    
+public:
+    explicit XxHash64(uint64_t seed = 0)
+        : seed(seed), lanes{seed + prime1 + prime2, seed + prime2, seed, seed - prime1} {}
+    
+    void update(const void* data, size_t length) {
+        const unsigned char* input = static_cast<const unsigned char*>(data);
+        totalLength += length;
+        
+        if (pendingLength > 0) {
+            size_t take = min(length, sizeof(pending) - pendingLength);
+            memcpy(pending + pendingLength, input, take);
+            pendingLength += take;
+            input += take;
+            length -= take;
+            if (pendingLength < sizeof(pending)) return;
+            consume(pending);
+            pendingLength = 0;
+        }
+        for (; length >= 32; input += 32, length -= 32) {
+            consume(input);
+        }
+        memcpy(pending, input, length);
+        pendingLength = length;
+    }
+    
+    uint64_t digest() const {
+        uint64_t hash;
+        if (totalLength >= 32) {
+            hash = rotate(lanes[0], 1) + rotate(lanes[1], 7) + rotate(lanes[2], 12) + rotate(lanes[3], 18);
+            for (uint64_t lane : lanes) {
+                hash = merge(hash, lane);
+            }
+        } else {
+            hash = seed + prime5;
+        }
+        hash += totalLength;
+        
+        const unsigned char* tail = pending;
+        size_t remaining = pendingLength;
+        for (; remaining >= 8; tail += 8, remaining -= 8) {
+            hash ^= round(0, load64(tail));
+            hash = rotate(hash, 27) * prime1 + prime4;
+        }
+        if (remaining >= 4) {
+            hash ^= load32(tail) * prime1;
+            hash = rotate(hash, 23) * prime2 + prime3;
+            tail += 4;
+            remaining -= 4;
+        }
+        for (; remaining > 0; tail++, remaining--) {
+            hash ^= *tail * prime5;
+            hash = rotate(hash, 11) * prime1;
+        }
+        
+        hash ^= hash >> 33;
+        hash *= prime2;
+        hash ^= hash >> 29;
+        hash *= prime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+    
+    static uint64_t of(const void* data, size_t length) {
+        XxHash64 hasher;
+        hasher.update(data, length);
+        return hasher.digest();
+    }
+};
+
+// One line of a checksum manifest
+struct ChecksumEntry {
+    fs::path path;
+    uint64_t size;
+    uint64_t hash;              // XXH64 of the whole file
+};
+
+// Fixed-capacity queue between pipeline stages; push blocks while full,
+// pop blocks while empty, and close() wakes everyone up for shutdown
+template <typename T>
+class BoundedQueue {
+private:
+    deque<T> items;
+    size_t capacity;
+    bool closed = false;
+    mutex lock;
+    condition_variable notFull;
+    condition_variable notEmpty;
+    
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+    
+    // Returns false if the queue was closed before the item fit
+    bool push(T item) {
+        unique_lock<mutex> guard(lock);
+        notFull.wait(guard, [this] { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+    
+    // Returns false once the queue is closed and drained
+    bool pop(T& item) {
+        unique_lock<mutex> guard(lock);
+        notEmpty.wait(guard, [this] { return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        item = move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+    
+    void close() {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+};
+
+// Parallel tree copy. The task that discovers a directory creates it on the
+// destination before queueing its children, so file workers never race ahead
+// of their parent. Data moves inside the kernel where possible: reflink
+// (FICLONE), then copy_file_range, then sendfile, then a buffered copy.
+// Large files are split into ranges copied by several workers at once.
+// In verifying mode data goes through userspace instead, so that it can
+// be hashed on the way (see copyHashed).
+class CopyEngine {
+private:
+    static constexpr uint64_t chunkBytes = 64ull * 1024 * 1024;
+    static constexpr uint64_t splitThreshold = 4 * chunkBytes;
+    static constexpr uint64_t sliceBytes = 16ull * 1024 * 1024;    // most one kernel copy call moves
+    static constexpr size_t bufferBytes = 1024 * 1024;
+    static constexpr uint64_t pipelineBytes = 8 * bufferBytes;     // smaller files are copied in one loop
+    static constexpr size_t pipelineBlocks = 8;
+    
+    TaskGroup group;
+    TransferProgress& progress;
+    atomic<bool> failed{false};
+    bool verifying = false;
+    mutex checksumsLock;
+    vector<ChecksumEntry> checksums;
+    atomic<bool> cloneUnsupported{false};
+    atomic<bool> rangeUnsupported{false};
+    mutex deferredLock;
+    vector<pair<fs::path, unsigned int>> deferredModes;    // read-only dirs, chmod'ed last
+    
+    void record(const fs::path& destination, uint64_t size, uint64_t hash) {
+        lock_guard<mutex> guard(checksumsLock);
+        checksums.push_back({destination, size, hash});
+    }
+    
+    // Guards a task so that the first failure or a cancel stops queued work early
+    template <typename Task>
+    void submit(Task task) {
+        group.submit([this, task = move(task)]() mutable {
+            if (failed || progress.cancelled) {
+                return;
+            }
+            try {
+                task();
+            } catch (...) {
+                failed = true;
+                throw;
+            }
+        });
+    }
+    
+#ifdef _WIN32
+    void copyFile(const fs::path& source, const fs::path& destination) {
+        progress.checkCancelled();
+        if (verifying) {
+            copyHashed(source, destination);
+            return;
+        }
+        fs::copy_file(source, destination, fs::copy_options::overwrite_existing);
+        uint64_t size = fs::file_size(destination);
+        progress.bytes += size;
+        Metrics::add(Metric::BytesRead, size);
+        Metrics::add(Metric::BytesWritten, size);
+        progress.files++;
+    }
+    
+    // Read, hash and write in one loop; Windows has no pipelined variant
+    void copyHashed(const fs::path& source, const fs::path& destination) {
+        ifstream input(source, ios::binary);
+        if (!input) fail("Cannot open file", source, EIO);
+        ofstream output(destination, ios::binary | ios::trunc);
+        if (!output) fail("Cannot create file", destination, EIO);
+        
+        vector<char> buffer(bufferBytes);
+        XxHash64 hasher;
+        uint64_t total = 0;
+        while (input) {
+            progress.checkCancelled();
+            input.read(buffer.data(), static_cast<streamsize>(buffer.size()));
+            streamsize got = input.gcount();
+            if (got <= 0) break;
+            hasher.update(buffer.data(), static_cast<size_t>(got));
+            output.write(buffer.data(), got);
+            total += static_cast<uint64_t>(got);
+            progress.bytes += static_cast<uint64_t>(got);
+            Metrics::add(Metric::BytesRead, static_cast<uint64_t>(got));
+            Metrics::add(Metric::BytesWritten, static_cast<uint64_t>(got));
+        }
+        output.flush();
+        if (!output) fail("Cannot write file", destination, EIO);
+        progress.files++;
+        record(destination, total, hasher.digest());
+    }
+    
+    void copyDirectory(const fs::path& source, const fs::path& destination) {
+        fs::create_directories(destination);
+        progress.directories++;
+        for (const auto& entry : fs::directory_iterator(source)) {
+            fs::path target = destination / entry.path().filename();
+            if (entry.is_directory()) {
+                submit([this, from = entry.path(), target] { copyDirectory(from, target); });
+            } else {
+                submit([this, from = entry.path(), target] { copyFile(from, target); });
+            }
+        }
+    }
+#else
+    // Shared by the range tasks of one split file; closes both ends last
+    // and removes the destination unless every piece was copied, so a
+    // failed or cancelled copy never leaves a truncated file behind
+    struct OpenPair {
+        int in;
+        int out;
+        fs::path destination;
+        atomic<uint64_t> unfinished;
+        ~OpenPair() {
+            close(in);
+            close(out);
+            if (unfinished > 0) {
+                unlink(destination.c_str());
+            }
+        }
+    };
+    
+    static bool unsupported(int error) {
+        return error == EXDEV || error == ENOSYS || error == EINVAL || error == EOPNOTSUPP || error == ENOTTY;
+    }
+    
+    static void writeAll(int out, const char* data, size_t length, uint64_t offset, const fs::path& destination) {
+        for (size_t done = 0; done < length;) {
+            ssize_t put = pwrite(out, data + done, length - done, static_cast<off_t>(offset + done));
+            if (put < 0 && errno == EINTR) continue;
+            if (put < 0) fail("Cannot write file", destination, errno);
+            done += put;
+        }
+    }
+    
+    // Copies a whole file while hashing it, with no second read of either
+    // side. Above pipelineBytes the steps overlap: this task reads into
+    // recycled blocks while a hashing thread and a writing thread follow it
+    // through bounded queues. Returns the XXH64 of the data written.
+    uint64_t copyHashed(int in, int out, uint64_t size, const fs::path& source, const fs::path& destination) {
+        XxHash64 hasher;
+        uint64_t offset = 0;
+        
+        if (size < pipelineBytes) {
+            vector<char> buffer(bufferBytes);
+            while (true) {
+                progress.checkCancelled();
+                ssize_t got = pread(in, buffer.data(), buffer.size(), static_cast<off_t>(offset));
+                if (got < 0 && errno == EINTR) continue;
+                if (got < 0) fail("Cannot read file", source, errno);
+                if (got == 0) break;
+                hasher.update(buffer.data(), static_cast<size_t>(got));
+                writeAll(out, buffer.data(), static_cast<size_t>(got), offset, destination);
+                offset += got;
+                progress.bytes += got;
+                Metrics::add(Metric::BytesRead, got);
+                Metrics::add(Metric::BytesWritten, got);
+            }
+            if (offset != size) fail("Source changed while it was copied", source, EIO);
+            return hasher.digest();
+        }
+        
+        struct Block {
+            unique_ptr<vector<char>> data;
+            size_t length = 0;
+        };
+        BoundedQueue<Block> freeBlocks(pipelineBlocks);
+        BoundedQueue<Block> toHash(pipelineBlocks);
+        BoundedQueue<Block> toWrite(pipelineBlocks);
+        for (size_t i = 0; i < pipelineBlocks; i++) {
+            freeBlocks.push(Block{make_unique<vector<char>>(bufferBytes), 0});
+        }
+        auto stopAll = [&] {
+            freeBlocks.close();
+            toHash.close();
+            toWrite.close();
+        };
+        
+        thread hashing([&] {
+            Block block;
+            while (toHash.pop(block)) {
+                hasher.update(block.data->data(), block.length);
+                if (!toWrite.push(move(block))) break;
+            }
+            toWrite.close();
+        });
+        
+        exception_ptr writeError;
+        thread writing([&] {
+            Block block;
+            uint64_t written = 0;
+            try {
+                while (toWrite.pop(block)) {
+                    writeAll(out, block.data->data(), block.length, written, destination);
+                    written += block.length;
+                    progress.bytes += block.length;
+                    Metrics::add(Metric::BytesWritten, block.length);
+                    freeBlocks.push(move(block));
+                }
+            } catch (...) {
+                writeError = current_exception();
+                stopAll();
+            }
+        });
+        
+        exception_ptr readError;
+        try {
+            Block block;
+            while (freeBlocks.pop(block)) {
+                progress.checkCancelled();
+                ssize_t got = pread(in, block.data->data(), block.data->size(), static_cast<off_t>(offset));
+                if (got < 0 && errno == EINTR) {
+                    freeBlocks.push(move(block));
+                    continue;
+                }
+                if (got < 0) fail("Cannot read file", source, errno);
+                if (got == 0) break;
+                block.length = static_cast<size_t>(got);
+                offset += got;
+                Metrics::add(Metric::BytesRead, got);
+                if (!toHash.push(move(block))) break;
+            }
+        } catch (...) {
+            readError = current_exception();
+            stopAll();
+        }
+        toHash.close();
+        hashing.join();
+        writing.join();
+        
+        if (readError) rethrow_exception(readError);
+        if (writeError) rethrow_exception(writeError);
+        if (offset != size) fail("Source changed while it was copied", source, EIO);
+        return hasher.digest();
+    }
+    
+    // Position-independent copy of [offset, offset + length); safe to run
+    // concurrently on disjoint ranges of the same descriptors
+    void copyRange(int in, int out, uint64_t offset, uint64_t length, const fs::path& source) {
+        #ifdef __linux__
+        if (!rangeUnsupported) {
+            loff_t inOffset = static_cast<loff_t>(offset);
+            loff_t outOffset = inOffset;
+            while (length > 0) {
+                progress.checkCancelled();
+                ssize_t copied = copy_file_range(in, &inOffset, out, &outOffset, min(length, sliceBytes), 0);
+                if (copied < 0) {
+                    if (errno == EINTR) continue;
+                    if (!unsupported(errno) || inOffset != static_cast<loff_t>(offset)) {
+                        fail("Cannot copy file", source, errno);
+                    }
+                    rangeUnsupported = true;
+                    break;
+                }
+                if (copied == 0) break;     // EOF, or a filesystem that reports none; pread tells which
+                length -= copied;
+                progress.bytes += copied;
+                Metrics::add(Metric::BytesRead, copied);
+                Metrics::add(Metric::BytesWritten, copied);
+            }
+            if (length == 0) return;
+            offset = static_cast<uint64_t>(inOffset);
+        }
+        #endif
+        
+        vector<char> buffer(bufferBytes);
+        while (length > 0) {
+            progress.checkCancelled();
+            ssize_t got = pread(in, buffer.data(), static_cast<size_t>(min<uint64_t>(length, bufferBytes)), static_cast<off_t>(offset));
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0) fail("Cannot read file", source, errno);
+            if (got == 0) fail("Source changed while it was copied", source, EIO);
+            for (ssize_t done = 0; done < got;) {
+                ssize_t put = pwrite(out, buffer.data() + done, got - done, static_cast<off_t>(offset + done));
+                if (put < 0 && errno == EINTR) continue;
+                if (put < 0) fail("Cannot write file", source, errno);
+                done += put;
+            }
+            offset += got;
+            length -= got;
+            progress.bytes += got;
+            Metrics::add(Metric::BytesRead, got);
+            Metrics::add(Metric::BytesWritten, got);
+        }
+    }
+    
+    // Whole-file copy through the cheapest path the filesystems allow
+    void copyData(int in, int out, uint64_t size, const fs::path& source) {
+        #ifdef __linux__
+        if (rangeUnsupported) {
+            // sendfile still avoids the userspace copy between filesystems
+            // that refuse copy_file_range
+            uint64_t remaining = size;
+            while (remaining > 0) {
+                progress.checkCancelled();
+                ssize_t sent = sendfile(out, in, nullptr, min(remaining, sliceBytes));
+                if (sent < 0 && errno == EINTR) continue;
+                if (sent <= 0) break;
+                remaining -= sent;
+                progress.bytes += sent;
+                Metrics::add(Metric::BytesRead, sent);
+                Metrics::add(Metric::BytesWritten, sent);
+            }
+            if (remaining > 0) {
+                copyRange(in, out, size - remaining, remaining, source);
+            }
+            return;
+        }
+        #endif
+        copyRange(in, out, 0, size, source);
+    }
+    
+    void copyFile(const fs::path& source, const fs::path& destination) {
+        int in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) fail("Cannot open file", source, errno);
+        struct stat st;
+        Metrics::add(Metric::StatCalls);
+        if (fstat(in, &st) != 0) {
+            int error = errno;
+            close(in);
+            fail("Cannot stat file", source, error);
+        }
+        
+        int out = open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+        if (out < 0) {
+            int error = errno;
+            close(in);
+            fail("Cannot create file", destination, error);
+        }
+        auto files = shared_ptr<OpenPair>(new OpenPair{in, out, destination, 1});
+        uint64_t size = static_cast<uint64_t>(st.st_size);
+        
+        // A file counts as copied only once its last byte is written
+        if (verifying) {
+            uint64_t hash = copyHashed(in, out, size, source, destination);
+            // A source rewritten during the copy would make the hash meaningless
+            struct stat after;
+            Metrics::add(Metric::StatCalls);
+            if (fstat(in, &after) != 0 || after.st_size != st.st_size || after.st_mtime != st.st_mtime) {
+                fail("Source changed while it was copied", source, EIO);
+            }
+            if (fdatasync(out) != 0) fail("Cannot sync file", destination, errno);
+            files->unfinished = 0;
+            progress.files++;
+            record(destination, size, hash);
+            return;
+        }
+        
+        #ifdef __linux__
+        // Reflink shares the extents, so even huge files finish instantly
+        if (!cloneUnsupported) {
+            if (ioctl(out, FICLONE, in) == 0) {
+                progress.bytes += size;
+                files->unfinished = 0;
+                progress.files++;
+                return;
+            }
+            if (unsupported(errno)) cloneUnsupported = true;
+        }
+        #endif
+        
+        if (size < splitThreshold) {
+            copyData(in, out, size, source);
+            files->unfinished = 0;
+            progress.files++;
+            return;
+        }
+        
+        // Big file: size the destination once, then copy ranges in parallel
+        if (ftruncate(out, static_cast<off_t>(size)) != 0) fail("Cannot create file", destination, errno);
+        files->unfinished = (size + chunkBytes - 1) / chunkBytes;
+        for (uint64_t offset = 0; offset < size; offset += chunkBytes) {
+            uint64_t length = min(chunkBytes, size - offset);
+            submit([this, files, offset, length, source] {
+                copyRange(files->in, files->out, offset, length, source);
+                if (--files->unfinished == 0) progress.files++;
+            });
+        }
+    }
+    
+    void copyDirectory(const fs::path& source, const fs::path& destination, unsigned int mode) {
+        // Create writable first; read-only modes are restored at the end
+        if (mkdir(destination.c_str(), (mode & 07777) | S_IRWXU) != 0 && errno != EEXIST) {
+            fail("Cannot create directory", destination, errno);
+        }
+        if ((mode & S_IRWXU) != S_IRWXU) {
+            lock_guard<mutex> guard(deferredLock);
+            deferredModes.emplace_back(destination, mode & 07777);
+        }
+        progress.directories++;
+        
+        int dirfd = DirectoryReader::openDirectory(source);
+        unique_ptr<int, void (*)(int*)> closer(&dirfd, [](int* fd) { close(*fd); });
+        DirectoryReader::scan(dirfd, source, [&](const char* name, unsigned char type) {
+            fs::path from = source / name;
+            fs::path to = destination / name;
+            
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                Metrics::add(Metric::StatCalls);
+                if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+            }
+            
+            if (type == DT_DIR) {
+                struct stat st;
+                Metrics::add(Metric::StatCalls);
+                if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) fail("Cannot stat directory", from, errno);
+                submit([this, from, to, mode = st.st_mode] { copyDirectory(from, to, mode); });
+            } else if (type == DT_LNK) {
+                copySymlink(dirfd, name, from, to);
+            } else {
+                submit([this, from, to] { copyFile(from, to); });
+            }
+        });
+    }
+    
+    void copySymlink(int sourceDir, const char* name, const fs::path& source, const fs::path& destination) {
+        char target[PATH_MAX];
+        ssize_t length = readlinkat(sourceDir, name, target, sizeof(target) - 1);
+        if (length < 0) fail("Cannot read link", source, errno);
+        target[length] = '\0';
+        unlink(destination.c_str());
+        if (symlink(target, destination.c_str()) != 0) fail("Cannot create link", destination, errno);
+        progress.files++;
+    }
+#endif
+    
+public:
+    CopyEngine(WorkStealingPool& pool, TransferProgress& progress) : group(pool), progress(progress) {}
+    
+    // Hashes every file while copying it (no reflinks or kernel copies) and
+    // syncs it to disk; the results are available from manifest()
+    void verifyWhileCopying() {
+        verifying = true;
+    }
+    
+    // Checksums of the copied files, valid once the copy has finished
+    vector<ChecksumEntry> manifest() {
+        lock_guard<mutex> guard(checksumsLock);
+        return checksums;
+    }
+    
+    // Starts copying `source` to `destination`; overwrites existing files
+    // and merges into existing directories like fs::copy_options::overwrite_existing
+    void start(const fs::path& source, const fs::path& destination) {
+        #ifdef _WIN32
+        if (fs::is_directory(source)) {
+            submit([this, source, destination] { copyDirectory(source, destination); });
+        } else {
+            submit([this, source, destination] { copyFile(source, destination); });
+        }
+        #else
+        struct stat st;
+        Metrics::add(Metric::StatCalls);
+        if (lstat(source.c_str(), &st) != 0) fail("Cannot stat", source, errno);
+        if (S_ISDIR(st.st_mode)) {
+            submit([this, source, destination, mode = st.st_mode] { copyDirectory(source, destination, mode); });
+        } else if (S_ISLNK(st.st_mode)) {
+            int parent = DirectoryReader::openDirectory(source.parent_path().empty() ? fs::path(".") : source.parent_path());
+            try {
+                copySymlink(parent, source.filename().c_str(), source, destination);
+            } catch (...) {
+                close(parent);
+                throw;
+            }
+            close(parent);
+        } else {
+            submit([this, source, destination] { copyFile(source, destination); });
+        }
+        #endif
+    }
+    
+    // Waits up to `timeout`; true once finished, rethrows the first error
+    bool waitFor(chrono::milliseconds timeout) {
+        if (!group.waitFor(timeout)) {
+            return false;
+        }
+        finish();
+        return true;
+    }
+    
+    void wait() {
+        group.wait();
+        finish();
+    }
+    
+private:
+    void finish() {
+        #ifndef _WIN32
+        // Deepest first, so a read-only parent does not block its children
+        lock_guard<mutex> guard(deferredLock);
+        for (auto it = deferredModes.rbegin(); it != deferredModes.rend(); ++it) {
+            chmod(it->first.c_str(), it->second);
+        }
+        deferredModes.clear();
+        #endif
+    }
+};
+
+#ifndef _WIN32
+// Move across filesystems as a stream: a reader thread walks the source and
+// reads file data while a writer thread creates and writes the destination.
+// Sources are unlinked in small batches as soon as their copies are synced
+// and the source is still the file that was read (same inode, size and
+// mtime as at EOF), so extra disk use stays near one batch instead of the
+// whole tree, and an interrupted or raced move never loses data.
+class MovePipeline {
+private:
+    static constexpr size_t blockBytes = 1024 * 1024;
+    static constexpr size_t blockCount = 16;
+    static constexpr size_t batchFiles = 64;
+    static constexpr uint64_t batchBytes = 256ull * 1024 * 1024;
+    
+    enum class Step { MakeDirectory, OpenFile, Data, CloseFile, Symlink, RemoveDirectory };
+    
+    struct Message {
+        Step step;
+        fs::path source;
+        fs::path destination;
+        unsigned int mode = 0;
+        uint64_t size = 0;          // bytes read for CloseFile
+        unique_ptr<vector<char>> block;
+        size_t length = 0;
+        string linkTarget;
+        dev_t device = 0;           // CloseFile: the source as it was at EOF
+        ino_t inode = 0;
+        int64_t modified = 0;
+    };
+    
+    // A written file that is waiting for its batch to be confirmed
+    struct PendingFile {
+        fs::path source;
+        fs::path destination;
+        int fd;
+        uint64_t size;
+        dev_t device;
+        ino_t inode;
+        int64_t modified;
+    };
+    
+    static int64_t modifiedOf(const struct stat& st) {
+        #ifdef __APPLE__
+        return static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+        #else
+        return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        #endif
+    }
+    
+    TransferProgress& progress;
+    BoundedQueue<Message> messages{4096};
+    BoundedQueue<unique_ptr<vector<char>>> freeBlocks{blockCount};
+    atomic<bool> stopped{false};
+    exception_ptr readError;
+    exception_ptr writeError;
+    thread reader;
+    thread writer;
+    mutex doneLock;
+    condition_variable doneSignal;
+    int running = 0;
+    
+    vector<PendingFile> pending;
+    uint64_t pendingBytes = 0;
+    int outFd = -1;
+    fs::path currentDestination;
+    uint64_t written = 0;
+    
+    void send(Message message) {
+        if (!messages.push(move(message))) {
+            throw runtime_error("move cancelled");
+        }
+    }
+    
+    // The reader stops on errors and on a cancel from the progress owner
+    bool halted() const {
+        return stopped || progress.cancelled;
+    }
+    
+    // ---- reader side ----
+    
+    void readFile(const fs::path& source, const fs::path& destination) {
+        int in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) fail("Cannot open file", source, errno);
+        unique_ptr<int, void (*)(int*)> closer(&in, [](int* fd) { close(*fd); });
+        
+        struct stat st;
+        Metrics::add(Metric::StatCalls);
+        if (fstat(in, &st) != 0) fail("Cannot stat file", source, errno);
+        #ifdef __linux__
+        posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+        #endif
+        
+        Message open;
+        open.step = Step::OpenFile;
+        open.source = source;
+        open.destination = destination;
+        open.mode = st.st_mode & 07777;
+        send(move(open));
+        
+        uint64_t total = 0;
+        while (!halted()) {
+            unique_ptr<vector<char>> block;
+            if (!freeBlocks.pop(block)) return;
+            ssize_t got = ::read(in, block->data(), block->size());
+            if (got < 0 && errno == EINTR) {
+                freeBlocks.push(move(block));
+                continue;
+            }
+            if (got < 0) fail("Cannot read file", source, errno);
+            if (got == 0) {
+                freeBlocks.push(move(block));
+                break;
+            }
+            
+            total += got;
+            Metrics::add(Metric::BytesRead, static_cast<uint64_t>(got));
+            Message data;
+            data.step = Step::Data;
+            data.block = move(block);
+            data.length = static_cast<size_t>(got);
+            send(move(data));
+        }
+        
+        // A file cut short is never closed, so its source is never removed
+        if (halted()) {
+            return;
+        }
+        
+        // What was read is the whole file only if nothing changed it meanwhile
+        struct stat after;
+        Metrics::add(Metric::StatCalls);
+        if (fstat(in, &after) != 0) fail("Cannot stat file", source, errno);
+        if (static_cast<uint64_t>(after.st_size) != total || modifiedOf(after) != modifiedOf(st)) {
+            fail("Source changed while it was copied", source, EIO);
+        }
+        
+        Message closeFile;
+        closeFile.step = Step::CloseFile;
+        closeFile.source = source;
+        closeFile.destination = destination;
+        closeFile.size = total;
+        closeFile.device = after.st_dev;
+        closeFile.inode = after.st_ino;
+        closeFile.modified = modifiedOf(after);
+        send(move(closeFile));
+    }
+    
+    void readTree(const fs::path& source, const fs::path& destination, unsigned int mode) {
+        Message makeDirectory;
+        makeDirectory.step = Step::MakeDirectory;
+        makeDirectory.destination = destination;
+        makeDirectory.mode = mode;
+        send(move(makeDirectory));
+        
+        // Collect first: the scan buffer cannot be shared with the recursion
+        vector<pair<string, unsigned char>> children;
+        int dirfd = DirectoryReader::openDirectory(source);
+        unique_ptr<int, void (*)(int*)> closer(&dirfd, [](int* fd) { close(*fd); });
+        DirectoryReader::scan(dirfd, source, [&](const char* name, unsigned char type) {
+            children.emplace_back(name, type);
+        });
+        
+        for (auto& [name, type] : children) {
+            if (halted()) return;
+            struct stat st;
+            Metrics::add(Metric::StatCalls);
+            if (fstatat(dirfd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) fail("Cannot stat", source / name, errno);
+            
+            if (S_ISDIR(st.st_mode)) {
+                readTree(source / name, destination / name, st.st_mode & 07777);
+            } else if (S_ISLNK(st.st_mode)) {
+                char target[PATH_MAX];
+                ssize_t length = readlinkat(dirfd, name.c_str(), target, sizeof(target) - 1);
+                if (length < 0) fail("Cannot read link", source / name, errno);
+                Message link;
+                link.step = Step::Symlink;
+                link.source = source / name;
+                link.destination = destination / name;
+                link.linkTarget.assign(target, static_cast<size_t>(length));
+                send(move(link));
+            } else {
+                readFile(source / name, destination / name);
+            }
+        }
+        
+        Message removeDirectory;
+        removeDirectory.step = Step::RemoveDirectory;
+        removeDirectory.source = source;
+        removeDirectory.destination = destination;
+        removeDirectory.mode = mode;
+        send(move(removeDirectory));
+    }
+    
+    // ---- writer side ----
+    
+    // Syncs every pending copy and only then unlinks its source, unless the
+    // source was replaced, appended to or rewritten since it was read
+    void confirmPending() {
+        for (auto& file : pending) {
+            bool durable = fdatasync(file.fd) == 0;
+            int error = errno;
+            bool closed = close(file.fd) == 0;
+            if (!durable || !closed) fail("Cannot sync file", file.destination, durable ? errno : error);
+            
+            struct stat st;
+            Metrics::add(Metric::StatCalls);
+            if (lstat(file.source.c_str(), &st) != 0) fail("Cannot stat file", file.source, errno);
+            if (st.st_dev != file.device || st.st_ino != file.inode || static_cast<uint64_t>(st.st_size) != file.size ||
+                modifiedOf(st) != file.modified) {
+                fail("Source changed while it was copied", file.source, EIO);
+            }
+            if (unlink(file.source.c_str()) != 0) fail("Cannot remove source", file.source, errno);
+        }
+        pending.clear();
+        pendingBytes = 0;
+    }
+    
+    void handle(Message& message) {
+        switch (message.step) {
+            case Step::MakeDirectory:
+                if (mkdir(message.destination.c_str(), message.mode | S_IRWXU) != 0 && errno != EEXIST) {
+                    fail("Cannot create directory", message.destination, errno);
+                }
+                progress.directories++;
+                break;
+                
+            case Step::OpenFile:
+                outFd = open(message.destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, message.mode);
+                if (outFd < 0) fail("Cannot create file", message.destination, errno);
+                currentDestination = message.destination;
+                written = 0;
+                break;
+                
+            case Step::Data:
+                for (size_t done = 0; done < message.length;) {
+                    ssize_t put = ::write(outFd, message.block->data() + done, message.length - done);
+                    if (put < 0 && errno == EINTR) continue;
+                    if (put < 0) fail("Cannot write file", message.destination, errno);
+                    done += put;
+                }
+                written += message.length;
+                progress.bytes += message.length;
+                Metrics::add(Metric::BytesWritten, message.length);
+                freeBlocks.push(move(message.block));
+                break;
+                
+            case Step::CloseFile:
+                if (written != message.size) fail("Short write, source kept", message.source, EIO);
+                pending.push_back(PendingFile{message.source, message.destination, outFd, written,
+                                              message.device, message.inode, message.modified});
+                pendingBytes += written;
+                outFd = -1;
+                progress.files++;
+                if (pending.size() >= batchFiles || pendingBytes >= batchBytes) {
+                    confirmPending();
+                }
+                break;
+                
+            case Step::Symlink:
+                unlink(message.destination.c_str());
+                if (symlink(message.linkTarget.c_str(), message.destination.c_str()) != 0) {
+                    fail("Cannot create link", message.destination, errno);
+                }
+                if (unlink(message.source.c_str()) != 0) fail("Cannot remove source", message.source, errno);
+                progress.files++;
+                break;
+                
+            case Step::RemoveDirectory:
+                confirmPending();
+                if ((message.mode & S_IRWXU) != S_IRWXU) {
+                    chmod(message.destination.c_str(), message.mode);
+                }
+                if (rmdir(message.source.c_str()) != 0) fail("Cannot remove source directory", message.source, errno);
+                break;
+        }
+    }
+    
+    void finishStage(exception_ptr& error, exception_ptr caught) {
+        if (caught) {
+            error = caught;
+            stopped = true;
+            messages.close();
+            freeBlocks.close();
+        }
+        lock_guard<mutex> guard(doneLock);
+        running--;
+        doneSignal.notify_all();
+    }
+    
+public:
+    explicit MovePipeline(TransferProgress& progress) : progress(progress) {}
+    
+    ~MovePipeline() {
+        stopped = true;
+        messages.close();
+        freeBlocks.close();
+        if (reader.joinable()) reader.join();
+        if (writer.joinable()) writer.join();
+        for (auto& file : pending) close(file.fd);
+        if (outFd >= 0) close(outFd);
+    }
+    
+    void start(const fs::path& source, const fs::path& destination) {
+        struct stat st;
+        Metrics::add(Metric::StatCalls);
+        if (lstat(source.c_str(), &st) != 0) fail("Cannot stat", source, errno);
+        for (size_t i = 0; i < blockCount; i++) {
+            freeBlocks.push(make_unique<vector<char>>(blockBytes));
+        }
+        
+        running = 2;
+        reader = thread([this, source, destination, mode = st.st_mode] {
+            exception_ptr caught;
+            try {
+                if (S_ISDIR(mode)) {
+                    readTree(source, destination, mode & 07777);
+                } else {
+                    readFile(source, destination);
+                }
+            } catch (...) {
+                caught = stopped ? nullptr : current_exception();
+            }
+            messages.close();
+            finishStage(readError, caught);
+        });
+        
+        writer = thread([this] {
+            exception_ptr caught;
+            try {
+                Message message;
+                while (messages.pop(message)) {
+                    handle(message);
+                }
+                // Files already closed are complete even if the reader failed
+                confirmPending();
+                
+                // The reader stopped inside a file: drop the partial copy
+                if (outFd >= 0) {
+                    close(outFd);
+                    outFd = -1;
+                    unlink(currentDestination.c_str());
+                }
+            } catch (...) {
+                caught = current_exception();
+                
+                // Never leave a half-written file behind; its source is intact
+                if (outFd >= 0) {
+                    close(outFd);
+                    outFd = -1;
+                    unlink(currentDestination.c_str());
+                }
+            }
+            finishStage(writeError, caught);
+        });
+    }
+    
+    bool waitFor(chrono::milliseconds timeout) {
+        {
+            unique_lock<mutex> guard(doneLock);
+            if (!doneSignal.wait_for(guard, timeout, [this] { return running == 0; })) {
+                return false;
+            }
+        }
+        reader.join();
+        writer.join();
+        if (writeError) rethrow_exception(writeError);
+        if (readError) rethrow_exception(readError);
+        return true;
+    }
+};
+#endif
+
+// Parallel recursive delete. Every directory is opened relative to its
+// parent's descriptor and its entries are removed with unlinkat, so no full
+// path is ever built or resolved. Sibling subtrees are handed to other
+// workers while the descriptor budget allows; beyond it a worker finishes
+// the subtree itself. A directory is removed by whichever task finishes its
+// last child, through the parent descriptor that is still held open.
+class DeleteEngine {
+private:
+    TaskGroup group;
+    TransferProgress& progress;
+    atomic<bool> failed{false};
+    
+#ifdef _WIN32
+    void removeTree(const fs::path& path) {
+        vector<fs::path> subdirectories;
+        for (const auto& entry : fs::directory_iterator(path)) {
+            progress.checkCancelled();
+            if (entry.is_directory() && !entry.is_symlink()) {
+                subdirectories.push_back(entry.path());
+            } else {
+                fs::remove(entry.path());
+                progress.files++;
+            }
+        }
+        for (const auto& subdirectory : subdirectories) {
+            removeTree(subdirectory);
+        }
+        fs::remove(path);
+        progress.directories++;
+    }
+#else
+    struct Node {
+        Node* parent;
+        int fd;
+        string name;
+        atomic<int> pending{1};     // own scan + children handed to other tasks
+    };
+    
+    atomic<int> descriptorBudget;
+    Node anchor{nullptr, -1, ""};   // parent of the root, never removed
+    
+    bool acquireDescriptor() {
+        int available = descriptorBudget.load();
+        while (available > 0) {
+            if (descriptorBudget.compare_exchange_weak(available, available - 1)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    static vector<pair<string, unsigned char>> listEntries(int dirfd, const string& name) {
+        vector<pair<string, unsigned char>> entries;
+        DirectoryReader::scan(dirfd, fs::path(name), [&](const char* entry, unsigned char type) {
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                Metrics::add(Metric::StatCalls);
+                type = (fstatat(dirfd, entry, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode)) ? DT_DIR : DT_REG;
+            }
+            entries.emplace_back(entry, type);
+        });
+        return entries;
+    }
+    
+    // Depth-first removal of a subtree on the current thread
+    void removeInline(int parentFd, const string& name) {
+        int fd = openat(parentFd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) fail("Cannot open directory", name, errno);
+        unique_ptr<int, void (*)(int*)> closer(&fd, [](int* descriptor) { close(*descriptor); });
+        
+        for (const auto& [entry, type] : listEntries(fd, name)) {
+            progress.checkCancelled();
+            if (type == DT_DIR) {
+                removeInline(fd, entry);
+            } else {
+                if (unlinkat(fd, entry.c_str(), 0) != 0 && errno != ENOENT) fail("Cannot delete", entry, errno);
+                progress.files++;
+            }
+        }
+        
+        closer.reset();
+        if (unlinkat(parentFd, name.c_str(), AT_REMOVEDIR) != 0) fail("Cannot delete directory", name, errno);
+        progress.directories++;
+    }
+    
+    void removeNode(Node* node) {
+        try {
+            if (!failed) {
+                for (const auto& [entry, type] : listEntries(node->fd, node->name)) {
+                    progress.checkCancelled();
+                    if (type != DT_DIR) {
+                        if (unlinkat(node->fd, entry.c_str(), 0) != 0 && errno != ENOENT) fail("Cannot delete", entry, errno);
+                        progress.files++;
+                    } else if (acquireDescriptor()) {
+                        int fd = openat(node->fd, entry.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                        if (fd < 0) {
+                            descriptorBudget++;
+                            fail("Cannot open directory", entry, errno);
+                        }
+                        Node* child = new Node{node, fd, entry};
+                        node->pending++;
+                        group.submit([this, child] { removeNode(child); });
+                    } else {
+                        removeInline(node->fd, entry);
+                    }
+                }
+            }
+        } catch (...) {
+            failed = true;
+            release(node);
+            throw;
+        }
+        release(node);
+    }
+    
+    // Drops one reference; the last one closes the directory and removes it
+    void release(Node* node) {
+        while (node != &anchor && --node->pending == 0) {
+            close(node->fd);
+            descriptorBudget++;
+            Node* parent = node->parent;
+            int result = failed ? 0 : unlinkat(parent->fd, node->name.c_str(), AT_REMOVEDIR);
+            int error = errno;
+            string name = node->name;
+            delete node;
+            if (result != 0) {
+                failed = true;
+                release(parent);
+                fail("Cannot delete directory", name, error);
+            }
+            if (!failed) progress.directories++;
+            node = parent;
+        }
+    }
+    
+    static int defaultDescriptorBudget() {
+        // Leave most of the process limit to the rest of the explorer
+        long limit = sysconf(_SC_OPEN_MAX);
+        return static_cast<int>(clamp<long>(limit > 0 ? limit / 4 : 256, 16, 4096));
+    }
+#endif
+    
+public:
+    DeleteEngine(WorkStealingPool& pool, TransferProgress& progress)
+        : group(pool), progress(progress)
+        #ifndef _WIN32
+        , descriptorBudget(defaultDescriptorBudget())
+        #endif
+    {}
+    
+    #ifndef _WIN32
+    ~DeleteEngine() {
+        // Tasks still use the anchor descriptor until the group drains
+        try {
+            group.wait();
+        } catch (...) {
+        }
+        if (anchor.fd >= 0) close(anchor.fd);
+    }
+    #endif
+    
+    void start(const fs::path& directory) {
+        #ifdef _WIN32
+        group.submit([this, directory] { removeTree(directory); });
+        #else
+        fs::path parentPath = directory.parent_path().empty() ? fs::path(".") : directory.parent_path();
+        anchor.fd = DirectoryReader::openDirectory(parentPath);
+        string name = directory.filename().string();
+        int fd = openat(anchor.fd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) fail("Cannot open directory", directory.string(), errno);
+        descriptorBudget--;
+        Node* root = new Node{&anchor, fd, name};
+        group.submit([this, root] { removeNode(root); });
+        #endif
+    }
+    
+    bool waitFor(chrono::milliseconds timeout) {
+        return group.waitFor(timeout);
+    }
+};
+
+// Background jobs for long copies, moves and deletes. Jobs queue in order
+// and at most `slots` of them run at once, each on its own runner thread
+// driving engines on a private pool, so foreground commands that use the
+// shared pool never wait behind a job's tasks. The REPL thread only reads
+// the progress counters; cancelling sets the job's progress flag, which the
+// engines check between units of work.
+class JobScheduler {
+public:
+    enum class State { Queued, Running, Done, Failed, Cancelled };
+    
+    struct Job {
+        size_t id;
+        string command;
+        string verb;                // "Copying", "Moving" or "Deleting"
+        function<void(WorkStealingPool&, TransferProgress&)> work;
+        TransferProgress progress;
+        atomic<State> state{State::Queued};
+        string error;               // set before the state leaves Running
+        double seconds = 0;         // run time, likewise
+        
+        bool finished() const {
+            State current = state;
+            return current != State::Queued && current != State::Running;
+        }
+    };
+    
+private:
+    size_t slots;
+    size_t poolThreads;
+    unique_ptr<WorkStealingPool> pool;
+    vector<thread> runners;
+    deque<shared_ptr<Job>> queue;
+    vector<shared_ptr<Job>> jobs;   // every job not yet reported to the user
+    size_t nextId = 1;
+    bool stopping = false;
+    mutex lock;
+    condition_variable wakeRunner;
+    condition_variable jobFinished;
+    
+    void runnerLoop() {
+        while (true) {
+            shared_ptr<Job> job;
+            {
+                unique_lock<mutex> guard(lock);
+                wakeRunner.wait(guard, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                job = move(queue.front());
+                queue.pop_front();
+                if (job->progress.cancelled) {
+                    job->state = State::Cancelled;
+                    jobFinished.notify_all();
+                    continue;
+                }
+                job->progress.started = chrono::steady_clock::now();
+                job->state = State::Running;
+            }
+            
+            State result = State::Done;
+            string error;
+            try {
+                job->work(*pool, job->progress);
+            } catch (const OperationCancelled&) {
+                result = State::Cancelled;
+            } catch (const exception& e) {
+                result = State::Failed;
+                error = e.what();
+            }
+            if (result != State::Failed && job->progress.cancelled) {
+                result = State::Cancelled;
+            }
+            
+            {
+                lock_guard<mutex> guard(lock);
+                job->work = nullptr;
+                job->error = error;
+                job->seconds = job->progress.seconds();
+                job->state = result;
+            }
+            jobFinished.notify_all();
+        }
+    }
+    
+public:
+    JobScheduler(size_t slots, size_t poolThreads) : slots(max<size_t>(slots, 1)), poolThreads(poolThreads) {}
+    
+    // Running jobs are cancelled, and each stops at its next safe point
+    ~JobScheduler() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+            for (auto& job : jobs) {
+                job->progress.cancelled = true;
+            }
+        }
+        wakeRunner.notify_all();
+        for (auto& runner : runners) {
+            runner.join();
+        }
+    }
+    
+    JobScheduler(const JobScheduler&) = delete;
+    JobScheduler& operator=(const JobScheduler&) = delete;
+    
+    // Threads are only started by the first job of the session
+    shared_ptr<Job> submit(const string& command, const string& verb,
+                           function<void(WorkStealingPool&, TransferProgress&)> work) {
+        auto job = make_shared<Job>();
+        job->command = command;
+        job->verb = verb;
+        job->work = move(work);
+        {
+            lock_guard<mutex> guard(lock);
+            if (!pool) {
+                pool = make_unique<WorkStealingPool>(poolThreads);
+                for (size_t i = 0; i < slots; i++) {
+                    runners.emplace_back(&JobScheduler::runnerLoop, this);
+                }
+            }
+            job->id = nextId++;
+            jobs.push_back(job);
+            queue.push_back(job);
+        }
+        wakeRunner.notify_one();
+        return job;
+    }
+    
+    // Null when there is no such unreported job; id 0 picks the newest one
+    shared_ptr<Job> find(size_t id) {
+        lock_guard<mutex> guard(lock);
+        if (id == 0) {
+            return jobs.empty() ? nullptr : jobs.back();
+        }
+        for (auto& job : jobs) {
+            if (job->id == id) return job;
+        }
+        return nullptr;
+    }
+    
+    vector<shared_ptr<Job>> list() {
+        lock_guard<mutex> guard(lock);
+        return jobs;
+    }
+    
+    // Returns false for unknown or already finished jobs
+    bool cancel(size_t id) {
+        shared_ptr<Job> job = find(id);
+        if (!job || job->finished()) {
+            return false;
+        }
+        job->progress.cancelled = true;
+        return true;
+    }
+    
+    // Waits up to `timeout`; true once the job has finished
+    bool waitFor(const Job& job, chrono::milliseconds timeout) {
+        unique_lock<mutex> guard(lock);
+        return jobFinished.wait_for(guard, timeout, [&job] { return job.finished(); });
+    }
+    
+    // Finished jobs, which are forgotten once handed out here
+    vector<shared_ptr<Job>> takeFinished() {
+        lock_guard<mutex> guard(lock);
+        vector<shared_ptr<Job>> finished;
+        auto kept = remove_if(jobs.begin(), jobs.end(), [&finished](const shared_ptr<Job>& job) {
+            if (!job->finished()) return false;
+            finished.push_back(job);
+            return true;
+        });
+        jobs.erase(kept, jobs.end());
+        return finished;
+    }
+    
+    void forget(size_t id) {
+        lock_guard<mutex> guard(lock);
+        jobs.erase(remove_if(jobs.begin(), jobs.end(), [id](const shared_ptr<Job>& job) { return job->id == id; }),
+                   jobs.end());
+    }
+    
+    size_t active() {
+        lock_guard<mutex> guard(lock);
+        return count_if(jobs.begin(), jobs.end(), [](const shared_ptr<Job>& job) { return !job->finished(); });
+    }
+};
+
+// Per-volume trash. Deleting is one rename into the trash directory of the
+// item's volume, so it costs the same for a file and for a huge tree, and
+// restoring is the reverse rename. Info files are grouped by original name
+// (info/<name>/<id>), so a restore only looks at items of that name. A
+// low-priority thread purges entries once they outlive the retention
+// period, limited to a fixed number of removals per second so it never
+// competes with foreground work.
+class TrashCan {
+public:
+    struct Entry {
+        string id;
+        fs::path trashed;
+        fs::path original;
+        time_t deleted;
+    };
+    
+private:
+    static constexpr const char* directoryName = ".file-explorer-trash";
+    static constexpr int removalsPerSecond = 2000;
+    static constexpr chrono::seconds retention{10 * 60};
+    static constexpr chrono::seconds purgeInterval{60};
+    
+    mutex lock;                         // guards the claim on an entry's info file
+    condition_variable wake;
+    vector<fs::path> knownTrashes;
+    atomic<bool> stopping{false};
+    atomic<uint64_t> sequence{0};
+    thread purger;
+    
+    chrono::steady_clock::time_point budgetWindow = chrono::steady_clock::now();
+    int budgetUsed = 0;
+    
+    static fs::path homeDirectory() {
+        #ifdef _WIN32
+        const char* home = getenv("USERPROFILE");
+        #else
+        const char* home = getenv("HOME");
+        #endif
+        return home ? fs::path(home) : fs::path();
+    }
+    
+    static bool sameVolume(const fs::path& a, const fs::path& b) {
+        #ifdef _WIN32
+        return fs::absolute(a).root_name() == fs::absolute(b).root_name();
+        #else
+        struct stat first, second;
+        return lstat(a.c_str(), &first) == 0 && stat(b.c_str(), &second) == 0 && first.st_dev == second.st_dev;
+        #endif
+    }
+    
+    // Topmost ancestor of `path` that is still on the same volume
+    static fs::path volumeRoot(const fs::path& path) {
+        fs::path absolute = fs::absolute(path);
+        #ifdef _WIN32
+        return absolute.root_path();
+        #else
+        struct stat st;
+        if (lstat(absolute.c_str(), &st) != 0) return absolute.root_path();
+        fs::path root = absolute.parent_path();
+        while (root.has_relative_path()) {
+            struct stat parent;
+            if (stat(root.parent_path().c_str(), &parent) != 0 || parent.st_dev != st.st_dev) break;
+            root = root.parent_path();
+        }
+        return root;
+        #endif
+    }
+    
+    // The home trash serves the home volume, other volumes keep their own
+    static fs::path trashLocation(const fs::path& path) {
+        fs::path home = homeDirectory();
+        return (!home.empty() && sameVolume(path, home) ? home : volumeRoot(path)) / directoryName;
+    }
+    
+    void remember(const fs::path& trash) {
+        lock_guard<mutex> guard(lock);
+        if (find(knownTrashes.begin(), knownTrashes.end(), trash) == knownTrashes.end()) {
+            knownTrashes.push_back(trash);
+        }
+    }
+    
+    // Known trashes plus the one serving `near`, if it exists; never creates one
+    vector<fs::path> trashesNear(const fs::path& near) {
+        fs::path trash = trashLocation(near);
+        error_code ec;
+        if (fs::is_directory(trash / "info", ec)) {
+            remember(trash);
+        }
+        lock_guard<mutex> guard(lock);
+        return knownTrashes;
+    }
+    
+    // Ids are "<seconds>.<sequence>-<name>"
+    static time_t deletedAt(const string& id) {
+        return static_cast<time_t>(strtoll(id.c_str(), nullptr, 10));
+    }
+    
+    static pair<long long, long long> age(const string& id) {
+        size_t dot = id.find('.');
+        return {strtoll(id.c_str(), nullptr, 10), dot == string::npos ? 0 : strtoll(id.c_str() + dot + 1, nullptr, 10)};
+    }
+    
+    // Names become a directory under info/, so they must be a single component
+    static bool plainName(const string& name) {
+        #ifdef _WIN32
+        const char* separators = "/\\";
+        #else
+        const char* separators = "/";
+        #endif
+        return !name.empty() && name != "." && name != ".." && name.find_first_of(separators) == string::npos;
+    }
+    
+    static string nameOf(const string& id) {
+        size_t dash = id.find('-');
+        return dash == string::npos ? id : id.substr(dash + 1);
+    }
+    
+    // Must hold `lock`; the name directory goes once its last item does
+    static void dropInfo(const fs::path& trash, const string& id) {
+        error_code ec;
+        fs::path names = trash / "info" / nameOf(id);
+        fs::remove(names / id, ec);
+        fs::remove(names, ec);
+    }
+    
+    // Waits out the rest of the second once its removal budget is spent
+    bool spendBudget() {
+        if (++budgetUsed > removalsPerSecond) {
+            auto next = budgetWindow + chrono::seconds(1);
+            while (chrono::steady_clock::now() < next) {
+                if (stopping) return false;
+                this_thread::sleep_for(chrono::milliseconds(50));
+            }
+            budgetWindow = chrono::steady_clock::now();
+            budgetUsed = 1;
+        }
+        return !stopping;
+    }
+    
+    bool removeThrottled(const fs::path& path) {
+        error_code ec;
+        if (fs::is_directory(fs::symlink_status(path, ec))) {
+            fs::permissions(path, fs::perms::owner_all, fs::perm_options::add, ec);
+            vector<fs::path> children;
+            for (fs::directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+                children.push_back(it->path());
+            }
+            for (const auto& child : children) {
+                if (!removeThrottled(child)) return false;
+            }
+        }
+        if (!spendBudget()) return false;
+        fs::remove(path, ec);
+        return true;
+    }
+    
+    void purgeExpired(const fs::path& trash) {
+        time_t now = time(nullptr);
+        error_code ec;
+        vector<string> expired;
+        for (fs::directory_iterator it(trash / "files", ec), end; !ec && it != end; it.increment(ec)) {
+            string id = it->path().filename().string();
+            if (now - deletedAt(id) >= retention.count()) {
+                expired.push_back(id);
+            }
+        }
+        
+        for (const auto& id : expired) {
+            {
+                // Dropping the info file claims the entry; restore can no longer see it
+                lock_guard<mutex> guard(lock);
+                dropInfo(trash, id);
+            }
+            if (!removeThrottled(trash / "files" / id)) return;
+        }
+    }
+    
+    static void lowerPriority() {
+        #ifdef _WIN32
+        SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+        #elif defined(__linux__)
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+        syscall(SYS_ioprio_set, 1, 0, 3 << 13);     // IOPRIO_WHO_PROCESS, idle class
+        #endif
+    }
+    
+    void purgeLoop() {
+        lowerPriority();
+        unique_lock<mutex> guard(lock);
+        while (!stopping) {
+            vector<fs::path> trashes = knownTrashes;
+            guard.unlock();
+            for (const auto& trash : trashes) {
+                if (stopping) break;
+                purgeExpired(trash);
+            }
+            guard.lock();
+            wake.wait_for(guard, purgeInterval, [this] { return stopping.load(); });
+        }
+    }
+    
+public:
+    TrashCan() {
+        fs::path home = homeDirectory();
+        error_code ec;
+        if (!home.empty() && fs::is_directory(home / directoryName, ec)) {
+            knownTrashes.push_back(home / directoryName);
+        }
+        purger = thread([this] { purgeLoop(); });
+    }
+    
+    ~TrashCan() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        purger.join();
+    }
+    
+    // Returns false with `reason` set when the item cannot be trashed; the
+    // trash directories are only ever created here
+    bool moveToTrash(const fs::path& path, string& reason) {
+        for (const auto& part : fs::absolute(path)) {
+            if (part == directoryName) {
+                reason = "it is inside a trash directory";
+                return false;
+            }
+        }
+        if (!plainName(path.filename().string())) {
+            reason = "'" + path.filename().string() + "' is not a file name";
+            return false;
+        }
+        fs::path trash = trashLocation(path);
+        error_code ec;
+        fs::create_directories(trash / "files", ec);
+        if (!ec) fs::create_directories(trash / "info", ec);
+        if (ec) {
+            reason = "cannot create " + trash.string() + ": " + ec.message();
+            return false;
+        }
+        remember(trash);
+        
+        auto now = chrono::system_clock::now().time_since_epoch();
+        string seconds = to_string(chrono::duration_cast<chrono::seconds>(now).count());
+        string name = path.filename().string();
+        
+        lock_guard<mutex> guard(lock);
+        // Another session may have trashed the same name in the same second
+        string id;
+        do {
+            id = seconds + "." + to_string(sequence++) + "-" + name;
+        } while (fs::exists(fs::symlink_status(trash / "files" / id)));
+        fs::create_directory(trash / "info" / name, ec);
+        {
+            ofstream info(trash / "info" / name / id);
+            info << fs::absolute(path).string() << "\n";
+            if (!info) {
+                reason = "cannot write to " + (trash / "info").string();
+                dropInfo(trash, id);
+                return false;
+            }
+        }
+        fs::rename(path, trash / "files" / id, ec);
+        if (ec) {
+            reason = ec.message();
+            dropInfo(trash, id);
+            return false;
+        }
+        return true;
+    }
+    
+    vector<Entry> entries(const fs::path& near) {
+        vector<fs::path> trashes = trashesNear(near);
+        lock_guard<mutex> guard(lock);
+        vector<Entry> result;
+        for (const auto& trash : trashes) {
+            error_code ec;
+            for (fs::recursive_directory_iterator it(trash / "info", ec), end; !ec && it != end; it.increment(ec)) {
+                if (it.depth() != 1) continue;
+                string id = it->path().filename().string();
+                ifstream info(it->path());
+                string original;
+                if (getline(info, original)) {
+                    result.push_back({id, trash / "files" / id, fs::path(original), deletedAt(id)});
+                }
+            }
+        }
+        sort(result.begin(), result.end(), [](const Entry& a, const Entry& b) { return age(a.id) > age(b.id); });
+        return result;
+    }
+    
+    // Moves the most recently trashed item called `name` back where it came
+    // from; reads only the info files of items with that name
+    fs::path restore(const fs::path& near, const string& name) {
+        if (!plainName(name)) {
+            throw fs::filesystem_error("Not a file name", fs::path(name), make_error_code(errc::invalid_argument));
+        }
+        vector<fs::path> trashes = trashesNear(near);
+        lock_guard<mutex> guard(lock);
+        fs::path newestTrash;
+        string newest;
+        for (const auto& trash : trashes) {
+            error_code ec;
+            for (fs::directory_iterator it(trash / "info" / name, ec), end; !ec && it != end; it.increment(ec)) {
+                string id = it->path().filename().string();
+                if (newest.empty() || age(id) > age(newest)) {
+                    newest = id;
+                    newestTrash = trash;
+                }
+            }
+        }
+        if (newest.empty()) {
+            throw fs::filesystem_error("Not in trash", fs::path(name), make_error_code(errc::no_such_file_or_directory));
+        }
+        
+        ifstream info(newestTrash / "info" / name / newest);
+        string original;
+        if (!getline(info, original)) {
+            throw fs::filesystem_error("Unreadable trash entry", newestTrash / "info" / name / newest, make_error_code(errc::io_error));
+        }
+        fs::path target(original);
+        if (fs::exists(fs::symlink_status(target))) {
+            throw fs::filesystem_error("Restore target exists", target, make_error_code(errc::file_exists));
+        }
+        fs::rename(newestTrash / "files" / newest, target);
+        dropInfo(newestTrash, newest);
+        return target;
+    }
+};
+
+// Parallel disk usage walk. Every directory is one task on the shared pool;
+// each entry is stat'ed once without following symlinks, and files with
+// several links are counted only the first time their (device, inode) pair
+// is seen. When a directory's last subdirectory finishes, its totals are
+// added to the parent, so the root ends up holding the whole tree.
+class DiskUsageWalker {
+public:
+    struct Usage {
+        fs::path path;
+        int depth;
+        uint64_t apparent;
+        uint64_t allocated;
+        uint64_t files;
+    };
+    
+private:
+    struct Node {
+        Node* parent;
+        fs::path path;
+        int depth;
+        atomic<uint64_t> apparent{0};
+        atomic<uint64_t> allocated{0};
+        atomic<uint64_t> files{0};
+        atomic<int> pending{1};     // own scan + unfinished subdirectories
+    };
+    
+    struct InodeShard {
+        mutex lock;
+        unordered_map<uint64_t, unordered_set<uint64_t>> inodesByDevice;
+    };
+    static constexpr size_t shardCount = 64;
+    
+    TransferProgress& progress;
+    size_t topCount;
+    
+    mutex nodesLock;
+    deque<unique_ptr<Node>> nodes;
+    InodeShard shards[shardCount];
+    atomic<uint64_t> unreadable{0};
+    
+    mutex topLock;
+    vector<pair<uint64_t, fs::path>> topFiles;     // min-heap on allocated size
+    atomic<uint64_t> topFloor{0};
+    TaskGroup group;
+    
+    Node* addNode(Node* parent, fs::path path, int depth) {
+        lock_guard<mutex> guard(nodesLock);
+        nodes.push_back(unique_ptr<Node>(new Node{parent, move(path), depth}));
+        return nodes.back().get();
+    }
+    
+    // True the first time a multiply-linked inode is seen
+    bool firstLink(uint64_t device, uint64_t inode) {
+        InodeShard& shard = shards[(inode ^ device) % shardCount];
+        lock_guard<mutex> guard(shard.lock);
+        return shard.inodesByDevice[device].insert(inode).second;
+    }
+    
+    void offerFile(const fs::path& path, uint64_t allocated) {
+        if (topCount == 0 || (allocated <= topFloor && topFloor != 0)) return;
+        lock_guard<mutex> guard(topLock);
+        auto larger = [](const pair<uint64_t, fs::path>& a, const pair<uint64_t, fs::path>& b) { return a.first > b.first; };
+        if (topFiles.size() < topCount) {
+            topFiles.emplace_back(allocated, path);
+            push_heap(topFiles.begin(), topFiles.end(), larger);
+        } else if (allocated > topFiles.front().first) {
+            pop_heap(topFiles.begin(), topFiles.end(), larger);
+            topFiles.back() = {allocated, path};
+            push_heap(topFiles.begin(), topFiles.end(), larger);
+        }
+        if (topFiles.size() == topCount) topFloor = topFiles.front().first;
+    }
+    
+    void account(Node* node, const char* name, bool isDirectory, uint64_t apparent, uint64_t allocated) {
+        node->apparent += apparent;
+        node->allocated += allocated;
+        progress.bytes += apparent;
+        if (!isDirectory) {
+            node->files++;
+            progress.files++;
+            offerFile(node->path / name, allocated);
+        }
+    }
+    
+    void scanDirectory(Node* node) {
+        vector<string> subdirectories;
+        
+        #ifdef _WIN32
+        error_code ec;
+        for (fs::directory_iterator it(node->path, ec), end; !ec && it != end; it.increment(ec)) {
+            string name = it->path().filename().string();
+            if (it->is_directory(ec) && !it->is_symlink(ec)) {
+                subdirectories.push_back(name);
+            } else {
+                uintmax_t size = it->is_regular_file(ec) ? it->file_size(ec) : 0;
+                account(node, name.c_str(), false, ec ? 0 : size, ec ? 0 : size);
+            }
+        }
+        if (ec) unreadable++;
+        #else
+        // Only the root may be reached through a symlink
+        int dirfd = open(node->path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | (node->parent ? O_NOFOLLOW : 0));
+        if (dirfd < 0) {
+            unreadable++;
+        } else {
+            try {
+                DirectoryReader::scan(dirfd, node->path, [&](const char* name, unsigned char) {
+                    #ifdef __linux__
+                    struct statx stx;
+                    unsigned int mask = STATX_TYPE | STATX_SIZE | STATX_BLOCKS | STATX_INO | STATX_NLINK;
+                    Metrics::add(Metric::StatCalls);
+                    if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | AT_STATX_DONT_SYNC, mask, &stx) != 0) return;
+                    bool isDirectory = S_ISDIR(stx.stx_mode);
+                    uint64_t device = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+                    uint64_t inode = stx.stx_ino, links = stx.stx_nlink, size = stx.stx_size, blocks = stx.stx_blocks;
+                    #else
+                    struct stat st;
+                    Metrics::add(Metric::StatCalls);
+                    if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+                    bool isDirectory = S_ISDIR(st.st_mode);
+                    uint64_t device = st.st_dev;
+                    uint64_t inode = st.st_ino, links = st.st_nlink, size = st.st_size, blocks = st.st_blocks;
+                    #endif
+                    if (isDirectory) {
+                        subdirectories.push_back(name);
+                    } else if (links > 1 && !firstLink(device, inode)) {
+                        return;
+                    }
+                    account(node, name, isDirectory, size, blocks * 512);
+                });
+            } catch (const fs::filesystem_error&) {
+                unreadable++;
+            }
+            close(dirfd);
+        }
+        #endif
+        
+        for (const auto& name : subdirectories) {
+            Node* child = addNode(node, node->path / name, node->depth + 1);
+            node->pending++;
+            group.submit([this, child] { scanDirectory(child); });
+        }
+        progress.directories++;
+        release(node);
+    }
+    
+    // Drops one reference; the last one folds the totals into the parent
+    void release(Node* node) {
+        while (--node->pending == 0 && node->parent) {
+            Node* parent = node->parent;
+            parent->apparent += node->apparent;
+            parent->allocated += node->allocated;
+            parent->files += node->files;
+            node = parent;
+        }
+    }
+    
+public:
+    DiskUsageWalker(WorkStealingPool& pool, TransferProgress& progress, size_t topCount)
+        : progress(progress), topCount(topCount), group(pool) {}
+    
+    void start(const fs::path& root) {
+        Node* node = addNode(nullptr, root, 0);
+        group.submit([this, node] { scanDirectory(node); });
+    }
+    
+    bool waitFor(chrono::milliseconds timeout) {
+        return group.waitFor(timeout);
+    }
+    
+    // Totals for every directory down to maxDepth, in path order
+    vector<Usage> directories(int maxDepth) {
+        vector<Usage> result;
+        lock_guard<mutex> guard(nodesLock);
+        for (const auto& node : nodes) {
+            if (node->depth <= maxDepth) {
+                result.push_back({node->path, node->depth, node->apparent, node->allocated, node->files});
+            }
+        }
+        sort(result.begin(), result.end(), [](const Usage& a, const Usage& b) { return a.path < b.path; });
+        return result;
+    }
+    
+    // The largest files by allocated size, largest first
+    vector<pair<uint64_t, fs::path>> largestFiles() {
+        lock_guard<mutex> guard(topLock);
+        vector<pair<uint64_t, fs::path>> result = topFiles;
+        sort(result.begin(), result.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+        return result;
+    }
+    
+    uint64_t unreadableDirectories() const {
+        return unreadable;
+    }
+};
+
+// Shell-style wildcard pattern (*, ?, [a-z], [!abc], \x) compiled once into
+// tokens; matching walks the raw entry name and never allocates
+class GlobMatcher {
+private:
+    enum class Kind { Literal, AnyOne, AnyRun, Set };
+    struct Token {
+        Kind kind;
+        unsigned char literal;
+        bitset<256> set;
+    };
+    vector<Token> tokens;
+    
+public:
+    explicit GlobMatcher(const string& pattern = "*") {
+        for (size_t i = 0; i < pattern.size(); i++) {
+            char c = pattern[i];
+            if (c == '*') {
+                if (tokens.empty() || tokens.back().kind != Kind::AnyRun) tokens.push_back({Kind::AnyRun, 0, {}});
+            } else if (c == '?') {
+                tokens.push_back({Kind::AnyOne, 0, {}});
+            } else if (c == '[' && pattern.find(']', i + 2) != string::npos) {
+                Token token{Kind::Set, 0, {}};
+                size_t j = i + 1;
+                bool negate = pattern[j] == '!' || pattern[j] == '^';
+                if (negate) j++;
+                // A ']' right after the opening bracket is a member, not the end
+                for (bool first = true; j < pattern.size() && (first || pattern[j] != ']'); j++, first = false) {
+                    unsigned char low = static_cast<unsigned char>(pattern[j]);
+                    if (j + 2 < pattern.size() && pattern[j + 1] == '-' && pattern[j + 2] != ']') {
+                        for (unsigned int ch = low; ch <= static_cast<unsigned char>(pattern[j + 2]); ch++) token.set.set(ch);
+                        j += 2;
+                    } else {
+                        token.set.set(low);
+                    }
+                }
+                if (negate) token.set.flip();
+                tokens.push_back(token);
+                i = j;
+            } else {
+                if (c == '\\' && i + 1 < pattern.size()) c = pattern[++i];
+                tokens.push_back({Kind::Literal, static_cast<unsigned char>(c), {}});
+            }
+        }
+    }
+    
+    // Greedy match that backtracks only to the most recent '*'
+    bool matches(const char* name) const {
+        size_t token = 0;
+        size_t starToken = string::npos;
+        const char* starName = nullptr;
+        
+        while (*name) {
+            if (token < tokens.size()) {
+                const Token& t = tokens[token];
+                unsigned char c = static_cast<unsigned char>(*name);
+                if (t.kind == Kind::AnyRun) {
+                    starToken = token++;
+                    starName = name;
+                    continue;
+                }
+                if (t.kind == Kind::AnyOne || (t.kind == Kind::Literal && t.literal == c) || (t.kind == Kind::Set && t.set.test(c))) {
+                    token++;
+                    name++;
+                    continue;
+                }
+            }
+            if (starToken == string::npos) return false;
+            token = starToken + 1;
+            name = ++starName;
+        }
+        while (token < tokens.size() && tokens[token].kind == Kind::AnyRun) token++;
+        return token == tokens.size();
+    }
+};
+
+// Everything `find` filters on, parsed once before the walk
+struct FindQuery {
+    GlobMatcher glob;
+    bool useRegex = false;
+    regex pattern;
+    char type = 0;              // 'f', 'd', 'l' or 0 for any
+    int sizeCompare = 0;        // -1 less than, 0 equal, +1 greater than
+    uint64_t sizeValue = 0;
+    uint64_t sizeUnit = 0;      // 0 when -size was not given
+    int ageCompare = 0;
+    long ageDays = -1;          // -1 when -mtime was not given
+    
+    bool needsStat() const {
+        return sizeUnit != 0 || ageDays >= 0;
+    }
+    
+    bool nameMatches(const char* name) const {
+        return useRegex ? regex_match(name, name + strlen(name), pattern) : glob.matches(name);
+    }
+    
+    static bool compare(int how, uint64_t actual, uint64_t wanted) {
+        return how < 0 ? actual < wanted : how > 0 ? actual > wanted : actual == wanted;
+    }
+    
+    // Sizes round up to the unit and ages down to whole days, as in find(1)
+    bool metadataMatches(uint64_t size, time_t modified, time_t now) const {
+        if (sizeUnit != 0 && !compare(sizeCompare, (size + sizeUnit - 1) / sizeUnit, sizeValue)) return false;
+        if (ageDays >= 0) {
+            uint64_t age = now > modified ? static_cast<uint64_t>(now - modified) / 86400 : 0;
+            if (!compare(ageCompare, age, static_cast<uint64_t>(ageDays))) return false;
+        }
+        return true;
+    }
+};
+
+// Parallel search. Each directory is a task on the shared pool; an entry's
+// name and directory-record type are checked before anything is stat'ed,
+// and a path string is only built for entries that match. Matches go to
+// the sink as they are found, one at a time.
+class FindWalker {
+private:
+    const FindQuery& query;
+    TransferProgress& progress;
+    function<void(const fs::path&)> sink;
+    time_t now = time(nullptr);
+    mutex sinkLock;
+    atomic<uint64_t> matched{0};
+    atomic<uint64_t> unreadable{0};
+    TaskGroup group;
+    
+    void report(const fs::path& path) {
+        matched++;
+        lock_guard<mutex> guard(sinkLock);
+        sink(path);
+    }
+    
+    void scanDirectory(const fs::path& dirPath, bool isRoot) {
+        vector<string> subdirectories;
+        
+        #ifdef _WIN32
+        error_code ec;
+        for (fs::directory_iterator it(dirPath, ec), end; !ec && it != end; it.increment(ec)) {
+            progress.files++;
+            bool isLink = it->is_symlink(ec);
+            bool isDirectory = !isLink && it->is_directory(ec);
+            string name = it->path().filename().string();
+            if (isDirectory) subdirectories.push_back(name);
+            if (!query.nameMatches(name.c_str())) continue;
+            char type = isLink ? 'l' : isDirectory ? 'd' : 'f';
+            if (query.type && query.type != type) continue;
+            if (query.needsStat()) {
+                uintmax_t size = isDirectory ? 0 : it->file_size(ec);
+                auto stamp = it->last_write_time(ec);
+                if (ec) continue;
+                time_t modified = chrono::system_clock::to_time_t(chrono::system_clock::now() +
+                                  chrono::duration_cast<chrono::system_clock::duration>(stamp - fs::file_time_type::clock::now()));
+                if (!query.metadataMatches(size, modified, now)) continue;
+            }
+            report(it->path());
+        }
+        if (ec) unreadable++;
+        #else
+        int dirfd = open(dirPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | (isRoot ? 0 : O_NOFOLLOW));
+        if (dirfd < 0) {
+            unreadable++;
+            return;
+        }
+        try {
+            DirectoryReader::scan(dirfd, dirPath, [&](const char* name, unsigned char dtype) {
+                progress.files++;
+                bool nameMatches = query.nameMatches(name);
+                // The directory record is enough unless the type is unknown or metadata was asked for
+                if (dtype == DT_UNKNOWN || (nameMatches && query.needsStat())) {
+                    struct stat st;
+                    Metrics::add(Metric::StatCalls);
+                    if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+                    dtype = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+                    if (nameMatches && query.needsStat() && !query.metadataMatches(st.st_size, st.st_mtime, now)) {
+                        nameMatches = false;
+                    }
+                }
+                if (dtype == DT_DIR) subdirectories.push_back(name);
+                if (!nameMatches) return;
+                char type = dtype == DT_DIR ? 'd' : dtype == DT_LNK ? 'l' : 'f';
+                if (query.type && query.type != type) return;
+                report(dirPath / name);
+            });
+        } catch (const fs::filesystem_error&) {
+            unreadable++;
+        }
+        close(dirfd);
+        #endif
+        
+        progress.directories++;
+        for (auto& name : subdirectories) {
+            fs::path child = dirPath / name;
+            group.submit([this, child] { scanDirectory(child, false); });
+        }
+    }
+    
+public:
+    FindWalker(WorkStealingPool& pool, const FindQuery& query, TransferProgress& progress, function<void(const fs::path&)> sink)
+        : query(query), progress(progress), sink(move(sink)), group(pool) {}
+    
+    void start(const fs::path& root) {
+        group.submit([this, root] { scanDirectory(root, true); });
+    }
+    
+    bool waitFor(chrono::milliseconds timeout) {
+        return group.waitFor(timeout);
+    }
+    
+    // Runs `action` while no match is being reported
+    void withSinkLocked(const function<void()>& action) {
+        lock_guard<mutex> guard(sinkLock);
+        action();
+    }
+    
+    uint64_t matches() const {
+        return matched;
+    }
+    
+    uint64_t unreadableDirectories() const {
+        return unreadable;
+    }
+};
+
+// Read-only mapping of a sliding window of a file, so that files of any
+// size can be scanned while the address space used stays bounded
+class MappedFile {
+private:
+    static constexpr size_t windowSize = 16 * 1024 * 1024;
+    
+    uint64_t fileSize = 0;
+    const char* base = nullptr;
+    uint64_t baseOffset = 0;
+    size_t mappedLength = 0;
+    #ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = nullptr;
+    #else
+    int fd = -1;
+    #endif
+    
+    static uint64_t granularity() {
+        #ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwAllocationGranularity;
+        #else
+        return static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        #endif
+    }
+    
+    void unmap() {
+        if (base) {
+            #ifdef _WIN32
+            UnmapViewOfFile(base);
+            #else
+            munmap(const_cast<char*>(base), mappedLength);
+            #endif
+            base = nullptr;
+        }
+    }
+    
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    ~MappedFile() {
+        unmap();
+        #ifdef _WIN32
+        if (mappingHandle) CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+        #else
+        if (fd >= 0) close(fd);
+        #endif
+    }
+    
+    bool open(const fs::path& path) {
+        #ifdef _WIN32
+        fileHandle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                                 OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER length;
+        if (!GetFileSizeEx(fileHandle, &length)) return false;
+        fileSize = static_cast<uint64_t>(length.QuadPart);
+        if (fileSize > 0) {
+            mappingHandle = CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!mappingHandle) return false;
+        }
+        #else
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) return false;
+        fileSize = static_cast<uint64_t>(st.st_size);
+        #endif
+        return true;
+    }
+    
+    uint64_t size() const { return fileSize; }
+    
+    // Pointer to the byte at `offset`; `available` receives how many bytes
+    // from there on are mapped (at least min(length, size - offset))
+    const char* view(uint64_t offset, size_t length, size_t& available) {
+        if (offset >= fileSize) {
+            available = 0;
+            return nullptr;
+        }
+        length = static_cast<size_t>(min<uint64_t>(length, fileSize - offset));
+        
+        if (!base || offset < baseOffset || offset + length > baseOffset + mappedLength) {
+            unmap();
+            baseOffset = offset - offset % granularity();
+            mappedLength = static_cast<size_t>(min<uint64_t>(max(windowSize, length + (offset - baseOffset)),
+                                                             fileSize - baseOffset));
+            #ifdef _WIN32
+            base = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ,
+                                                          static_cast<DWORD>(baseOffset >> 32),
+                                                          static_cast<DWORD>(baseOffset), mappedLength));
+            #else
+            void* address = mmap(nullptr, mappedLength, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(baseOffset));
+            base = (address == MAP_FAILED) ? nullptr : static_cast<const char*>(address);
+            if (base) {
+                madvise(address, mappedLength, MADV_SEQUENTIAL);
+            }
+            #endif
+            if (!base) {
+                available = 0;
+                return nullptr;
+            }
+        }
+        
+        available = static_cast<size_t>(baseOffset + mappedLength - offset);
+        return base + (offset - baseOffset);
+    }
+};
+
+// Interactive pager over a MappedFile. The line index keeps one offset per
+// 1024 lines and is only built as far as the user has asked to go, so memory
+// stays small for any file size and every jump after indexing touches at
+// most one checkpoint interval.
+class FilePager {
+private:
+    static constexpr uint64_t checkpointInterval = 1024;
+    static constexpr size_t pageLines = 40;
+    static constexpr size_t maxLineBytes = 4096;
+    static constexpr size_t chunkBytes = 8 * 1024 * 1024;
+    
+    MappedFile& file;
+    vector<uint64_t> checkpoints{0};    // checkpoints[k] = offset of line k * interval
+    uint64_t scannedOffset = 0;         // index covers [0, scannedOffset)
+    uint64_t linesScanned = 0;          // newlines seen in [0, scannedOffset)
+    bool complete = false;
+    
+    // Counts the newlines flagged in `mask` (bit i = byte position + i of the
+    // chunk) and records a checkpoint at every interval boundary among them
+    void recordNewlines(uint64_t chunkOffset, size_t position, unsigned int mask) {
+        while (mask) {
+            size_t bit = bitset<16>((mask & (0u - mask)) - 1).count();
+            mask &= mask - 1;
+            linesScanned++;
+            if (linesScanned % checkpointInterval == 0) {
+                checkpoints.push_back(chunkOffset + position + bit + 1);
+            }
+        }
+    }
+    
+    void scanChunk(const char* data, size_t length, uint64_t chunkOffset) {
+        size_t position = 0;
+        
+        #ifdef HAVE_SSE2
+        // Count newlines 16 bytes at a time; only walk individual bits when
+        // the block crosses a checkpoint boundary
+        const __m128i newline = _mm_set1_epi8('\n');
+        for (; position + 16 <= length; position += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + position));
+            unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+            if (!mask) continue;
+            
+            uint64_t count = bitset<16>(mask).count();
+            uint64_t untilCheckpoint = checkpointInterval - linesScanned % checkpointInterval;
+            if (count < untilCheckpoint) {
+                linesScanned += count;
+            } else {
+                recordNewlines(chunkOffset, position, mask);
+            }
+        }
+        #endif
+        
+        while (position < length) {
+            const void* hit = memchr(data + position, '\n', length - position);
+            if (!hit) break;
+            position = static_cast<const char*>(hit) - data;
+            recordNewlines(chunkOffset, position, 1);
+            position++;
+        }
+    }
+    
+    // Extends the index until line `line` has its checkpoint, or to EOF
+    void ensureIndexed(uint64_t line) {
+        while (!complete && checkpoints.size() <= line / checkpointInterval) {
+            size_t available;
+            const char* data = file.view(scannedOffset, chunkBytes, available);
+            if (!data) {
+                complete = true;
+                break;
+            }
+            size_t length = min(available, chunkBytes);
+            scanChunk(data, length, scannedOffset);
+            scannedOffset += length;
+        }
+    }
+    
+    // Offset just past the end of the line starting at `offset`
+    uint64_t lineEnd(uint64_t offset) {
+        while (true) {
+            size_t available;
+            const char* data = file.view(offset, chunkBytes, available);
+            if (!data) return file.size();
+            const void* hit = memchr(data, '\n', available);
+            if (hit) return offset + (static_cast<const char*>(hit) - data) + 1;
+            offset += available;
+        }
+    }
+    
+    // Offset of the first byte of `line` (0-based), or size() past the end
+    uint64_t lineOffset(uint64_t line) {
+        ensureIndexed(line);
+        uint64_t checkpoint = min<uint64_t>(line / checkpointInterval, checkpoints.size() - 1);
+        uint64_t offset = checkpoints[checkpoint];
+        for (uint64_t current = checkpoint * checkpointInterval; current < line && offset < file.size(); current++) {
+            offset = lineEnd(offset);
+        }
+        return offset;
+    }
+    
+    // Full line count; forces the index to EOF
+    uint64_t totalLines() {
+        ensureIndexed(UINT64_MAX - checkpointInterval);
+        uint64_t lines = linesScanned;
+        size_t available;
+        const char* last = file.view(file.size() - 1, 1, available);
+        if (last && *last != '\n') lines++;
+        return lines;
+    }
+    
+    void printPage(uint64_t firstLine) {
+        uint64_t offset = lineOffset(firstLine);
+        for (size_t i = 0; i < pageLines && offset < file.size(); i++) {
+            uint64_t end = lineEnd(offset);
+            size_t available;
+            const char* data = file.view(offset, maxLineBytes, available);
+            size_t length = static_cast<size_t>(min<uint64_t>(end - offset, min(available, maxLineBytes)));
+            bool truncated = end - offset > maxLineBytes;
+            if (length > 0 && data[length - 1] == '\n') length--;
+            if (length > 0 && data[length - 1] == '\r') length--;
+            
+            setConsoleColor(COLOR_YELLOW);
+            cout << setw(8) << right << firstLine + i + 1;
+            setConsoleColor(COLOR_CYAN);
+            cout << " │ ";
+            setConsoleColor(COLOR_RESET);
+            cout.write(data, static_cast<streamsize>(length));
+            if (truncated) cout << " …";
+            cout << "\n";
+            offset = end;
+        }
+    }
+    
+public:
+    explicit FilePager(MappedFile& file) : file(file) {}
+    
+    void run() {
+        if (file.size() == 0) {
+            cout << "(empty file)\n";
+            return;
+        }
+        
+        uint64_t top = 0;
+        string command;
+        while (true) {
+            printPage(top);
+            
+            setConsoleColor(COLOR_CYAN);
+            cout << "-- lines " << top + 1 << "-";
+            if (complete) {
+                uint64_t lines = totalLines();
+                cout << min(top + pageLines, lines) << " of " << lines;
+            } else {
+                cout << top + pageLines << " of ";
+                cout << "?";
+            }
+            cout << " -- [Enter] next, b back, g <n> go to line, G end, q quit: ";
+            setConsoleColor(COLOR_RESET);
+            
+            if (!getline(cin, command) || command == "q") {
+                break;
+            }
+            
+            if (command.empty() || command == "n") {
+                if (lineOffset(top + pageLines) < file.size()) top += pageLines;
+            } else if (command == "b") {
+                top = top > pageLines ? top - pageLines : 0;
+            } else if (command == "G") {
+                uint64_t lines = totalLines();
+                top = lines > pageLines ? lines - pageLines : 0;
+            } else if (command[0] == 'g') {
+                try {
+                    uint64_t target = stoull(command.substr(1));
+                    top = target > 0 ? target - 1 : 0;
+                    if (lineOffset(top) >= file.size()) {
+                        uint64_t lines = totalLines();
+                        top = lines > pageLines ? lines - pageLines : 0;
+                    }
+                } catch (const exception&) {
+                    cout << "Usage: g <line number>\n";
+                }
+            }
+        }
+    }
+};
+
+// Finds a fixed byte string, optionally ignoring ASCII case. With SSE2 the
+// first two bytes of the literal are compared against 16 positions at once
+// and only the surviving candidates are checked byte by byte.
+class LiteralScanner {
+private:
+    string lower;
+    string upper;
+    
+    bool matchesAt(const char* at) const {
+        for (size_t i = 0; i < lower.size(); i++) {
+            if (at[i] != lower[i] && at[i] != upper[i]) return false;
+        }
+        return true;
+    }
+    
+public:
+    LiteralScanner(const string& literal = "", bool ignoreCase = false) : lower(literal), upper(literal) {
+        if (ignoreCase) {
+            transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+            transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+        }
+    }
+    
+    bool empty() const { return lower.empty(); }
+    
+    // First occurrence in [begin, end), or nullptr
+    const char* find(const char* begin, const char* end) const {
+        size_t length = lower.size();
+        if (static_cast<size_t>(end - begin) < length) return nullptr;
+        const char* last = end - length;     // last position a match can start at
+        const char* at = begin;
+        
+        #ifdef HAVE_SSE2
+        const __m128i lower0 = _mm_set1_epi8(lower[0]), upper0 = _mm_set1_epi8(upper[0]);
+        const __m128i lower1 = _mm_set1_epi8(length > 1 ? lower[1] : lower[0]);
+        const __m128i upper1 = _mm_set1_epi8(length > 1 ? upper[1] : upper[0]);
+        for (; at + 16 + 1 <= end && at + 16 <= last + 1; at += 16) {
+            __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(at));
+            __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(first, lower0), _mm_cmpeq_epi8(first, upper0));
+            if (length > 1) {
+                __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(at + 1));
+                hits = _mm_and_si128(hits, _mm_or_si128(_mm_cmpeq_epi8(second, lower1), _mm_cmpeq_epi8(second, upper1)));
+            }
+            unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(hits));
+            while (mask) {
+                size_t bit = bitset<16>((mask & (0u - mask)) - 1).count();
+                mask &= mask - 1;
+                if (matchesAt(at + bit)) return at + bit;
+            }
+        }
+        #endif
+        
+        for (; at <= last; at++) {
+            if ((*at == lower[0] || *at == upper[0]) && matchesAt(at)) return at;
+        }
+        return nullptr;
+    }
+    
+    // Longest run of plain characters every match of an ECMAScript pattern
+    // must contain; `exact` is set when the pattern is nothing but that run
+    static string requiredLiteral(const string& pattern, bool& exact) {
+        exact = pattern.find_first_of(".^$*+?()[]{}|\\") == string::npos;
+        if (exact) return pattern;
+        if (pattern.find('|') != string::npos) return "";
+        
+        string best, run;
+        int depth = 0;
+        auto endRun = [&] {
+            if (run.size() > best.size()) best = run;
+            run.clear();
+        };
+        for (size_t i = 0; i < pattern.size(); i++) {
+            char c = pattern[i];
+            if (c == '*' || c == '?' || c == '{') {
+                // The preceding character is optional
+                if (!run.empty()) run.pop_back();
+                endRun();
+                if (c == '{') i = min(pattern.find('}', i), pattern.size() - 1);
+            } else if (c == '+') {
+                endRun();
+            } else if (c == '\\' && i + 1 < pattern.size() && ispunct(static_cast<unsigned char>(pattern[i + 1]))) {
+                if (depth == 0) run += pattern[++i];
+                else i++;
+            } else if (c == '(' || c == ')') {
+                depth += c == '(' ? 1 : -1;
+                endRun();
+            } else if (c == '[' || c == '.' || c == '^' || c == '$' || c == '\\') {
+                endRun();
+                if (c == '[') i = min(pattern.find(']', i + 2), pattern.size() - 1);
+                else if (c == '\\') i++;
+            } else if (depth == 0) {
+                run += c;
+            }
+        }
+        endRun();
+        return best;
+    }
+};
+
+// Everything `grep` needs, prepared once before any file is opened
+struct GrepQuery {
+    LiteralScanner scanner;     // required substring, empty when none was derived
+    bool literalOnly = false;   // a scanner hit is already a match
+    bool filesOnly = false;
+    bool includeHidden = false;
+    regex pattern;
+};
+
+// Parallel content search. Directories are walked as tasks on the shared
+// pool and every file is searched by the task that found it. Small files
+// are read into a per-thread buffer, larger ones are memory-mapped. Files
+// with a NUL byte near the start are treated as binary and skipped. The
+// literal scanner finds candidate lines and the regex only confirms those;
+// each file's output is handed to the sink in one piece.
+class ContentSearch {
+private:
+    static constexpr size_t readLimit = 64 * 1024;      // bigger files are mapped
+    static constexpr size_t binaryProbe = 8 * 1024;
+    static constexpr size_t maxShownLine = 300;
+    
+    const GrepQuery& query;
+    TransferProgress& progress;
+    function<void(const string&)> sink;
+    mutex sinkLock;
+    atomic<uint64_t> matchedLines{0};
+    atomic<uint64_t> matchedFiles{0};
+    atomic<uint64_t> unreadable{0};
+    TaskGroup group;
+    
+    // Appends "path:line:text" for every matching line of data[0, length)
+    uint64_t searchBuffer(const char* data, size_t length, const string& shownPath, string& output) const {
+        const char* end = data + length;
+        const char* at = data;
+        const char* counted = data;
+        uint64_t lineNumber = 1;
+        uint64_t matches = 0;
+        
+        while (at < end) {
+            const char* candidate = at;
+            if (!query.scanner.empty()) {
+                candidate = query.scanner.find(at, end);
+                if (!candidate) break;
+            }
+            
+            const char* lineStart = candidate;
+            while (lineStart > at && lineStart[-1] != '\n') lineStart--;
+            const char* lineEnd = static_cast<const char*>(memchr(candidate, '\n', end - candidate));
+            if (!lineEnd) lineEnd = end;
+            
+            if (query.literalOnly || regex_search(lineStart, lineEnd, query.pattern)) {
+                matches++;
+                if (query.filesOnly) {
+                    output += shownPath + "\n";
+                    return matches;
+                }
+                lineNumber += count(counted, lineStart, '\n');
+                counted = lineStart;
+                size_t shown = min(static_cast<size_t>(lineEnd - lineStart), maxShownLine);
+                output += shownPath + ":" + to_string(lineNumber) + ":";
+                output.append(lineStart, shown);
+                output += shown < static_cast<size_t>(lineEnd - lineStart) ? "...\n" : "\n";
+            }
+            at = lineEnd + 1;
+        }
+        return matches;
+    }
+    
+    void searchFile(const fs::path& path, uint64_t size) {
+        if (size == 0) return;
+        string shownPath = path.string();
+        string output;
+        uint64_t matches = 0;
+        
+        #ifndef _WIN32
+        if (size <= readLimit) {
+            static thread_local vector<char> buffer(readLimit);
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+            if (fd < 0) {
+                unreadable++;
+                return;
+            }
+            ssize_t length = pread(fd, buffer.data(), readLimit, 0);
+            close(fd);
+            if (length <= 0) return;
+            progress.bytes += static_cast<uint64_t>(length);
+            Metrics::add(Metric::BytesRead, static_cast<uint64_t>(length));
+            if (memchr(buffer.data(), '\0', min<size_t>(length, binaryProbe))) return;
+            matches = searchBuffer(buffer.data(), static_cast<size_t>(length), shownPath, output);
+        } else
+        #endif
+        {
+            MappedFile file;
+            size_t available = 0;
+            const char* data = file.open(path) ? file.view(0, static_cast<size_t>(file.size()), available) : nullptr;
+            if (!data) {
+                unreadable++;
+                return;
+            }
+            #ifndef _WIN32
+            madvise(const_cast<char*>(data), available, MADV_SEQUENTIAL);     // mapped from offset 0, so page aligned
+            #endif
+            progress.bytes += available;
+            Metrics::add(Metric::BytesRead, available);
+            if (memchr(data, '\0', min(available, binaryProbe))) return;
+            matches = searchBuffer(data, available, shownPath, output);
+        }
+        
+        if (matches > 0) {
+            matchedLines += matches;
+            matchedFiles++;
+            lock_guard<mutex> guard(sinkLock);
+            sink(output);
+        }
+    }
+    
+    void scanDirectory(const fs::path& dirPath) {
+        vector<pair<fs::path, uint64_t>> files;
+        vector<fs::path> subdirectories;
+        
+        error_code ec;
+        for (fs::directory_iterator it(dirPath, ec), end; !ec && it != end; it.increment(ec)) {
+            const fs::path& path = it->path();
+            if (!query.includeHidden && path.filename().string()[0] == '.') continue;
+            if (it->is_symlink(ec)) continue;
+            if (it->is_directory(ec)) {
+                subdirectories.push_back(path);
+            } else if (it->is_regular_file(ec)) {
+                uintmax_t size = it->file_size(ec);
+                if (!ec) files.emplace_back(path, size);
+            }
+        }
+        if (ec) unreadable++;
+        
+        for (const auto& subdirectory : subdirectories) {
+            group.submit([this, subdirectory] { scanDirectory(subdirectory); });
+        }
+        progress.directories++;
+        for (const auto& [path, size] : files) {
+            progress.files++;
+            searchFile(path, size);
+        }
+    }
+    
+public:
+    ContentSearch(WorkStealingPool& pool, const GrepQuery& query, TransferProgress& progress, function<void(const string&)> sink)
+        : query(query), progress(progress), sink(move(sink)), group(pool) {}
+    
+    void start(const fs::path& root) {
+        if (fs::is_directory(root)) {
+            group.submit([this, root] { scanDirectory(root); });
+        } else {
+            group.submit([this, root] { progress.files++; searchFile(root, fs::file_size(root)); });
+        }
+    }
+    
+    bool waitFor(chrono::milliseconds timeout) {
+        return group.waitFor(timeout);
+    }
+    
+    // Runs `action` while no file's output is being reported
+    void withSinkLocked(const function<void()>& action) {
+        lock_guard<mutex> guard(sinkLock);
+        action();
+    }
+    
+    uint64_t lines() const { return matchedLines; }
+    uint64_t filesMatched() const { return matchedFiles; }
+    uint64_t unreadableItems() const { return unreadable; }
+};
+
+// Feeds byte ranges of one file to a hasher. Plain reads on POSIX, where a
+// 4 KB sample is one pread instead of an mmap/munmap pair; a sliding
+// mapping on Windows.
+class HashReader {
+private:
+    static constexpr size_t sampleBytes = 8192;
+    
+    uint64_t fileSize = 0;
+    #ifdef _WIN32
+    MappedFile mapped;
+    #else
+    int fd = -1;
+    char sample[sampleBytes];
+    vector<char> buffer;
+    #endif
+    
+public:
+    HashReader() = default;
+    HashReader(const HashReader&) = delete;
+    HashReader& operator=(const HashReader&) = delete;
+    
+    ~HashReader() {
+        #ifndef _WIN32
+        if (fd >= 0) close(fd);
+        #endif
+    }
+    
+    // `sequential` announces that the whole file will be read in order
+    bool open(const fs::path& path, bool sequential) {
+        #ifdef _WIN32
+        if (!mapped.open(path)) return false;
+        fileSize = mapped.size();
+        #else
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) return false;
+        fileSize = static_cast<uint64_t>(st.st_size);
+        #ifdef __linux__
+        if (sequential) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        #endif
+        #endif
+        return true;
+    }
+    
+    uint64_t size() const { return fileSize; }
+    
+    // False when the range could not be read in full
+    bool feed(XxHash64& hasher, uint64_t offset, uint64_t length, TransferProgress& progress) {
+        while (length > 0) {
+            #ifdef _WIN32
+            size_t got = 0;
+            const char* data = mapped.view(offset, static_cast<size_t>(min<uint64_t>(length, 1 << 20)), got);
+            if (!data) return false;
+            got = static_cast<size_t>(min<uint64_t>(got, length));
+            #else
+            char* data = sample;
+            size_t capacity = sizeof(sample);
+            if (length > capacity) {
+                buffer.resize(1 << 20);
+                data = buffer.data();
+                capacity = buffer.size();
+            }
+            ssize_t got = pread(fd, data, static_cast<size_t>(min<uint64_t>(length, capacity)), static_cast<off_t>(offset));
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            #endif
+            hasher.update(data, static_cast<size_t>(got));
+            offset += got;
+            length -= got;
+            progress.bytes += got;
+            Metrics::add(Metric::BytesRead, static_cast<uint64_t>(got));
+        }
+        return true;
+    }
+};
+
+// Finds files with identical content in passes that each narrow down the
+// candidates for the next, so most files are never opened: sizes come from
+// one metadata walk, files that share a size are hashed over their first
+// and last 4 KB, and only files that still collide are hashed in full.
+// Every pass runs on the pool, one task per directory or per file.
+class DuplicateFinder {
+public:
+    struct Group {
+        uint64_t size;
+        vector<fs::path> paths;
+    };
+    
+private:
+    static constexpr uint64_t sampleBytes = 4096;
+    static constexpr size_t sampleBatch = 64;       // files per sampling task
+    
+    struct Candidate {
+        fs::path path;
+        uint64_t size;
+        uint64_t device = 0;
+        uint64_t inode = 0;
+        uint64_t hash = 0;
+        bool hashedWhole = false;   // the hash covers every byte of the file
+        bool unreadable = false;
+    };
+    
+    TransferProgress* progress = nullptr;
+    vector<Candidate> candidates;
+    mutex candidatesLock;
+    atomic<uint64_t> unreadable{0};
+    TaskGroup group;
+    
+    void scanDirectory(const fs::path& dirPath, bool isRoot) {
+        vector<string> subdirectories;
+        vector<Candidate> found;
+        
+        #ifdef _WIN32
+        error_code ec;
+        for (fs::directory_iterator it(dirPath, ec), end; !ec && it != end; it.increment(ec)) {
+            progress->files++;
+            if (it->is_symlink(ec)) continue;
+            if (it->is_directory(ec)) {
+                subdirectories.push_back(it->path().filename().string());
+            } else if (it->is_regular_file(ec)) {
+                uintmax_t size = it->file_size(ec);
+                if (!ec && size > 0) found.push_back({it->path(), size});
+            }
+        }
+        if (ec) unreadable++;
+        #else
+        int dirfd = open(dirPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | (isRoot ? 0 : O_NOFOLLOW));
+        if (dirfd < 0) {
+            unreadable++;
+            return;
+        }
+        try {
+            DirectoryReader::scan(dirfd, dirPath, [&](const char* name, unsigned char type) {
+                progress->files++;
+                if (type == DT_DIR) {
+                    subdirectories.push_back(name);
+                    return;
+                }
+                // Links, devices and sockets are never duplicates
+                if (type != DT_REG && type != DT_UNKNOWN) return;
+                
+                struct stat st;
+                Metrics::add(Metric::StatCalls);
+                if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+                if (S_ISDIR(st.st_mode)) {
+                    subdirectories.push_back(name);
+                } else if (S_ISREG(st.st_mode) && st.st_size > 0) {
+                    found.push_back({dirPath / name, static_cast<uint64_t>(st.st_size),
+                                     static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino)});
+                }
+            });
+        } catch (const fs::filesystem_error&) {
+            unreadable++;
+        }
+        close(dirfd);
+        #endif
+        
+        progress->directories++;
+        if (!found.empty()) {
+            lock_guard<mutex> guard(candidatesLock);
+            move(found.begin(), found.end(), back_inserter(candidates));
+        }
+        for (auto& name : subdirectories) {
+            fs::path child = dirPath / name;
+            group.submit([this, child] { scanDirectory(child, false); });
+        }
+    }
+    
+    // Hashes the first and last sampleBytes of a file, or all of it when
+    // that is less than both samples together
+    void hash(Candidate& candidate, bool whole) {
+        XxHash64 hasher;
+        bool wholeFile = whole || candidate.size <= 2 * sampleBytes;
+        HashReader reader;
+        bool ok = reader.open(candidate.path, wholeFile && candidate.size > 2 * sampleBytes) && reader.size() == candidate.size;
+        if (ok) {
+            ok = wholeFile ? reader.feed(hasher, 0, candidate.size, *progress)
+                           : reader.feed(hasher, 0, sampleBytes, *progress) &&
+                             reader.feed(hasher, candidate.size - sampleBytes, sampleBytes, *progress);
+        }
+        if (!ok) {
+            candidate.unreadable = true;
+            unreadable++;
+            return;
+        }
+        candidate.hash = hasher.digest();
+        candidate.hashedWhole = wholeFile;
+        progress->files++;
+    }
+    
+    // Keeps only candidates that share their size (and hash, once there is
+    // one) with another readable candidate; returns how many are left
+    size_t keepCollisions(bool byHash) {
+        sort(candidates.begin(), candidates.end(), [byHash](const Candidate& a, const Candidate& b) {
+            if (a.size != b.size) return a.size > b.size;
+            return byHash && a.hash < b.hash;
+        });
+        auto same = [byHash](const Candidate& a, const Candidate& b) {
+            return a.size == b.size && (!byHash || a.hash == b.hash);
+        };
+        
+        vector<Candidate> kept;
+        for (size_t i = 0; i < candidates.size();) {
+            size_t end = i;
+            size_t readable = 0;
+            while (end < candidates.size() && same(candidates[i], candidates[end])) {
+                if (!candidates[end].unreadable) readable++;
+                end++;
+            }
+            if (readable > 1) {
+                for (; i < end; i++) {
+                    if (!candidates[i].unreadable) kept.push_back(move(candidates[i]));
+                }
+            }
+            i = end;
+        }
+        candidates = move(kept);
+        return candidates.size();
+    }
+    
+public:
+    explicit DuplicateFinder(WorkStealingPool& pool) : group(pool) {}
+    
+    // Pass 1: collect the size of every non-empty regular file
+    void start(const fs::path& root, TransferProgress& walkProgress) {
+        progress = &walkProgress;
+        group.submit([this, root] { scanDirectory(root, true); });
+    }
+    
+    // Groups by size; hard links to one inode count once. Returns the
+    // number of files that share their size with another file.
+    size_t bucketBySize() {
+        #ifndef _WIN32
+        sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+            if (a.device != b.device) return a.device < b.device;
+            return a.inode != b.inode ? a.inode < b.inode : a.path < b.path;
+        });
+        candidates.erase(unique(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+            return a.device == b.device && a.inode == b.inode;
+        }), candidates.end());
+        #endif
+        return keepCollisions(false);
+    }
+    
+    // Pass 2: head and tail samples, in batches since each file is tiny work
+    void startSampling(TransferProgress& sampleProgress) {
+        progress = &sampleProgress;
+        for (size_t first = 0; first < candidates.size(); first += sampleBatch) {
+            size_t last = min(candidates.size(), first + sampleBatch);
+            group.submit([this, first, last] {
+                for (size_t i = first; i < last; i++) hash(candidates[i], false);
+            });
+        }
+    }
+    
+    // Pass 3: full hashes of the files whose samples did not settle it
+    void startFullHash(TransferProgress& hashProgress) {
+        progress = &hashProgress;
+        for (auto& candidate : candidates) {
+            if (!candidate.hashedWhole) {
+                Candidate* target = &candidate;
+                group.submit([this, target] { hash(*target, true); });
+            }
+        }
+    }
+    
+    // Regroups after a hashing pass; returns the number of candidates left
+    size_t bucketByHash() {
+        return keepCollisions(true);
+    }
+    
+    bool waitFor(chrono::milliseconds timeout) {
+        return group.waitFor(timeout);
+    }
+    
+    // Sets of identical files, the most reclaimable space first
+    vector<Group> groups() const {
+        vector<Group> result;
+        for (size_t i = 0; i < candidates.size();) {
+            Group current{candidates[i].size, {}};
+            size_t end = i;
+            while (end < candidates.size() && candidates[end].size == candidates[i].size &&
+                   candidates[end].hash == candidates[i].hash) {
+                current.paths.push_back(candidates[end].path);
+                end++;
+            }
+            sort(current.paths.begin(), current.paths.end());
+            result.push_back(move(current));
+            i = end;
+        }
+        stable_sort(result.begin(), result.end(), [](const Group& a, const Group& b) {
+            return a.size * (a.paths.size() - 1) > b.size * (b.paths.size() - 1);
+        });
+        return result;
+    }
+    
+    uint64_t unreadableItems() const {
+        return unreadable;
+    }
+};
+
+// Checksum manifests written by `paste --verify`, and their recheck. A
+// manifest is text, one file per line: XXH64 in hex, size, then the path
+// relative to the manifest's own directory. Rechecking reads every listed
+// file once, one pool task per file.
+class ManifestVerifier {
+public:
+    enum class Result { Pending, Match, Mismatch, WrongSize, Missing };
+    
+    struct Check {
+        ChecksumEntry entry;
+        Result result = Result::Pending;
+    };
+    
+private:
+    TransferProgress& progress;
+    vector<Check> checks;
+    TaskGroup group;
+    
+    void check(Check& item) {
+        HashReader reader;
+        XxHash64 hasher;
+        if (!reader.open(item.entry.path, true)) {
+            item.result = Result::Missing;
+        } else if (reader.size() != item.entry.size) {
+            item.result = Result::WrongSize;
+        } else if (!reader.feed(hasher, 0, item.entry.size, progress)) {
+            item.result = Result::Missing;
+        } else {
+            item.result = hasher.digest() == item.entry.hash ? Result::Match : Result::Mismatch;
+        }
+        progress.files++;
+    }
+    
+public:
+    ManifestVerifier(WorkStealingPool& pool, TransferProgress& progress) : progress(progress), group(pool) {}
+    
+    // Written in path order to a temporary name first, so a manifest is
+    // stable across runs and never half there
+    static void save(const fs::path& manifest, vector<ChecksumEntry> entries) {
+        sort(entries.begin(), entries.end(), [](const ChecksumEntry& a, const ChecksumEntry& b) { return a.path < b.path; });
+        fs::path directory = manifest.parent_path();
+        fs::path temporary = manifest;
+        temporary += ".tmp";
+        {
+            ofstream out(temporary, ios::binary | ios::trunc);
+            if (!out) {
+                throw fs::filesystem_error("Cannot create manifest", temporary, make_error_code(errc::io_error));
+            }
+            out << "# xxh64 size path\n";
+            char hash[17];
+            for (const auto& entry : entries) {
+                snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(entry.hash));
+                out << hash << ' ' << entry.size << ' ' << entry.path.lexically_relative(directory).generic_u8string() << '\n';
+            }
+            out.flush();
+            if (!out) {
+                throw fs::filesystem_error("Cannot write manifest", temporary, make_error_code(errc::io_error));
+            }
+        }
+        syncFile(temporary);
+        fs::rename(temporary, manifest);
+    }
+    
+    // Returns false with `error` set when the manifest cannot be used
+    static bool load(const fs::path& manifest, vector<ChecksumEntry>& entries, string& error) {
+        ifstream in(manifest, ios::binary);
+        if (!in) {
+            error = "Could not open manifest '" + manifest.string() + "'";
+            return false;
+        }
+        fs::path directory = manifest.parent_path();
+        string line;
+        size_t lineNumber = 0;
+        while (getline(in, line)) {
+            lineNumber++;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty() || line[0] == '#') continue;
+            
+            size_t hashEnd = line.find(' ');
+            size_t sizeEnd = hashEnd == string::npos ? string::npos : line.find(' ', hashEnd + 1);
+            if (hashEnd != 16 || sizeEnd == string::npos || sizeEnd + 1 >= line.size()) {
+                error = "Malformed manifest line " + to_string(lineNumber);
+                return false;
+            }
+            try {
+                ChecksumEntry entry;
+                entry.hash = stoull(line.substr(0, hashEnd), nullptr, 16);
+                entry.size = stoull(line.substr(hashEnd + 1, sizeEnd - hashEnd - 1));
+                entry.path = directory / fs::u8path(line.substr(sizeEnd + 1));
+                entries.push_back(move(entry));
+            } catch (const exception&) {
+                error = "Malformed manifest line " + to_string(lineNumber);
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    void start(const vector<ChecksumEntry>& entries) {
+        checks.reserve(entries.size());
+        for (const auto& entry : entries) {
+            checks.push_back({entry});
+        }
+        for (auto& item : checks) {
+            Check* target = &item;
+            group.submit([this, target] { check(*target); });
+        }
+    }
+    
+    bool waitFor(chrono::milliseconds timeout) {
+        return group.waitFor(timeout);
+    }
+    
+    const vector<Check>& results() const {
+        return checks;
+    }
+};
+
+// Gives a copied file or directory the mode and mtime of its original;
+// `modified` is in the form DirectorySnapshot reports. Refuses a path that
+// is a link, or not a directory when `directory` is set, so metadata never
+// lands on whatever a link that replaced the copy points to. The entry is
+// opened once without following links and everything happens on that
+// descriptor, so a link swapped in midway cannot redirect it either.
+void applyModeAndTime(const fs::path& path, unsigned int mode, int64_t modified, bool directory) {
+    #ifdef _WIN32
+    error_code ec;
+    if (fs::is_symlink(fs::symlink_status(path, ec)) || (directory && !fs::is_directory(fs::symlink_status(path, ec)))) {
+        throw fs::filesystem_error("Not the entry that was copied", path, make_error_code(errc::not_a_directory));
+    }
+    fs::last_write_time(path, fs::file_time_type(fs::file_time_type::duration(modified)), ec);
+    #else
+    // O_NONBLOCK keeps a FIFO from blocking the open; a file the owner may
+    // only write is opened for writing instead
+    int flags = O_NOFOLLOW | O_CLOEXEC | O_NONBLOCK | (directory ? O_DIRECTORY : 0);
+    int fd = open(path.c_str(), O_RDONLY | flags);
+    if (fd < 0 && errno == EACCES && !directory) {
+        fd = open(path.c_str(), O_WRONLY | flags);
+    }
+    if (fd < 0) {
+        int error = errno;
+        if (error == ELOOP || error == ENOTDIR) fail("Not the entry that was copied", path, error);
+        fail("Cannot open", path, error);
+    }
+    unique_ptr<int, void (*)(int*)> closer(&fd, [](int* descriptor) { close(*descriptor); });
+    
+    struct stat st;
+    Metrics::add(Metric::StatCalls);
+    if (fstat(fd, &st) != 0) fail("Cannot stat", path, errno);
+    if (directory && !S_ISDIR(st.st_mode)) fail("Not the entry that was copied", path, ENOTDIR);
+    
+    struct timespec times[2];
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    // Floor division: a pre-1970 time still needs tv_nsec in [0, 1e9)
+    int64_t seconds = modified / 1000000000;
+    int64_t nanoseconds = modified % 1000000000;
+    if (nanoseconds < 0) {
+        seconds--;
+        nanoseconds += 1000000000;
+    }
+    times[1].tv_sec = static_cast<time_t>(seconds);
+    times[1].tv_nsec = static_cast<long>(nanoseconds);
+    if (fchmod(fd, mode) != 0) fail("Cannot set permissions", path, errno);
+    if (futimens(fd, times) != 0) fail("Cannot set times", path, errno);
+    #endif
+}
+
+// One step of a sync plan; `relative` names the same entry under both roots
+struct SyncAction {
+    enum class Kind : uint8_t { MakeDirectory, Copy, Update, Link, Remove };
+    
+    Kind kind;
+    fs::path relative;
+    uint64_t size = 0;
+    int64_t modified = 0;       // source mtime: ns since the epoch, file_time_type ticks on Windows
+    unsigned int mode = 0;
+    bool delta = false;         // Update: rebuild from the old copy instead of rewriting it
+    bool directory = false;     // Remove: the destination is a directory tree
+    string target;              // Link
+    
+    SyncAction(Kind kind, fs::path relative, uint64_t size = 0, int64_t modified = 0, unsigned int mode = 0)
+        : kind(kind), relative(move(relative)), size(size), modified(modified), mode(mode) {}
+};
+
+#ifndef _WIN32
+// Updates a file from a new version of it the way rsync does locally: the
+// old copy is cut into blocks of about sqrt(size) bytes, each with a weak
+// rolling sum and an XXH64, and one pass of a rolling window over the new
+// version finds those blocks at any offset. Only the bytes in between are
+// read from the new version. The updated copy is always assembled beside the
+// old one from old blocks (copy_file_range, so shared extents on CoW
+// filesystems) and new bytes, flushed, then renamed over it: a crash leaves
+// either the old file or the new one, never a mix.
+class BlockDelta {
+public:
+    static constexpr uint64_t minimumSize = 1024 * 1024;    // smaller files are copied whole
+    
+    struct Result {
+        uint64_t written = 0;       // bytes taken from the new version
+        uint64_t reused = 0;        // bytes kept from the old copy
+    };
+    
+private:
+    static constexpr size_t filterBits = 1 << 20;
+    
+    // Adler-32 style sum from rsync: `a` adds up the window, `b` adds up `a`
+    struct RollingSum {
+        uint32_t a = 0;
+        uint32_t b = 0;
+        uint32_t length = 0;
+        
+        void reset(const unsigned char* data, size_t count) {
+            a = b = 0;
+            length = static_cast<uint32_t>(count);
+            for (size_t i = 0; i < count; i++) {
+                a += data[i];
+                b += a;
+            }
+        }
+        
+        void roll(unsigned char out, unsigned char in) {
+            a += in - out;
+            b += a - length * out;
+        }
+        
+        uint32_t value() const { return (a & 0xffff) | (b << 16); }
+    };
+    
+    struct Signature {
+        size_t blockSize = 0;
+        vector<uint64_t> strong;
+        unordered_map<uint32_t, vector<uint32_t>> blocks;   // weak sum -> block numbers
+        vector<uint64_t> filter;    // one bit per weak sum bucket, so most misses skip the map
+        uint64_t tailOffset = 0;    // the short last block, matched only at the end
+        size_t tailLength = 0;
+        uint64_t tailHash = 0;
+        
+        static size_t bucket(uint32_t weak) { return (weak * 0x9E3779B1u) >> 12; }
+        bool mayContain(uint32_t weak) const { return (filter[bucket(weak) / 64] >> (bucket(weak) % 64)) & 1; }
+    };
+    
+    // A run of the new version: either new bytes or a range of the old copy
+    struct Instruction {
+        uint64_t offset;
+        uint64_t length;
+        bool literal;
+        uint64_t from = 0;
+    };
+    
+    // Sequential reads through a MappedFile without remapping for every byte
+    class Window {
+    private:
+        MappedFile& file;
+        const fs::path& path;
+        const unsigned char* data = nullptr;
+        uint64_t start = 0;
+        size_t length = 0;
+    
+    public:
+        Window(MappedFile& file, const fs::path& path) : file(file), path(path) {}
+        
+        const unsigned char* at(uint64_t offset, size_t count) {
+            if (!data || offset < start || offset + count > start + length) {
+                size_t available = 0;
+                data = reinterpret_cast<const unsigned char*>(file.view(offset, count, available));
+                if (!data || available < count) fail("Cannot read file", path, EIO);
+                start = offset;
+                length = available;
+            }
+            return data + (offset - start);
+        }
+    };
+    
+    static size_t blockSizeFor(uint64_t size) {
+        uint64_t root = static_cast<uint64_t>(sqrt(static_cast<double>(size)));
+        return static_cast<size_t>(clamp<uint64_t>((root + 4095) / 4096 * 4096, 4096, 256 * 1024));
+    }
+    
+    static Signature sign(const fs::path& path, uint64_t newSize) {
+        MappedFile old;
+        if (!old.open(path)) fail("Cannot open file", path, errno);
+        Window window(old, path);
+        
+        Signature signature;
+        signature.blockSize = blockSizeFor(max(newSize, old.size()));
+        signature.filter.assign(filterBits / 64, 0);
+        uint64_t blocks = old.size() / signature.blockSize;
+        signature.strong.reserve(blocks);
+        RollingSum sum;
+        for (uint64_t block = 0; block < blocks; block++) {
+            const unsigned char* data = window.at(block * signature.blockSize, signature.blockSize);
+            sum.reset(data, signature.blockSize);
+            signature.strong.push_back(XxHash64::of(data, signature.blockSize));
+            signature.blocks[sum.value()].push_back(static_cast<uint32_t>(block));
+            size_t bucket = Signature::bucket(sum.value());
+            signature.filter[bucket / 64] |= 1ull << (bucket % 64);
+        }
+        signature.tailOffset = blocks * signature.blockSize;
+        if (signature.tailOffset < old.size()) {
+            signature.tailLength = static_cast<size_t>(old.size() - signature.tailOffset);
+            signature.tailHash = XxHash64::of(window.at(signature.tailOffset, signature.tailLength), signature.tailLength);
+        }
+        Metrics::add(Metric::BytesRead, old.size());
+        return signature;
+    }
+    
+    static void append(vector<Instruction>& instructions, uint64_t offset, uint64_t length, bool literal, uint64_t from) {
+        if (!instructions.empty()) {
+            Instruction& last = instructions.back();
+            if (last.literal && literal) {
+                last.length += length;
+                return;
+            }
+            if (!last.literal && !literal && last.from + last.length == from) {
+                last.length += length;
+                return;
+            }
+        }
+        instructions.push_back({offset, length, literal, from});
+    }
+    
+    static vector<Instruction> match(MappedFile& input, const fs::path& source, const Signature& signature) {
+        vector<Instruction> instructions;
+        Window window(input, source);
+        uint64_t size = input.size();
+        size_t blockSize = signature.blockSize;
+        uint64_t literalStart = 0;
+        uint64_t position = 0;
+        RollingSum sum;
+        bool primed = false;
+        
+        while (position + blockSize <= size) {
+            if (!primed) {
+                sum.reset(window.at(position, blockSize), blockSize);
+                primed = true;
+            }
+            
+            int64_t found = -1;
+            uint32_t weak = sum.value();
+            if (signature.mayContain(weak)) {
+                auto candidates = signature.blocks.find(weak);
+                if (candidates != signature.blocks.end()) {
+                    uint64_t strong = XxHash64::of(window.at(position, blockSize), blockSize);
+                    for (uint32_t block : candidates->second) {
+                        // The block at the same offset wins, so unchanged stretches merge into one copy
+                        if (signature.strong[block] == strong && (found < 0 || block * blockSize == position)) {
+                            found = block;
+                        }
+                    }
+                }
+            }
+            
+            if (found >= 0) {
+                if (literalStart < position) {
+                    append(instructions, literalStart, position - literalStart, true, 0);
+                }
+                append(instructions, position, blockSize, false, static_cast<uint64_t>(found) * blockSize);
+                position += blockSize;
+                literalStart = position;
+                primed = false;
+                continue;
+            }
+            
+            if (position + blockSize < size) {
+                const unsigned char* data = window.at(position, blockSize + 1);
+                sum.roll(data[0], data[blockSize]);
+            }
+            position++;
+        }
+        
+        // The old copy's short last block can only match the end of the new version
+        size_t tail = signature.tailLength;
+        if (tail > 0 && size - literalStart >= tail &&
+            XxHash64::of(window.at(size - tail, tail), tail) == signature.tailHash) {
+            if (literalStart < size - tail) {
+                append(instructions, literalStart, size - tail - literalStart, true, 0);
+            }
+            append(instructions, size - tail, tail, false, signature.tailOffset);
+        } else if (literalStart < size) {
+            append(instructions, literalStart, size - literalStart, true, 0);
+        }
+        return instructions;
+    }
+    
+    static void writeFrom(Window& window, int out, uint64_t offset, uint64_t length, const fs::path& destination) {
+        while (length > 0) {
+            size_t count = static_cast<size_t>(min<uint64_t>(length, 1 << 20));
+            const char* data = reinterpret_cast<const char*>(window.at(offset, count));
+            for (size_t done = 0; done < count;) {
+                ssize_t put = pwrite(out, data + done, count - done, static_cast<off_t>(offset + done));
+                if (put < 0 && errno == EINTR) continue;
+                if (put < 0) fail("Cannot write file", destination, errno);
+                done += put;
+            }
+            Metrics::add(Metric::BytesWritten, count);
+            offset += count;
+            length -= count;
+        }
+    }
+    
+    // Copies [from, from + length) of the old copy to `offset` of the new one
+    static void copyOld(int in, int out, uint64_t from, uint64_t offset, uint64_t length, const fs::path& destination) {
+        #ifdef __linux__
+        loff_t inOffset = static_cast<loff_t>(from);
+        loff_t outOffset = static_cast<loff_t>(offset);
+        while (length > 0) {
+            ssize_t copied = copy_file_range(in, &inOffset, out, &outOffset, static_cast<size_t>(min<uint64_t>(length, 16 << 20)), 0);
+            if (copied < 0 && errno == EINTR) continue;
+            if (copied <= 0) break;
+            length -= copied;
+        }
+        from = static_cast<uint64_t>(inOffset);
+        offset = static_cast<uint64_t>(outOffset);
+        #endif
+        vector<char> buffer(static_cast<size_t>(min<uint64_t>(length, 1 << 20)));
+        while (length > 0) {
+            ssize_t got = pread(in, buffer.data(), static_cast<size_t>(min<uint64_t>(length, buffer.size())), static_cast<off_t>(from));
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) fail("Cannot read file", destination, got < 0 ? errno : EIO);
+            for (ssize_t done = 0; done < got;) {
+                ssize_t put = pwrite(out, buffer.data() + done, got - done, static_cast<off_t>(offset + done));
+                if (put < 0 && errno == EINTR) continue;
+                if (put < 0) fail("Cannot write file", destination, errno);
+                done += put;
+            }
+            from += got;
+            offset += got;
+            length -= got;
+        }
+    }
+    
+public:
+    // Brings `destination` up to date with `source`; the caller sets its
+    // mode and times afterwards
+    static Result apply(const fs::path& source, const fs::path& destination, TransferProgress& progress) {
+        MappedFile input;
+        if (!input.open(source)) fail("Cannot open file", source, errno);
+        Signature signature = sign(destination, input.size());
+        vector<Instruction> instructions = match(input, source, signature);
+        progress.bytes += input.size();
+        Metrics::add(Metric::BytesRead, input.size());
+        
+        Result result;
+        for (const auto& step : instructions) {
+            (step.literal ? result.written : result.reused) += step.length;
+        }
+        
+        Window window(input, source);
+        fs::path temporary = destination;
+        temporary += ".sync-part";
+        int in = ::open(destination.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) fail("Cannot open file", destination, errno);
+        int out = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (out < 0) {
+            int error = errno;
+            close(in);
+            fail("Cannot create file", temporary, error);
+        }
+        try {
+            for (const auto& step : instructions) {
+                if (step.literal) {
+                    writeFrom(window, out, step.offset, step.length, temporary);
+                } else {
+                    copyOld(in, out, step.from, step.offset, step.length, temporary);
+                }
+            }
+            // The data must be on disk before the rename makes it the only copy
+            if (fdatasync(out) != 0) fail("Cannot flush file", temporary, errno);
+            if (rename(temporary.c_str(), destination.c_str()) != 0) fail("Cannot replace file", destination, errno);
+        } catch (...) {
+            close(in);
+            close(out);
+            unlink(temporary.c_str());
+            throw;
+        }
+        close(in);
+        close(out);
+        return result;
+    }
+};
+#endif
+
+// One entry of a directory listing as sync and pack see it; mtimes are ns
+// since the epoch on POSIX and file_time_type ticks on Windows
+struct SnapshotEntry {
+    string name;
+    char type = 'o';            // 'f'ile, 'd'irectory, 'l'ink or 'o'ther
+    uint64_t size = 0;
+    int64_t modified = 0;
+    unsigned int mode = 0;
+};
+
+class DirectorySnapshot {
+public:
+    // Entries of `directory` sorted by name; false when it cannot be read
+    static bool list(const fs::path& directory, vector<SnapshotEntry>& entries) {
+        #ifdef _WIN32
+        error_code ec;
+        for (fs::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+            SnapshotEntry entry;
+            entry.name = it->path().filename().string();
+            error_code statError;
+            fs::file_status status = it->symlink_status(statError);
+            if (fs::is_symlink(status)) {
+                entry.type = 'l';
+            } else if (fs::is_directory(status)) {
+                entry.type = 'd';
+            } else if (fs::is_regular_file(status)) {
+                entry.type = 'f';
+                entry.size = it->file_size(statError);
+                entry.modified = it->last_write_time(statError).time_since_epoch().count();
+            }
+            entries.push_back(move(entry));
+        }
+        if (ec) return false;
+        #else
+        int dirfd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirfd < 0) return false;
+        try {
+            DirectoryReader::scan(dirfd, directory, [&](const char* name, unsigned char) {
+                struct stat st;
+                Metrics::add(Metric::StatCalls);
+                if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+                SnapshotEntry entry;
+                entry.name = name;
+                entry.type = S_ISREG(st.st_mode) ? 'f' : S_ISDIR(st.st_mode) ? 'd' : S_ISLNK(st.st_mode) ? 'l' : 'o';
+                entry.size = static_cast<uint64_t>(st.st_size);
+                #ifdef __APPLE__
+                entry.modified = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+                #else
+                entry.modified = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+                #endif
+                entry.mode = st.st_mode & 07777;
+                entries.push_back(move(entry));
+            });
+        } catch (const fs::filesystem_error&) {
+            close(dirfd);
+            return false;
+        }
+        close(dirfd);
+        #endif
+        sort(entries.begin(), entries.end(), [](const SnapshotEntry& a, const SnapshotEntry& b) { return a.name < b.name; });
+        return true;
+    }
+};
+
+// Compares two trees for sync. Both sides of a directory pair are listed
+// by one pool task, which queues its subdirectory pairs as further tasks;
+// a directory missing from the destination is only listed on the source
+// side. Files match when their size and mtime agree (or their XXH64, with
+// checksums), so an unchanged tree costs one stat per entry on each side.
+class SyncPlanner {
+private:
+    using Entry = SnapshotEntry;
+    
+    fs::path sourceRoot;
+    fs::path destinationRoot;
+    bool byChecksum;
+    bool deleteExtras;
+    TransferProgress& progress;
+    mutex actionsLock;
+    vector<SyncAction> actions;
+    atomic<uint64_t> unchanged{0};
+    atomic<uint64_t> unreadable{0};
+    TaskGroup group;
+    
+    static string readLink(const fs::path& path) {
+        error_code ec;
+        return fs::read_symlink(path, ec).string();
+    }
+    
+    static SyncAction removal(const fs::path& relative, const Entry& entry) {
+        SyncAction action{SyncAction::Kind::Remove, relative};
+        action.directory = entry.type == 'd';
+        return action;
+    }
+    
+    // Plans `entry`, and everything under it, as new on the destination
+    void planNew(const fs::path& relative, const Entry& entry, vector<SyncAction>& planned) {
+        SyncAction action{SyncAction::Kind::Copy, relative, entry.size, entry.modified, entry.mode};
+        if (entry.type == 'd') {
+            action.kind = SyncAction::Kind::MakeDirectory;
+            group.submit([this, relative] { compare(relative, false); });
+        } else if (entry.type == 'l') {
+            action.kind = SyncAction::Kind::Link;
+            action.target = readLink(sourceRoot / relative);
+        }
+        planned.push_back(move(action));
+    }
+    
+    bool sameContent(const fs::path& relative, uint64_t size) {
+        HashReader source;
+        HashReader destination;
+        XxHash64 sourceHash;
+        XxHash64 destinationHash;
+        if (!source.open(sourceRoot / relative, true) || !destination.open(destinationRoot / relative, true) ||
+            !source.feed(sourceHash, 0, size, progress) || !destination.feed(destinationHash, 0, size, progress)) {
+            return false;
+        }
+        return sourceHash.digest() == destinationHash.digest();
+    }
+    
+    void compareFiles(const fs::path& relative, const Entry& source, const Entry& destination, vector<SyncAction>& planned) {
+        SyncAction update{SyncAction::Kind::Update, relative, source.size, source.modified, source.mode};
+        #ifndef _WIN32
+        update.delta = source.size >= BlockDelta::minimumSize && destination.size >= BlockDelta::minimumSize;
+        #endif
+        
+        if (source.size == destination.size && byChecksum) {
+            group.submit([this, update] {
+                if (sameContent(update.relative, update.size)) {
+                    unchanged++;
+                    return;
+                }
+                lock_guard<mutex> guard(actionsLock);
+                actions.push_back(update);
+            });
+        } else if (source.size == destination.size && source.modified == destination.modified) {
+            unchanged++;
+        } else {
+            planned.push_back(move(update));
+        }
+    }
+    
+    void compare(const fs::path& relative, bool destinationExists) {
+        vector<Entry> sources;
+        vector<Entry> destinations;
+        if (!DirectorySnapshot::list(sourceRoot / relative, sources) ||
+            (destinationExists && !DirectorySnapshot::list(destinationRoot / relative, destinations))) {
+            unreadable++;
+            return;
+        }
+        progress.directories++;
+        
+        vector<SyncAction> planned;
+        auto source = sources.begin();
+        auto destination = destinations.begin();
+        while (source != sources.end() || destination != destinations.end()) {
+            if (source == sources.end() || (destination != destinations.end() && destination->name < source->name)) {
+                if (deleteExtras) planned.push_back(removal(relative / destination->name, *destination));
+                ++destination;
+                continue;
+            }
+            
+            progress.files++;
+            fs::path child = relative / source->name;
+            if (destination == destinations.end() || source->name < destination->name) {
+                // Sockets, pipes and devices are not synced
+                if (source->type != 'o') planNew(child, *source, planned);
+                ++source;
+                continue;
+            }
+            
+            if (source->type == 'o') {
+                // Left alone on both sides
+            } else if (source->type != destination->type) {
+                planned.push_back(removal(child, *destination));
+                planNew(child, *source, planned);
+            } else if (source->type == 'd') {
+                group.submit([this, child] { compare(child, true); });
+            } else if (source->type == 'f') {
+                compareFiles(child, *source, *destination, planned);
+            } else if (readLink(sourceRoot / child) != readLink(destinationRoot / child)) {
+                SyncAction link{SyncAction::Kind::Link, child};
+                link.target = readLink(sourceRoot / child);
+                planned.push_back(move(link));
+            } else {
+                unchanged++;
+            }
+            ++source;
+            ++destination;
+        }
+        
+        if (!planned.empty()) {
+            lock_guard<mutex> guard(actionsLock);
+            move(planned.begin(), planned.end(), back_inserter(actions));
+        }
+    }
+    
+public:
+    SyncPlanner(WorkStealingPool& pool, TransferProgress& progress, const fs::path& source, const fs::path& destination,
+                bool byChecksum, bool deleteExtras)
+        : sourceRoot(source), destinationRoot(destination), byChecksum(byChecksum), deleteExtras(deleteExtras),
+          progress(progress), group(pool) {}
+    
+    // A missing destination is planned in full without being listed
+    void start(bool destinationExists) {
+        group.submit([this, destinationExists] { compare(fs::path(), destinationExists); });
+    }
+    
+    bool waitFor(chrono::milliseconds timeout) {
+        return group.waitFor(timeout);
+    }
+    
+    // The plan in path order, so every directory comes before its contents
+    vector<SyncAction> plan() {
+        lock_guard<mutex> guard(actionsLock);
+        sort(actions.begin(), actions.end(), [](const SyncAction& a, const SyncAction& b) {
+            if (a.relative != b.relative) return a.relative < b.relative;
+            return a.kind == SyncAction::Kind::Remove && b.kind != SyncAction::Kind::Remove;
+        });
+        return move(actions);
+    }
+    
+    uint64_t unchangedFiles() const { return unchanged; }
+    uint64_t unreadableItems() const { return unreadable; }
+};
+
+// Carries out a sync plan in stages, each waited for by the caller:
+// removals first, so a changed type frees its name, then directories in
+// path order, then copies and deltas on the pool, and last the source
+// modes and mtimes, which is what lets the next sync skip these files.
+class SyncEngine {
+private:
+    static constexpr size_t metadataBatch = 256;    // entries per task in the last stage
+    
+    WorkStealingPool& pool;
+    fs::path sourceRoot;
+    fs::path destinationRoot;
+    const vector<SyncAction>& actions;
+    TransferProgress& progress;
+    CopyEngine copier;
+    vector<fs::path> trees;         // removed one at a time, each by a parallel DeleteEngine
+    size_t nextTree = 0;
+    unique_ptr<DeleteEngine> remover;
+    atomic<uint64_t> deltaFiles{0};
+    atomic<uint64_t> deltaWritten{0};
+    atomic<uint64_t> deltaReused{0};
+    TaskGroup group;
+    
+    void remove(const fs::path& path) {
+        #ifdef _WIN32
+        fs::remove(path);
+        #else
+        if (unlink(path.c_str()) != 0 && errno != ENOENT) fail("Cannot delete", path, errno);
+        #endif
+        progress.files++;
+    }
+    
+    void link(const SyncAction& action) {
+        fs::path path = destinationRoot / action.relative;
+        #ifdef _WIN32
+        error_code ec;
+        fs::remove(path, ec);
+        fs::create_symlink(action.target, path);
+        #else
+        if (unlink(path.c_str()) != 0 && errno != ENOENT) fail("Cannot replace link", path, errno);
+        if (symlink(action.target.c_str(), path.c_str()) != 0) fail("Cannot create link", path, errno);
+        #endif
+        progress.files++;
+    }
+    
+    void setMetadata(const SyncAction& action) {
+        applyModeAndTime(destinationRoot / action.relative, action.mode, action.modified,
+                         action.kind == SyncAction::Kind::MakeDirectory);
+    }
+    
+public:
+    SyncEngine(WorkStealingPool& pool, TransferProgress& progress, const fs::path& source, const fs::path& destination,
+               const vector<SyncAction>& actions)
+        : pool(pool), sourceRoot(source), destinationRoot(destination), actions(actions), progress(progress),
+          copier(pool, progress), group(pool) {}
+    
+    void startRemovals() {
+        for (const auto& action : actions) {
+            if (action.kind != SyncAction::Kind::Remove) continue;
+            if (action.directory) {
+                trees.push_back(destinationRoot / action.relative);
+            } else {
+                group.submit([this, path = destinationRoot / action.relative] { remove(path); });
+            }
+        }
+    }
+    
+    // Directories are made owner-writable here and get their own mode last
+    void makeDirectories() {
+        for (const auto& action : actions) {
+            if (action.kind != SyncAction::Kind::MakeDirectory) continue;
+            fs::path path = destinationRoot / action.relative;
+            #ifdef _WIN32
+            fs::create_directory(path);
+            #else
+            if (mkdir(path.c_str(), 0700) != 0 && errno != EEXIST) fail("Cannot create directory", path, errno);
+            #endif
+            progress.directories++;
+        }
+    }
+    
+    void startTransfers() {
+        for (const auto& action : actions) {
+            if (action.kind == SyncAction::Kind::Link) {
+                group.submit([this, &action] { link(action); });
+            } else if (action.kind == SyncAction::Kind::Copy || (action.kind == SyncAction::Kind::Update && !action.delta)) {
+                copier.start(sourceRoot / action.relative, destinationRoot / action.relative);
+            } else if (action.kind == SyncAction::Kind::Update) {
+                #ifndef _WIN32
+                group.submit([this, &action] {
+                    BlockDelta::Result result = BlockDelta::apply(sourceRoot / action.relative, destinationRoot / action.relative, progress);
+                    deltaFiles++;
+                    deltaWritten += result.written;
+                    deltaReused += result.reused;
+                    progress.files++;
+                });
+                #endif
+            }
+        }
+    }
+    
+    void startMetadata() {
+        vector<const SyncAction*> batch;
+        for (const auto& action : actions) {
+            if (action.kind == SyncAction::Kind::Remove || action.kind == SyncAction::Kind::Link) continue;
+            batch.push_back(&action);
+            if (batch.size() == metadataBatch) {
+                group.submit([this, batch] { for (const SyncAction* item : batch) setMetadata(*item); });
+                batch.clear();
+            }
+        }
+        if (!batch.empty()) {
+            group.submit([this, batch] { for (const SyncAction* item : batch) setMetadata(*item); });
+        }
+    }
+    
+    // Waits up to `timeout` (per engine involved); rethrows the first error
+    bool waitFor(chrono::milliseconds timeout) {
+        if (!group.waitFor(timeout)) {
+            return false;
+        }
+        while (remover || nextTree < trees.size()) {
+            if (!remover) {
+                remover = make_unique<DeleteEngine>(pool, progress);
+                remover->start(trees[nextTree++]);
+            }
+            if (!remover->waitFor(timeout)) {
+                return false;
+            }
+            remover.reset();
+        }
+        return copier.waitFor(timeout);
+    }
+    
+    uint64_t deltaCount() const { return deltaFiles; }
+    uint64_t deltaBytesWritten() const { return deltaWritten; }
+    uint64_t deltaBytesReused() const { return deltaReused; }
+};
+
+// LZ77 block codec in the style of LZ4, built in. A 16K-entry hash table
+// over 4-byte sequences finds earlier matches up to 64 KB back; output is
+// a series of sequences, each a token byte (literal and match length
+// nibbles), the literals, a 2-byte offset and any extra length bytes.
+// Input that does not compress is skipped over in growing steps.
+class LzCodec {
+private:
+    static constexpr int hashBits = 14;
+    static constexpr size_t minimumMatch = 4;
+    static constexpr size_t endLiterals = 5;        // the last bytes are always literals
+    static constexpr size_t matchStartLimit = 12;   // and no match starts this close to the end
+    
+    static uint32_t read32(const unsigned char* data) {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    
+    static size_t hash(uint32_t sequence) {
+        return (sequence * 2654435761u) >> (32 - hashBits);
+    }
+    
+    static void putLength(unsigned char*& out, size_t length) {
+        for (; length >= 255; length -= 255) {
+            *out++ = 255;
+        }
+        *out++ = static_cast<unsigned char>(length);
+    }
+    
+    static bool getLength(const unsigned char*& in, const unsigned char* end, size_t& length) {
+        unsigned char byte;
+        do {
+            if (in == end) return false;
+            byte = *in++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+    
+    // A zero `matchLength` ends the block after the literals
+    static void emit(unsigned char*& out, const unsigned char* literals, size_t literalLength, size_t offset, size_t matchLength) {
+        unsigned char* token = out++;
+        *token = static_cast<unsigned char>(min<size_t>(literalLength, 15) << 4);
+        if (literalLength >= 15) putLength(out, literalLength - 15);
+        memcpy(out, literals, literalLength);
+        out += literalLength;
+        if (matchLength == 0) return;
+        
+        *out++ = static_cast<unsigned char>(offset);
+        *out++ = static_cast<unsigned char>(offset >> 8);
+        size_t extra = matchLength - minimumMatch;
+        *token |= static_cast<unsigned char>(min<size_t>(extra, 15));
+        if (extra >= 15) putLength(out, extra - 15);
+    }
+    
+public:
+    // Largest possible output for `length` bytes of input
+    static size_t bound(size_t length) {
+        return length + length / 255 + 16;
+    }
+    
+    // `output` must hold bound(length) bytes; returns the compressed size
+    static size_t compress(const char* input, size_t length, char* output) {
+        const unsigned char* in = reinterpret_cast<const unsigned char*>(input);
+        unsigned char* out = reinterpret_cast<unsigned char*>(output);
+        size_t anchor = 0;
+        
+        if (length > matchStartLimit) {
+            thread_local vector<uint32_t> table;
+            table.assign(size_t(1) << hashBits, 0);
+            size_t limit = length - matchStartLimit;
+            size_t matchLimit = length - endLiterals;
+            size_t position = 0;
+            
+            while (position < limit) {
+                uint32_t sequence = read32(in + position);
+                size_t slot = hash(sequence);
+                size_t candidate = table[slot];
+                table[slot] = static_cast<uint32_t>(position);
+                if (candidate >= position || position - candidate > 65535 || read32(in + candidate) != sequence) {
+                    position += 1 + ((position - anchor) >> 6);
+                    continue;
+                }
+                
+                size_t matchLength = minimumMatch;
+                while (position + matchLength + 8 <= matchLimit) {
+                    uint64_t a, b;
+                    memcpy(&a, in + candidate + matchLength, 8);
+                    memcpy(&b, in + position + matchLength, 8);
+                    if (a != b) break;
+                    matchLength += 8;
+                }
+                while (position + matchLength < matchLimit && in[candidate + matchLength] == in[position + matchLength]) {
+                    matchLength++;
+                }
+                emit(out, in + anchor, position - anchor, position - candidate, matchLength);
+                position += matchLength;
+                anchor = position;
+            }
+        }
+        
+        emit(out, in + anchor, length - anchor, 0, 0);
+        return static_cast<size_t>(out - reinterpret_cast<unsigned char*>(output));
+    }
+    
+    // False unless the input decodes to exactly `rawLength` bytes
+    static bool decompress(const char* input, size_t length, char* output, size_t rawLength) {
+        const unsigned char* in = reinterpret_cast<const unsigned char*>(input);
+        const unsigned char* end = in + length;
+        unsigned char* begin = reinterpret_cast<unsigned char*>(output);
+        unsigned char* out = begin;
+        unsigned char* outEnd = begin + rawLength;
+        
+        while (in < end) {
+            unsigned int token = *in++;
+            size_t literalLength = token >> 4;
+            if (literalLength == 15 && !getLength(in, end, literalLength)) return false;
+            if (literalLength > static_cast<size_t>(end - in) || literalLength > static_cast<size_t>(outEnd - out)) return false;
+            memcpy(out, in, literalLength);
+            in += literalLength;
+            out += literalLength;
+            if (in == end) break;
+            
+            if (end - in < 2) return false;
+            size_t offset = in[0] | (static_cast<size_t>(in[1]) << 8);
+            in += 2;
+            size_t matchLength = token & 15;
+            if (matchLength == 15 && !getLength(in, end, matchLength)) return false;
+            matchLength += minimumMatch;
+            if (offset == 0 || offset > static_cast<size_t>(out - begin) || matchLength > static_cast<size_t>(outEnd - out)) {
+                return false;
+            }
+            
+            const unsigned char* match = out - offset;
+            if (offset >= matchLength) {
+                memcpy(out, match, matchLength);
+                out += matchLength;
+            } else {
+                // Overlapping copy repeats the last `offset` bytes
+                for (size_t i = 0; i < matchLength; i++) {
+                    *out++ = *match++;
+                }
+            }
+        }
+        return out == outEnd;
+    }
+};
+
+// A file read or written at explicit offsets, so that several tasks can
+// work on one file without sharing a position
+class PositionedFile {
+private:
+    fs::path path;
+    #ifdef _WIN32
+    fstream stream;
+    #else
+    int fd = -1;
+    #endif
+    
+public:
+    PositionedFile() = default;
+    PositionedFile(const PositionedFile&) = delete;
+    PositionedFile& operator=(const PositionedFile&) = delete;
+    
+    ~PositionedFile() {
+        #ifndef _WIN32
+        if (fd >= 0) close(fd);
+        #endif
+    }
+    
+    // Opening for writing creates a missing file, readable by its owner only
+    // until its mode is set
+    bool open(const fs::path& filePath, bool write) {
+        path = filePath;
+        #ifdef _WIN32
+        if (write && !fs::exists(path)) {
+            ofstream create(path, ios::binary);
+        }
+        stream.open(path, write ? ios::binary | ios::in | ios::out : ios::binary | ios::in);
+        return stream.is_open();
+        #else
+        fd = write ? ::open(path.c_str(), O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600)
+                   : ::open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        return fd >= 0;
+        #endif
+    }
+    
+    // False when fewer than `length` bytes could be read
+    bool readAt(uint64_t offset, char* data, size_t length) {
+        #ifdef _WIN32
+        stream.seekg(static_cast<streamoff>(offset));
+        stream.read(data, static_cast<streamsize>(length));
+        bool complete = static_cast<size_t>(stream.gcount()) == length;
+        stream.clear();
+        return complete;
+        #else
+        for (size_t done = 0; done < length;) {
+            ssize_t got = pread(fd, data + done, length - done, static_cast<off_t>(offset + done));
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            done += got;
+        }
+        return true;
+        #endif
+    }
+    
+    void writeAt(uint64_t offset, const char* data, size_t length) {
+        #ifdef _WIN32
+        stream.seekp(static_cast<streamoff>(offset));
+        stream.write(data, static_cast<streamsize>(length));
+        if (!stream) fail("Cannot write file", path, EIO);
+        #else
+        for (size_t done = 0; done < length;) {
+            ssize_t put = pwrite(fd, data + done, length - done, static_cast<off_t>(offset + done));
+            if (put < 0 && errno == EINTR) continue;
+            if (put < 0) fail("Cannot write file", path, errno);
+            done += put;
+        }
+        #endif
+    }
+    
+    void resize(uint64_t size) {
+        #ifdef _WIN32
+        stream.flush();
+        fs::resize_file(path, size);
+        #else
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) fail("Cannot resize file", path, errno);
+        #endif
+    }
+};
+
+// One member of an archive
+struct ArchiveEntry {
+    enum class Type : uint8_t { File, Directory, Link };
+    
+    Type type = Type::File;
+    string path;                // relative, '/'-separated UTF-8
+    uint32_t mode = 0;
+    int64_t modified = 0;       // ns since the Unix epoch
+    uint64_t size = 0;
+    uint64_t offset = 0;        // where the contents start in the data stream
+    string target;              // Link
+};
+
+struct ArchiveChunk {
+    uint64_t offset = 0;        // in the archive file
+    uint32_t storedLength = 0;
+    uint32_t rawLength = 0;
+    uint8_t method = 0;
+    uint64_t hash = 0;          // XXH64 of the raw data
+};
+
+// Archive layout, all integers little-endian:
+//   "FEPACK01"
+//   chunks      the contents of all files, in entry order, form one data
+//               stream that is cut into 1 MB chunks, each compressed by
+//               LzCodec or stored when that does not make it smaller
+//   directory   chunk count, then per chunk its offset u64, stored length
+//               u32, raw length u32, method u8 and XXH64 u64; entry count,
+//               then per entry type u8, mode u32, mtime i64, size u64,
+//               stream offset u64, and path and link target as u32 length
+//               plus bytes
+//   trailer     directory offset u64, directory length u64, directory
+//               XXH64 u64, "FEPACKIX"
+// Reading starts at the trailer, so listing an archive or extracting one
+// member only decodes the chunks that member's bytes are in.
+class ArchiveFormat {
+public:
+    static constexpr const char* magic = "FEPACK01";
+    static constexpr const char* trailerMagic = "FEPACKIX";
+    static constexpr size_t magicLength = 8;
+    static constexpr size_t trailerLength = 32;
+    static constexpr uint64_t chunkSize = 1024 * 1024;
+    enum Method : uint8_t { Stored = 0, Lz = 1 };
+    
+    static void put(string& out, uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            out.push_back(static_cast<char>(value >> (8 * i)));
+        }
+    }
+    
+    static void putString(string& out, const string& value) {
+        put(out, value.size(), 4);
+        out += value;
+    }
+    
+    // Reads fields from a byte range; `ok` turns false at the first overrun
+    struct Cursor {
+        const char* data;
+        size_t length;
+        size_t position = 0;
+        bool ok = true;
+        
+        uint64_t get(int bytes) {
+            if (!ok || length - position < static_cast<size_t>(bytes)) {
+                ok = false;
+                return 0;
+            }
+            uint64_t value = 0;
+            for (int i = 0; i < bytes; i++) {
+                value |= static_cast<uint64_t>(static_cast<unsigned char>(data[position + i])) << (8 * i);
+            }
+            position += bytes;
+            return value;
+        }
+        
+        string getString() {
+            size_t count = static_cast<size_t>(get(4));
+            if (!ok || length - position < count) {
+                ok = false;
+                return string();
+            }
+            string value(data + position, count);
+            position += count;
+            return value;
+        }
+    };
+    
+    static string encodeDirectory(const vector<ArchiveChunk>& chunks, const vector<ArchiveEntry>& entries) {
+        string out;
+        put(out, chunks.size(), 8);
+        for (const auto& chunk : chunks) {
+            put(out, chunk.offset, 8);
+            put(out, chunk.storedLength, 4);
+            put(out, chunk.rawLength, 4);
+            put(out, chunk.method, 1);
+            put(out, chunk.hash, 8);
+        }
+        put(out, entries.size(), 8);
+        for (const auto& entry : entries) {
+            put(out, static_cast<uint8_t>(entry.type), 1);
+            put(out, entry.mode, 4);
+            put(out, static_cast<uint64_t>(entry.modified), 8);
+            put(out, entry.size, 8);
+            put(out, entry.offset, 8);
+            putString(out, entry.path);
+            putString(out, entry.target);
+        }
+        return out;
+    }
+    
+    // Members may only name paths below the extraction directory
+    static bool safePath(const string& path) {
+        if (path.empty() || path[0] == '/') {
+            return false;
+        }
+        #ifdef _WIN32
+        if (path.find('\\') != string::npos || path.find(':') != string::npos) {
+            return false;
+        }
+        #endif
+        for (size_t start = 0; start <= path.size();) {
+            size_t end = path.find('/', start);
+            if (end == string::npos) end = path.size();
+            string part = path.substr(start, end - start);
+            if (part.empty() || part == "." || part == "..") return false;
+            start = end + 1;
+        }
+        return true;
+    }
+    
+    // Checks every offset and length against the archive as well, and
+    // refuses duplicate members, so a damaged or hostile archive is
+    // rejected before anything is written
+    static bool decodeDirectory(const char* data, size_t length, uint64_t dataEnd,
+                                vector<ArchiveChunk>& chunks, vector<ArchiveEntry>& entries) {
+        Cursor cursor{data, length};
+        uint64_t chunkCount = cursor.get(8);
+        if (!cursor.ok || chunkCount > length / 25) return false;
+        uint64_t streamLength = 0;
+        for (uint64_t i = 0; i < chunkCount; i++) {
+            ArchiveChunk chunk;
+            chunk.offset = cursor.get(8);
+            chunk.storedLength = static_cast<uint32_t>(cursor.get(4));
+            chunk.rawLength = static_cast<uint32_t>(cursor.get(4));
+            chunk.method = static_cast<uint8_t>(cursor.get(1));
+            chunk.hash = cursor.get(8);
+            bool lastChunk = i + 1 == chunkCount;
+            if (!cursor.ok || chunk.method > Lz || chunk.offset < magicLength || chunk.offset > dataEnd ||
+                chunk.storedLength > dataEnd - chunk.offset || chunk.rawLength == 0 || chunk.rawLength > chunkSize ||
+                (!lastChunk && chunk.rawLength != chunkSize) || (chunk.method == Stored && chunk.storedLength != chunk.rawLength)) {
+                return false;
+            }
+            streamLength += chunk.rawLength;
+            chunks.push_back(chunk);
+        }
+        
+        uint64_t entryCount = cursor.get(8);
+        if (!cursor.ok || entryCount > length / 37) return false;
+        unordered_set<string> paths;
+        for (uint64_t i = 0; i < entryCount; i++) {
+            ArchiveEntry entry;
+            uint64_t type = cursor.get(1);
+            entry.mode = static_cast<uint32_t>(cursor.get(4)) & 07777;
+            entry.modified = static_cast<int64_t>(cursor.get(8));
+            entry.size = cursor.get(8);
+            entry.offset = cursor.get(8);
+            entry.path = cursor.getString();
+            entry.target = cursor.getString();
+            if (!cursor.ok || type > static_cast<uint64_t>(ArchiveEntry::Type::Link) || !safePath(entry.path) ||
+                entry.offset > streamLength || entry.size > streamLength - entry.offset || !paths.insert(entry.path).second) {
+                return false;
+            }
+            entry.type = static_cast<ArchiveEntry::Type>(type);
+            entries.push_back(move(entry));
+        }
+        return cursor.ok && cursor.position == length;
+    }
+    
+    // Archives store Unix times; Windows file times count 100 ns from 1601
+    static int64_t toUnixTime(int64_t modified) {
+        #ifdef _WIN32
+        return (modified - 116444736000000000LL) * 100;
+        #else
+        return modified;
+        #endif
+    }
+    
+    static int64_t fromUnixTime(int64_t modified) {
+        #ifdef _WIN32
+        return modified / 100 + 116444736000000000LL;
+        #else
+        return modified;
+        #endif
+    }
+};
+
+// Packs a directory tree. A parallel walk collects the entries; then pool
+// tasks each read one chunk's worth of file contents, hash and compress
+// it, while a writer thread appends finished chunks in stream order. At
+// most `window` chunks are in flight, so memory stays bounded whatever the
+// tree size, and small files cost little more than large ones because
+// many of them share one read-and-compress task.
+class ArchiveWriter {
+private:
+    struct Slot {
+        vector<char> data;
+        ArchiveChunk chunk;
+        bool ready = false;
+    };
+    
+    fs::path root;
+    fs::path archivePath;
+    TransferProgress* progress = nullptr;
+    mutex entriesLock;
+    vector<ArchiveEntry> entries;
+    vector<size_t> contents;        // entries with data, in stream order
+    uint64_t streamLength = 0;
+    atomic<uint64_t> unreadable{0};
+    size_t window = 0;
+    vector<Slot> slots;
+    mutex slotsLock;
+    condition_variable slotChanged;
+    exception_ptr error;            // first failure of a chunk task or the writer
+    bool written = false;
+    thread writer;
+    uint64_t archiveSize = 0;
+    TaskGroup group;
+    
+    void scan(const string& relative) {
+        fs::path directory = relative.empty() ? root : root / fs::u8path(relative);
+        vector<SnapshotEntry> listing;
+        if (!DirectorySnapshot::list(directory, listing)) {
+            unreadable++;
+            return;
+        }
+        progress->directories++;
+        
+        vector<ArchiveEntry> found;
+        for (const auto& item : listing) {
+            fs::path path = directory / item.name;
+            if (item.type == 'o' || path == archivePath) continue;
+            
+            ArchiveEntry entry;
+            entry.path = relative.empty() ? fs::path(item.name).u8string() : relative + "/" + fs::path(item.name).u8string();
+            entry.modified = ArchiveFormat::toUnixTime(item.modified);
+            #ifdef _WIN32
+            entry.mode = item.type == 'd' ? 0755 : 0644;
+            #else
+            entry.mode = item.mode;
+            #endif
+            if (item.type == 'd') {
+                entry.type = ArchiveEntry::Type::Directory;
+                group.submit([this, child = entry.path] { scan(child); });
+            } else if (item.type == 'l') {
+                entry.type = ArchiveEntry::Type::Link;
+                error_code ec;
+                entry.target = fs::read_symlink(path, ec).u8string();
+            } else {
+                entry.size = item.size;
+                progress->files++;
+                progress->bytes += item.size;
+            }
+            found.push_back(move(entry));
+        }
+        
+        lock_guard<mutex> guard(entriesLock);
+        move(found.begin(), found.end(), back_inserter(entries));
+    }
+    
+    // Fills the raw bytes of chunk `index` from the files it covers
+    void readChunk(size_t index, char* raw, size_t length) {
+        uint64_t start = index * ArchiveFormat::chunkSize;
+        auto first = upper_bound(contents.begin(), contents.end(), start,
+                                 [this](uint64_t offset, size_t entry) { return offset < entries[entry].offset; });
+        if (first != contents.begin()) --first;
+        
+        for (auto it = first; it != contents.end() && entries[*it].offset < start + length; ++it) {
+            const ArchiveEntry& entry = entries[*it];
+            uint64_t from = max(start, entry.offset);
+            uint64_t to = min(start + length, entry.offset + entry.size);
+            if (from >= to) continue;
+            
+            fs::path path = root / fs::u8path(entry.path);
+            PositionedFile file;
+            if (!file.open(path, false)) fail("Cannot open file", path, errno);
+            if (!file.readAt(from - entry.offset, raw + (from - start), static_cast<size_t>(to - from))) {
+                fail("File shrank while packing", path, EIO);
+            }
+            Metrics::add(Metric::BytesRead, to - from);
+            if (to == entry.offset + entry.size) {
+                progress->files++;
+            }
+        }
+    }
+    
+    void buildChunk(size_t index, Slot& slot) {
+        uint64_t start = index * ArchiveFormat::chunkSize;
+        size_t length = static_cast<size_t>(min(ArchiveFormat::chunkSize, streamLength - start));
+        thread_local vector<char> raw;
+        raw.resize(length);
+        readChunk(index, raw.data(), length);
+        
+        slot.chunk.rawLength = static_cast<uint32_t>(length);
+        slot.chunk.hash = XxHash64::of(raw.data(), length);
+        slot.data.resize(LzCodec::bound(length));
+        size_t packed = LzCodec::compress(raw.data(), length, slot.data.data());
+        if (packed < length) {
+            slot.chunk.method = ArchiveFormat::Lz;
+            slot.data.resize(packed);
+        } else {
+            slot.chunk.method = ArchiveFormat::Stored;
+            slot.data.assign(raw.begin(), raw.end());
+        }
+        slot.chunk.storedLength = static_cast<uint32_t>(slot.data.size());
+        progress->bytes += length;
+    }
+    
+    void submitChunk(size_t index) {
+        group.submit([this, index] {
+            Slot& slot = slots[index % window];
+            exception_ptr failure;
+            try {
+                buildChunk(index, slot);
+            } catch (...) {
+                failure = current_exception();
+            }
+            lock_guard<mutex> guard(slotsLock);
+            if (failure && !error) error = failure;
+            slot.ready = !failure;
+            slotChanged.notify_all();
+        });
+    }
+    
+    void writeArchive() {
+        fs::path temporary = archivePath;
+        temporary += ".part";
+        try {
+            ofstream out(temporary, ios::binary | ios::trunc);
+            if (!out) fail("Cannot create archive", temporary, errno);
+            out.write(ArchiveFormat::magic, ArchiveFormat::magicLength);
+            uint64_t position = ArchiveFormat::magicLength;
+            
+            size_t chunkCount = static_cast<size_t>((streamLength + ArchiveFormat::chunkSize - 1) / ArchiveFormat::chunkSize);
+            vector<ArchiveChunk> chunks;
+            chunks.reserve(chunkCount);
+            size_t submitted = 0;
+            for (size_t next = 0; next < chunkCount; next++) {
+                while (submitted < chunkCount && submitted < next + window) {
+                    submitChunk(submitted++);
+                }
+                Slot& slot = slots[next % window];
+                {
+                    unique_lock<mutex> guard(slotsLock);
+                    slotChanged.wait(guard, [&] { return slot.ready || error; });
+                    if (error) break;
+                }
+                
+                slot.chunk.offset = position;
+                out.write(slot.data.data(), static_cast<streamsize>(slot.data.size()));
+                if (!out) fail("Cannot write archive", temporary, EIO);
+                position += slot.data.size();
+                Metrics::add(Metric::BytesWritten, slot.data.size());
+                chunks.push_back(slot.chunk);
+                
+                lock_guard<mutex> guard(slotsLock);
+                slot.ready = false;
+            }
+            
+            bool failed;
+            {
+                lock_guard<mutex> guard(slotsLock);
+                failed = error != nullptr;
+            }
+            if (!failed) {
+                string directory = ArchiveFormat::encodeDirectory(chunks, entries);
+                string trailer;
+                ArchiveFormat::put(trailer, position, 8);
+                ArchiveFormat::put(trailer, directory.size(), 8);
+                ArchiveFormat::put(trailer, XxHash64::of(directory.data(), directory.size()), 8);
+                trailer += ArchiveFormat::trailerMagic;
+                out << directory << trailer;
+                out.close();
+                if (!out) fail("Cannot write archive", temporary, EIO);
+                archiveSize = position + directory.size() + trailer.size();
+                syncFile(temporary);
+                fs::rename(temporary, archivePath);
+            }
+        } catch (...) {
+            lock_guard<mutex> guard(slotsLock);
+            if (!error) error = current_exception();
+        }
+        
+        lock_guard<mutex> guard(slotsLock);
+        if (error) {
+            error_code ec;
+            fs::remove(temporary, ec);
+        }
+        written = true;
+        slotChanged.notify_all();
+    }
+    
+public:
+    ArchiveWriter(WorkStealingPool& pool, const fs::path& root, const fs::path& archive)
+        : root(root), archivePath(archive), group(pool) {}
+    
+    ~ArchiveWriter() {
+        if (writer.joinable()) writer.join();
+    }
+    
+    void startScan(TransferProgress& scanProgress) {
+        progress = &scanProgress;
+        group.submit([this] { scan(string()); });
+    }
+    
+    // Entries go in path order, so every directory precedes its contents
+    void startPacking(TransferProgress& packProgress) {
+        progress = &packProgress;
+        sort(entries.begin(), entries.end(), [](const ArchiveEntry& a, const ArchiveEntry& b) { return a.path < b.path; });
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (entries[i].type == ArchiveEntry::Type::File && entries[i].size > 0) {
+                entries[i].offset = streamLength;
+                streamLength += entries[i].size;
+                contents.push_back(i);
+            }
+        }
+        progress->totalBytes = streamLength;
+        window = clamp<size_t>(thread::hardware_concurrency() * 2, 4, 64);
+        slots.resize(window);
+        writer = thread([this] { writeArchive(); });
+    }
+    
+    // Waits up to `timeout`; true once finished, rethrows the first error
+    bool waitFor(chrono::milliseconds timeout) {
+        if (writer.joinable()) {
+            unique_lock<mutex> guard(slotsLock);
+            if (!slotChanged.wait_for(guard, timeout, [this] { return written; })) {
+                return false;
+            }
+            guard.unlock();
+            writer.join();
+        }
+        if (!group.waitFor(timeout)) {
+            return false;
+        }
+        if (error) {
+            exception_ptr failure = error;
+            error = nullptr;
+            rethrow_exception(failure);
+        }
+        return true;
+    }
+    
+    const vector<ArchiveEntry>& members() const { return entries; }
+    uint64_t dataSize() const { return streamLength; }
+    uint64_t size() const { return archiveSize; }
+    uint64_t unreadableItems() const { return unreadable; }
+};
+
+// Extracts an archive. Only the trailer and the central directory are read
+// up front, so listing an archive or extracting part of it never touches
+// chunks it does not need. Pool tasks each verify and decompress one chunk
+// and write its pieces of each file at their offsets, so files fill in
+// parallel in any order; modes, times and links are applied after all data.
+class ArchiveReader {
+private:
+    static constexpr size_t metadataBatch = 256;    // entries per task when setting modes and times
+    
+    fs::path archivePath;
+    vector<ArchiveChunk> chunks;
+    vector<ArchiveEntry> entries;
+    vector<size_t> selected;        // entries to extract, in path order
+    vector<size_t> contents;        // selected entries with data, in stream order
+    fs::path destination;
+    TransferProgress* progress = nullptr;
+    TaskGroup group;
+    
+    fs::path target(const ArchiveEntry& entry) const {
+        return destination / fs::u8path(entry.path);
+    }
+    
+    void extractChunk(size_t index) {
+        const ArchiveChunk& chunk = chunks[index];
+        thread_local vector<char> stored;
+        thread_local vector<char> raw;
+        stored.resize(chunk.storedLength);
+        PositionedFile archive;
+        if (!archive.open(archivePath, false) || !archive.readAt(chunk.offset, stored.data(), stored.size())) {
+            fail("Cannot read archive", archivePath, EIO);
+        }
+        Metrics::add(Metric::BytesRead, stored.size());
+        
+        const char* data = stored.data();
+        if (chunk.method == ArchiveFormat::Lz) {
+            raw.resize(chunk.rawLength);
+            if (!LzCodec::decompress(stored.data(), stored.size(), raw.data(), raw.size())) {
+                fail("Archive is damaged", archivePath, EIO);
+            }
+            data = raw.data();
+        }
+        if (XxHash64::of(data, chunk.rawLength) != chunk.hash) {
+            fail("Archive is damaged", archivePath, EIO);
+        }
+        
+        uint64_t start = index * ArchiveFormat::chunkSize;
+        uint64_t end = start + chunk.rawLength;
+        auto first = upper_bound(contents.begin(), contents.end(), start,
+                                 [this](uint64_t offset, size_t entry) { return offset < entries[entry].offset; });
+        if (first != contents.begin()) --first;
+        for (auto it = first; it != contents.end() && entries[*it].offset < end; ++it) {
+            const ArchiveEntry& entry = entries[*it];
+            uint64_t from = max(start, entry.offset);
+            uint64_t to = min(end, entry.offset + entry.size);
+            if (from >= to) continue;
+            
+            fs::path path = target(entry);
+            PositionedFile file;
+            if (!file.open(path, true)) fail("Cannot create file", path, errno);
+            file.writeAt(from - entry.offset, data + (from - start), static_cast<size_t>(to - from));
+            // Whichever chunk holds the first byte also fixes the length
+            if (from == entry.offset) file.resize(entry.size);
+            progress->bytes += to - from;
+            Metrics::add(Metric::BytesWritten, to - from);
+            if (to == entry.offset + entry.size) {
+                progress->files++;
+            }
+        }
+    }
+    
+public:
+    explicit ArchiveReader(WorkStealingPool& pool) : group(pool) {}
+    
+    // Returns false with `error` set when the file is not a usable archive
+    bool open(const fs::path& path, string& error) {
+        archivePath = path;
+        PositionedFile file;
+        error_code ec;
+        uint64_t fileSize = fs::file_size(path, ec);
+        char head[ArchiveFormat::magicLength];
+        char trailer[ArchiveFormat::trailerLength];
+        if (ec || !file.open(path, false)) {
+            error = "Could not open archive '" + path.string() + "'";
+            return false;
+        }
+        if (fileSize < ArchiveFormat::magicLength + ArchiveFormat::trailerLength ||
+            !file.readAt(0, head, sizeof(head)) || memcmp(head, ArchiveFormat::magic, sizeof(head)) != 0 ||
+            !file.readAt(fileSize - sizeof(trailer), trailer, sizeof(trailer)) ||
+            memcmp(trailer + 24, ArchiveFormat::trailerMagic, ArchiveFormat::magicLength) != 0) {
+            error = "'" + path.string() + "' is not an archive";
+            return false;
+        }
+        
+        ArchiveFormat::Cursor cursor{trailer, sizeof(trailer)};
+        uint64_t directoryOffset = cursor.get(8);
+        uint64_t directoryLength = cursor.get(8);
+        uint64_t directoryHash = cursor.get(8);
+        uint64_t dataEnd = fileSize - sizeof(trailer);
+        string directory;
+        if (directoryOffset < ArchiveFormat::magicLength || directoryOffset > dataEnd || directoryLength != dataEnd - directoryOffset) {
+            error = "Archive is damaged";
+            return false;
+        }
+        directory.resize(static_cast<size_t>(directoryLength));
+        if (!file.readAt(directoryOffset, &directory[0], directory.size()) ||
+            XxHash64::of(directory.data(), directory.size()) != directoryHash ||
+            !ArchiveFormat::decodeDirectory(directory.data(), directory.size(), directoryOffset, chunks, entries)) {
+            error = "Archive is damaged";
+            return false;
+        }
+        return true;
+    }
+    
+    const vector<ArchiveEntry>& members() const { return entries; }
+    const vector<ArchiveChunk>& chunkTable() const { return chunks; }
+    
+    // Limits extraction to the member `prefix` and everything under it (all
+    // members when empty); returns how many members that is
+    size_t select(const string& prefix) {
+        selected.clear();
+        for (size_t i = 0; i < entries.size(); i++) {
+            const string& path = entries[i].path;
+            if (prefix.empty() || path == prefix ||
+                (path.size() > prefix.size() && path.compare(0, prefix.size(), prefix) == 0 && path[prefix.size()] == '/')) {
+                selected.push_back(i);
+            }
+        }
+        return selected.size();
+    }
+    
+    // Makes the directories and empty files, then queues only the chunks
+    // that hold data of selected files
+    void start(const fs::path& into, TransferProgress& extractProgress) {
+        destination = into;
+        progress = &extractProgress;
+        contents.clear();
+        for (size_t index : selected) {
+            const ArchiveEntry& entry = entries[index];
+            fs::path path = target(entry);
+            if (entry.type == ArchiveEntry::Type::Directory) {
+                #ifdef _WIN32
+                fs::create_directories(path);
+                #else
+                if (mkdir(path.c_str(), 0700) != 0 && (errno != EEXIST || !fs::is_directory(fs::symlink_status(path)))) {
+                    fail("Cannot create directory", path, errno);
+                }
+                #endif
+                progress->directories++;
+            } else if (entry.type == ArchiveEntry::Type::File && entry.size == 0) {
+                PositionedFile file;
+                if (!file.open(path, true)) fail("Cannot create file", path, errno);
+                file.resize(0);
+                progress->files++;
+            } else if (entry.type == ArchiveEntry::Type::File) {
+                contents.push_back(index);
+                progress->totalBytes += entry.size;
+            }
+        }
+        
+        vector<bool> needed(chunks.size(), false);
+        for (size_t index : contents) {
+            const ArchiveEntry& entry = entries[index];
+            size_t last = static_cast<size_t>((entry.offset + entry.size - 1) / ArchiveFormat::chunkSize);
+            for (size_t chunk = static_cast<size_t>(entry.offset / ArchiveFormat::chunkSize); chunk <= last; chunk++) {
+                needed[chunk] = true;
+            }
+        }
+        for (size_t chunk = 0; chunk < chunks.size(); chunk++) {
+            if (needed[chunk]) group.submit([this, chunk] { extractChunk(chunk); });
+        }
+    }
+    
+    void startMetadata() {
+        vector<size_t> batch;
+        auto flush = [this, &batch] {
+            group.submit([this, batch] {
+                for (size_t index : batch) {
+                    applyModeAndTime(target(entries[index]), entries[index].mode, ArchiveFormat::fromUnixTime(entries[index].modified), false);
+                }
+            });
+            batch.clear();
+        };
+        for (size_t index : selected) {
+            if (entries[index].type != ArchiveEntry::Type::File) continue;
+            batch.push_back(index);
+            if (batch.size() == metadataBatch) flush();
+        }
+        if (!batch.empty()) flush();
+    }
+    
+    // Links are made only now, after every file was written through real
+    // directories, and never replace an existing entry; directories get
+    // their modes last, deepest first
+    void finishLinksAndDirectories() {
+        for (size_t index : selected) {
+            const ArchiveEntry& entry = entries[index];
+            if (entry.type != ArchiveEntry::Type::Link) continue;
+            fs::path path = target(entry);
+            error_code ec;
+            if (fs::exists(fs::symlink_status(path, ec))) fail("Cannot create link", path, EEXIST);
+            fs::create_symlink(fs::u8path(entry.target), path);
+            progress->files++;
+        }
+        for (auto it = selected.rbegin(); it != selected.rend(); ++it) {
+            const ArchiveEntry& entry = entries[*it];
+            if (entry.type == ArchiveEntry::Type::Directory) {
+                applyModeAndTime(target(entry), entry.mode, ArchiveFormat::fromUnixTime(entry.modified), true);
+            }
+        }
+    }
+    
+    bool waitFor(chrono::milliseconds timeout) {
+        return group.waitFor(timeout);
+    }
+};
+
+// Persistent metadata index of one directory tree, stored as a columnar
+// file that is mapped read-only at startup instead of being parsed or
+// rescanned. Entries are in depth-first order, so a directory's subtree is
+// the contiguous range [i, end(i)); each directory also carries the total
+// size and file count of its subtree. Names are NUL-terminated in one blob.
+class MetadataIndex {
+public:
+    enum Type : uint8_t { File = 0, Directory = 1, Symlink = 2, Other = 3 };
+    
+    struct Header {
+        char magic[8];
+        uint64_t version;
+        uint64_t count;
+        uint64_t nameBytes;
+        int64_t builtAt;
+        uint64_t rootLength;
+        uint64_t parentColumn;      // uint32 per entry, root has noParent
+        uint64_t endColumn;         // uint32, one past the subtree
+        uint64_t nameColumn;        // uint32 offset into the name blob
+        uint64_t sizeColumn;        // uint64 apparent size
+        uint64_t totalColumn;       // uint64 subtree size (directories)
+        uint64_t filesColumn;       // uint64 subtree file count (directories)
+        uint64_t mtimeColumn;       // int64 seconds
+        uint64_t typeColumn;        // uint8
+        uint64_t nameBlob;
+        uint64_t rootString;
+        uint64_t fileBytes;
+    };
+    static constexpr char magicValue[8] = {'F', 'E', 'I', 'N', 'D', 'E', 'X', '1'};
+    static constexpr uint64_t formatVersion = 2;
+    static constexpr uint32_t noParent = UINT32_MAX;
+    
+private:
+    unique_ptr<MappedFile> file;
+    const char* base = nullptr;
+    const Header* header = nullptr;
+    
+    template <typename T>
+    const T* column(uint64_t offset) const {
+        return reinterpret_cast<const T*>(base + offset);
+    }
+    
+    // `count` items of `width` bytes at `offset` lie after the header and inside the file
+    static bool fits(const Header& candidate, uint64_t offset, uint64_t count, uint64_t width) {
+        return offset >= sizeof(Header) && offset % width == 0 && offset <= candidate.fileBytes &&
+               count <= (candidate.fileBytes - offset) / width;
+    }
+    
+    // Every accessor indexes these columns unchecked, so a damaged or
+    // hostile file is rejected here: columns in range, names terminated,
+    // parents before children and subtrees inside their parent's
+    static bool valid(const Header& candidate, const char* data) {
+        uint64_t count = candidate.count;
+        if (!fits(candidate, candidate.parentColumn, count, 4) || !fits(candidate, candidate.endColumn, count, 4) ||
+            !fits(candidate, candidate.nameColumn, count, 4) || !fits(candidate, candidate.sizeColumn, count, 8) ||
+            !fits(candidate, candidate.totalColumn, count, 8) || !fits(candidate, candidate.filesColumn, count, 8) ||
+            !fits(candidate, candidate.mtimeColumn, count, 8) || !fits(candidate, candidate.typeColumn, count, 1) ||
+            !fits(candidate, candidate.nameBlob, candidate.nameBytes, 1) ||
+            !fits(candidate, candidate.rootString, candidate.rootLength, 1)) {
+            return false;
+        }
+        if (candidate.nameBytes == 0 || data[candidate.nameBlob + candidate.nameBytes - 1] != '\0') return false;
+        
+        const uint32_t* parents = reinterpret_cast<const uint32_t*>(data + candidate.parentColumn);
+        const uint32_t* ends = reinterpret_cast<const uint32_t*>(data + candidate.endColumn);
+        const uint32_t* names = reinterpret_cast<const uint32_t*>(data + candidate.nameColumn);
+        const uint8_t* types = reinterpret_cast<const uint8_t*>(data + candidate.typeColumn);
+        if (parents[0] != noParent || ends[0] != count) return false;
+        for (uint64_t i = 0; i < count; i++) {
+            if (names[i] >= candidate.nameBytes || types[i] > Other || ends[i] <= i) return false;
+            if (i > 0 && (parents[i] >= i || ends[i] > ends[parents[i]])) return false;
+        }
+        return true;
+    }
+    
+public:
+    // Maps an index file; a missing or malformed file leaves the index unloaded
+    bool load(const fs::path& path) {
+        unload();
+        unique_ptr<MappedFile> mapped(new MappedFile());
+        if (!mapped->open(path) || mapped->size() < sizeof(Header)) return false;
+        size_t available = 0;
+        const char* data = mapped->view(0, static_cast<size_t>(mapped->size()), available);
+        if (!data || available != mapped->size()) return false;
+        
+        const Header* candidate = reinterpret_cast<const Header*>(data);
+        if (memcmp(candidate->magic, magicValue, sizeof(magicValue)) != 0 || candidate->version != formatVersion ||
+            candidate->fileBytes != mapped->size() || candidate->count == 0 || candidate->count >= noParent ||
+            !valid(*candidate, data)) {
+            return false;
+        }
+        file = move(mapped);
+        base = data;
+        header = candidate;
+        return true;
+    }
+    
+    void unload() {
+        header = nullptr;
+        base = nullptr;
+        file.reset();
+    }
+    
+    bool loaded() const { return header != nullptr; }
+    uint64_t count() const { return header ? header->count : 0; }
+    uint64_t fileBytes() const { return header->fileBytes; }
+    time_t builtAt() const { return static_cast<time_t>(header->builtAt); }
+    fs::path root() const { return fs::path(string(base + header->rootString, header->rootLength)); }
+    
+    uint32_t parent(uint32_t i) const { return column<uint32_t>(header->parentColumn)[i]; }
+    uint32_t end(uint32_t i) const { return column<uint32_t>(header->endColumn)[i]; }
+    const char* name(uint32_t i) const { return base + header->nameBlob + column<uint32_t>(header->nameColumn)[i]; }
+    uint64_t size(uint32_t i) const { return column<uint64_t>(header->sizeColumn)[i]; }
+    uint64_t total(uint32_t i) const { return column<uint64_t>(header->totalColumn)[i]; }
+    uint64_t files(uint32_t i) const { return column<uint64_t>(header->filesColumn)[i]; }
+    int64_t modified(uint32_t i) const { return column<int64_t>(header->mtimeColumn)[i]; }
+    Type type(uint32_t i) const { return static_cast<Type>(column<uint8_t>(header->typeColumn)[i]); }
+    
+    // Calls visit(child) for each direct child of directory `i`
+    template <typename Visitor>
+    void forEachChild(uint32_t i, Visitor&& visit) const {
+        for (uint32_t child = i + 1; child < end(i); child = end(child)) {
+            visit(child);
+        }
+    }
+    
+    fs::path pathOf(uint32_t i) const {
+        vector<uint32_t> chain;
+        for (; i != 0; i = parent(i)) chain.push_back(i);
+        fs::path path = root();
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) path /= name(*it);
+        return path;
+    }
+    
+    // Entry of `path` (absolute, inside the root), or -1
+    int64_t locate(const fs::path& path) const {
+        fs::path relative = path.lexically_normal().lexically_relative(root());
+        if (relative.empty() || *relative.begin() == "..") return -1;
+        
+        uint32_t current = 0;
+        for (const auto& part : relative) {
+            if (part == ".") continue;
+            string wanted = part.string();
+            int64_t found = -1;
+            forEachChild(current, [&](uint32_t child) {
+                if (found < 0 && wanted == name(child)) found = child;
+            });
+            if (found < 0) return -1;
+            current = static_cast<uint32_t>(found);
+        }
+        return current;
+    }
+};
+
+constexpr char MetadataIndex::magicValue[8];
+
+// Walks a tree into a MetadataIndex file. Given the previous index of the
+// same root, a directory whose mtime is unchanged keeps its old listing,
+// so an update costs one stat per entry and no readdir, plus a rescan of
+// the directories that gained, lost or renamed entries. The stat is still
+// needed for files: rewriting one leaves its directory's mtime alone.
+class IndexBuilder {
+private:
+    struct Node {
+        string name;
+        MetadataIndex::Type type = MetadataIndex::File;
+        uint64_t size = 0;
+        int64_t modified = 0;
+        int64_t previous = -1;      // same directory in the old index
+        vector<Node> children;
+    };
+    
+    const MetadataIndex* previous;
+    TransferProgress& progress;
+    Node root;
+    fs::path rootPath;
+    atomic<uint64_t> rescannedDirectories{0};
+    atomic<uint64_t> unreadable{0};
+    TaskGroup group;
+    
+    static bool statNoFollow(const fs::path& path, Node& node) {
+        #ifdef _WIN32
+        error_code ec;
+        fs::file_status status = fs::symlink_status(path, ec);
+        if (ec) return false;
+        node.type = fs::is_symlink(status) ? MetadataIndex::Symlink : fs::is_directory(status) ? MetadataIndex::Directory :
+                    fs::is_regular_file(status) ? MetadataIndex::File : MetadataIndex::Other;
+        node.size = node.type == MetadataIndex::File ? fs::file_size(path, ec) : 0;
+        auto stamp = fs::last_write_time(path, ec);
+        node.modified = chrono::duration_cast<chrono::seconds>(stamp.time_since_epoch()).count();
+        return true;
+        #else
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0) return false;
+        fromStat(node, st);
+        return true;
+        #endif
+    }
+    
+    #ifndef _WIN32
+    static void fromStat(Node& node, const struct stat& st) {
+        node.type = S_ISDIR(st.st_mode) ? MetadataIndex::Directory : S_ISLNK(st.st_mode) ? MetadataIndex::Symlink :
+                    S_ISREG(st.st_mode) ? MetadataIndex::File : MetadataIndex::Other;
+        node.size = S_ISDIR(st.st_mode) ? 0 : static_cast<uint64_t>(st.st_size);
+        node.modified = st.st_mtime;
+    }
+    #endif
+    
+    // Unchanged directory: its names are the ones indexed last time, the
+    // files among them are statted again; false when it cannot be opened
+    bool reuseListing(Node& node, const fs::path& path) {
+        #ifndef _WIN32
+        int dirfd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+        if (dirfd < 0) return false;
+        #endif
+        previous->forEachChild(static_cast<uint32_t>(node.previous), [&](uint32_t old) {
+            Node child;
+            child.name = previous->name(old);
+            child.type = previous->type(old);
+            if (child.type == MetadataIndex::Directory) {
+                // Statted by visit() before it decides whether to reuse it too
+                child.modified = previous->modified(old);
+                child.previous = old;
+                node.children.push_back(move(child));
+                return;
+            }
+            #ifdef _WIN32
+            if (!statNoFollow(path / child.name, child)) return;
+            #else
+            struct stat st;
+            Metrics::add(Metric::StatCalls);
+            if (fstatat(dirfd, child.name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+            fromStat(child, st);
+            #endif
+            node.children.push_back(move(child));
+        });
+        #ifndef _WIN32
+        close(dirfd);
+        #endif
+        return true;
+    }
+    
+    void readListing(Node& node, const fs::path& path) {
+        rescannedDirectories++;
+        #ifdef _WIN32
+        error_code ec;
+        for (fs::directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+            Node child;
+            child.name = it->path().filename().string();
+            if (statNoFollow(it->path(), child)) node.children.push_back(move(child));
+        }
+        if (ec) unreadable++;
+        #else
+        int dirfd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+        if (dirfd < 0) {
+            unreadable++;
+            return;
+        }
+        try {
+            DirectoryReader::scan(dirfd, path, [&](const char* name, unsigned char) {
+                struct stat st;
+                Metrics::add(Metric::StatCalls);
+                if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+                Node child;
+                child.name = name;
+                fromStat(child, st);
+                node.children.push_back(move(child));
+            });
+        } catch (const fs::filesystem_error&) {
+            unreadable++;
+        }
+        close(dirfd);
+        #endif
+        
+        // Subdirectories that were indexed before can still reuse their listings
+        if (previous && node.previous >= 0) {
+            unordered_map<string, uint32_t> oldChildren;
+            previous->forEachChild(static_cast<uint32_t>(node.previous), [&](uint32_t child) {
+                if (previous->type(child) == MetadataIndex::Directory) oldChildren.emplace(previous->name(child), child);
+            });
+            for (auto& child : node.children) {
+                auto found = oldChildren.find(child.name);
+                if (child.type == MetadataIndex::Directory && found != oldChildren.end()) child.previous = found->second;
+            }
+        }
+    }
+    
+    void visit(Node* node, fs::path path) {
+        bool unchanged = previous && node->previous >= 0 && previous->modified(static_cast<uint32_t>(node->previous)) == node->modified;
+        if (!unchanged || !reuseListing(*node, path)) {
+            readListing(*node, path);
+        }
+        
+        progress.directories++;
+        for (auto& child : node->children) {
+            progress.files++;
+            if (child.type != MetadataIndex::Directory) continue;
+            
+            Node* childNode = &child;
+            fs::path childPath = path / child.name;
+            group.submit([this, childNode, childPath] {
+                // A reused entry only knows the old mtime; compare against the real one
+                if (childNode->previous >= 0 && (!statNoFollow(childPath, *childNode) || childNode->type != MetadataIndex::Directory)) {
+                    childNode->previous = -1;
+                    if (childNode->type != MetadataIndex::Directory) return;
+                }
+                visit(childNode, childPath);
+            });
+        }
+    }
+    
+    struct Columns {
+        vector<uint32_t> parent, end, nameOffset;
+        vector<uint64_t> size, total, files;
+        vector<int64_t> modified;
+        vector<uint8_t> type;
+        string names;
+    };
+    
+    void flatten(const Node& node, uint32_t parent, Columns& columns) const {
+        uint32_t index = static_cast<uint32_t>(columns.parent.size());
+        if (columns.names.size() > UINT32_MAX - node.name.size() - 1) {
+            throw fs::filesystem_error("Index name table is full", rootPath, make_error_code(errc::file_too_large));
+        }
+        columns.parent.push_back(parent);
+        columns.end.push_back(0);
+        columns.nameOffset.push_back(static_cast<uint32_t>(columns.names.size()));
+        columns.names.append(node.name.c_str(), node.name.size() + 1);
+        columns.size.push_back(node.size);
+        columns.total.push_back(node.size);
+        columns.files.push_back(node.type == MetadataIndex::Directory ? 0 : 1);
+        columns.modified.push_back(node.modified);
+        columns.type.push_back(node.type);
+        
+        for (const auto& child : node.children) {
+            uint32_t childIndex = static_cast<uint32_t>(columns.parent.size());
+            flatten(child, index, columns);
+            columns.total[index] += columns.total[childIndex];
+            columns.files[index] += columns.files[childIndex];
+        }
+        columns.end[index] = static_cast<uint32_t>(columns.parent.size());
+    }
+    
+    template <typename T>
+    static void writeColumn(ofstream& out, uint64_t& offset, const vector<T>& values) {
+        out.write(reinterpret_cast<const char*>(values.data()), static_cast<streamsize>(values.size() * sizeof(T)));
+        offset += values.size() * sizeof(T);
+        while (offset % 8 != 0) {
+            out.put('\0');
+            offset++;
+        }
+    }
+    
+public:
+    IndexBuilder(WorkStealingPool& pool, TransferProgress& progress, const MetadataIndex* previous)
+        : previous(previous), progress(progress), group(pool) {}
+    
+    void start(const fs::path& directory) {
+        rootPath = directory;
+        root.type = MetadataIndex::Directory;
+        statNoFollow(directory, root);
+        root.type = MetadataIndex::Directory;
+        if (previous && previous->loaded() && previous->root() == directory) root.previous = 0;
+        else previous = nullptr;
+        group.submit([this] { visit(&root, rootPath); });
+    }
+    
+    bool waitFor(chrono::milliseconds timeout) {
+        return group.waitFor(timeout);
+    }
+    
+    uint64_t rescanned() const { return rescannedDirectories; }
+    uint64_t unreadableDirectories() const { return unreadable; }
+    
+    // Writes the finished tree to `path` through a temporary file
+    void write(const fs::path& path) const {
+        Columns columns;
+        flatten(root, MetadataIndex::noParent, columns);
+        if (columns.parent.size() >= MetadataIndex::noParent) {
+            throw fs::filesystem_error("Too many entries for the index", rootPath, make_error_code(errc::file_too_large));
+        }
+        
+        uint64_t count = columns.parent.size();
+        string rootString = rootPath.string();
+        auto padded = [](uint64_t bytes) { return (bytes + 7) / 8 * 8; };
+        MetadataIndex::Header header{};
+        memcpy(header.magic, MetadataIndex::magicValue, sizeof(header.magic));
+        header.version = MetadataIndex::formatVersion;
+        header.count = count;
+        header.nameBytes = columns.names.size();
+        header.builtAt = static_cast<int64_t>(time(nullptr));
+        header.rootLength = rootString.size();
+        header.parentColumn = padded(sizeof(header));
+        header.endColumn = header.parentColumn + padded(count * 4);
+        header.nameColumn = header.endColumn + padded(count * 4);
+        header.sizeColumn = header.nameColumn + padded(count * 4);
+        header.totalColumn = header.sizeColumn + count * 8;
+        header.filesColumn = header.totalColumn + count * 8;
+        header.mtimeColumn = header.filesColumn + count * 8;
+        header.typeColumn = header.mtimeColumn + count * 8;
+        header.nameBlob = header.typeColumn + padded(count);
+        header.rootString = header.nameBlob + padded(columns.names.size());
+        header.fileBytes = header.rootString + rootString.size();
+        
+        fs::path temporary = path;
+        temporary += ".tmp";
+        {
+            ofstream out(temporary, ios::binary | ios::trunc);
+            uint64_t offset = 0;
+            writeColumn(out, offset, vector<char>(reinterpret_cast<const char*>(&header), reinterpret_cast<const char*>(&header + 1)));
+            writeColumn(out, offset, columns.parent);
+            writeColumn(out, offset, columns.end);
+            writeColumn(out, offset, columns.nameOffset);
+            writeColumn(out, offset, columns.size);
+            writeColumn(out, offset, columns.total);
+            writeColumn(out, offset, columns.files);
+            writeColumn(out, offset, columns.modified);
+            writeColumn(out, offset, columns.type);
+            writeColumn(out, offset, vector<char>(columns.names.begin(), columns.names.end()));
+            out.write(rootString.data(), static_cast<streamsize>(rootString.size()));
+            if (!out.flush()) {
+                throw fs::filesystem_error("Cannot write index", temporary, make_error_code(errc::io_error));
+            }
+        }
+        syncFile(temporary);
+        fs::rename(temporary, path);
+    }
+};
+
+// Resolves `cd` targets one component at a time from an already open
+// directory, so each uncached component costs one openat (on Windows one
+// FindFirstFile, which also yields the on-disk casing). Resolved
+// directories stay in an LRU cache together with their open descriptor
+// and identity; a fully cached path costs a single stat that confirms the
+// target is still the directory that was cached.
+class PathResolver {
+private:
+    static constexpr size_t capacity = 64;
+    
+    struct Dentry {
+        string key;
+        fs::path path;              // on-disk spelling
+        #ifndef _WIN32
+        int fd;
+        dev_t device;
+        ino_t inode;
+        #endif
+    };
+    
+    list<Dentry> lru;               // most recently used first
+    unordered_map<string, list<Dentry>::iterator> byKey;
+    
+    static string keyFor(const fs::path& path) {
+        string key = path.lexically_normal().string();
+        #ifdef _WIN32
+        transform(key.begin(), key.end(), key.begin(), ::tolower);
+        #endif
+        return key;
+    }
+    
+    Dentry* find(const string& key) {
+        auto found = byKey.find(key);
+        if (found == byKey.end()) return nullptr;
+        lru.splice(lru.begin(), lru, found->second);
+        return &*found->second;
+    }
+    
+    Dentry* insert(Dentry dentry) {
+        if (lru.size() >= capacity) {
+            #ifndef _WIN32
+            close(lru.back().fd);
+            #endif
+            byKey.erase(lru.back().key);
+            lru.pop_back();
+        }
+        lru.push_front(move(dentry));
+        byKey[lru.front().key] = lru.begin();
+        return &lru.front();
+    }
+    
+    // Looks up `name` inside `parent`; nullptr when it is not a directory
+    Dentry* lookup(const Dentry* parent, const fs::path& parentPath, const string& name) {
+        fs::path path = parentPath / name;
+        #ifdef _WIN32
+        if (name.empty()) {
+            // Drive roots have no directory entry of their own
+            DWORD attributes = GetFileAttributesW(path.c_str());
+            if (attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY)) return nullptr;
+            return insert(Dentry{keyFor(path), path});
+        }
+        WIN32_FIND_DATAW data;
+        HANDLE handle = FindFirstFileExW(path.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, 0);
+        if (handle == INVALID_HANDLE_VALUE) return nullptr;
+        FindClose(handle);
+        if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) return nullptr;
+        return insert(Dentry{keyFor(path), parentPath / data.cFileName});
+        #else
+        #ifdef O_PATH
+        int flags = O_PATH | O_DIRECTORY | O_CLOEXEC;
+        #else
+        int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+        #endif
+        int fd = parent ? openat(parent->fd, name.c_str(), flags) : open(path.c_str(), flags);
+        struct stat st;
+        if (fd < 0) return nullptr;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return nullptr;
+        }
+        return insert(Dentry{keyFor(path), path, fd, st.st_dev, st.st_ino});
+        #endif
+    }
+    
+    bool stillValid(const Dentry& dentry) const {
+        #ifdef _WIN32
+        DWORD attributes = GetFileAttributesW(dentry.path.c_str());
+        return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+        #else
+        struct stat st;
+        Metrics::add(Metric::StatCalls);
+        return stat(dentry.path.c_str(), &st) == 0 && S_ISDIR(st.st_mode) &&
+               st.st_dev == dentry.device && st.st_ino == dentry.inode;
+        #endif
+    }
+    
+    bool walk(const fs::path& base, const vector<string>& names, fs::path& result, bool& usedCache) {
+        Dentry* current = find(keyFor(base));
+        usedCache = current != nullptr;
+        if (!current) {
+            current = lookup(nullptr, base.parent_path(), base.filename().string());
+            if (!current && base == base.root_path()) current = lookup(nullptr, base, "");
+            if (!current) return false;
+        }
+        
+        for (const auto& name : names) {
+            fs::path path = current->path / name;
+            Dentry* next = find(keyFor(path));
+            if (next) {
+                usedCache = true;
+            } else {
+                next = lookup(current, current->path, name);
+                if (!next) return false;
+            }
+            current = next;
+        }
+        
+        result = current->path;
+        return !usedCache || stillValid(*current);
+    }
+    
+public:
+    PathResolver() = default;
+    PathResolver(const PathResolver&) = delete;
+    PathResolver& operator=(const PathResolver&) = delete;
+    
+    ~PathResolver() {
+        clear();
+    }
+    
+    void clear() {
+        #ifndef _WIN32
+        for (auto& dentry : lru) close(dentry.fd);
+        #endif
+        lru.clear();
+        byKey.clear();
+    }
+    
+    // Resolves base/names[0]/names[1]/... to an existing directory
+    bool resolve(const fs::path& base, const vector<string>& names, fs::path& result) {
+        bool usedCache = false;
+        if (walk(base, names, result, usedCache)) return true;
+        if (!usedCache) return false;
+        
+        // Something cached went stale: forget everything and look again
+        clear();
+        return walk(base, names, result, usedCache);
+    }
+};
+
+enum class SortMode { Name, Size, Time, Extension, Natural };
+
+struct SortOptions {
+    SortMode mode = SortMode::Name;
+    bool reverse = false;
+};
+
+// Sorts listings on keys built once per entry: a numeric primary key (size
+// or mtime) plus a byte string in one shared arena, compared with memcmp.
+// Natural order encodes each digit run as its length followed by its
+// digits, so "file2" sorts before "file10" without parsing during the
+// sort. Large listings are sorted in parallel slices and merged.
+class EntrySorter {
+private:
+    static constexpr size_t parallelThreshold = 16 * 1024;
+    
+    struct Key {
+        uint64_t primary;
+        uint32_t offset;
+        uint32_t length;
+        uint32_t index;
+    };
+    
+    string arena;
+    vector<Key> keys;
+    vector<uint32_t> order;
+    bool reverse = false;
+    
+    static void appendNatural(string& out, const char* name, size_t length) {
+        for (size_t i = 0; i < length;) {
+            if (!isdigit(static_cast<unsigned char>(name[i]))) {
+                out += name[i++];
+                continue;
+            }
+            size_t start = i;
+            while (start < length - 1 && name[start] == '0' && isdigit(static_cast<unsigned char>(name[start + 1]))) start++;
+            size_t end = start;
+            while (end < length && isdigit(static_cast<unsigned char>(name[end]))) end++;
+            // '0' keeps digit runs ahead of letters; the length byte orders numbers by magnitude
+            out += '0';
+            out += static_cast<char>(min<size_t>(end - start, 255));
+            out.append(name + start, end - start);
+            i = end;
+        }
+    }
+    
+    bool less(const Key& a, const Key& b) const {
+        int order = compareKeys(a.primary, arena.data() + a.offset, a.length,
+                                b.primary, arena.data() + b.offset, b.length, reverse);
+        return order != 0 ? order < 0 : a.index < b.index;
+    }
+    
+    void buildKeys(const EntryTable& entries, SortMode mode) {
+        arena.clear();
+        keys.clear();
+        keys.reserve(entries.size());
+        for (size_t i = 0; i < entries.size(); i++) {
+            Key key{0, static_cast<uint32_t>(arena.size()), 0, static_cast<uint32_t>(i)};
+            key.primary = appendKey(entries.name(i), entries.nameLength(i), entries.fileSize(i), entries.modified(i), mode, arena);
+            key.length = static_cast<uint32_t>(arena.size() - key.offset);
+            keys.push_back(key);
+        }
+    }
+    
+public:
+    // Appends the byte key of `entry` to `out` and returns its numeric key
+    static uint64_t appendKey(const char* name, size_t length, uint64_t size, time_t modified, SortMode mode, string& out) {
+        switch (mode) {
+            case SortMode::Size:
+                out.append(name, length);
+                return size;
+            case SortMode::Time:
+                out.append(name, length);
+                return static_cast<uint64_t>(static_cast<int64_t>(modified) + INT64_MAX / 2);
+            case SortMode::Extension: {
+                size_t dot = length;
+                while (dot > 0 && name[dot - 1] != '.') dot--;
+                if (dot > 1) out.append(name + dot, length - dot);
+                out += '\0';
+                out.append(name, length);
+                return 0;
+            }
+            case SortMode::Natural:
+                appendNatural(out, name, length);
+                out += '\0';
+                out.append(name, length);   // "file02" and "file2" still get a fixed order
+                return 0;
+            default:
+                out.append(name, length);
+                return 0;
+        }
+    }
+    
+    // Negative when key a sorts first; numeric keys sort descending, bytes ascending
+    static int compareKeys(uint64_t primaryA, const char* a, size_t lengthA,
+                           uint64_t primaryB, const char* b, size_t lengthB, bool reverse) {
+        int order = primaryA > primaryB ? -1 : primaryA < primaryB ? 1 : 0;
+        if (order == 0) order = memcmp(a, b, min(lengthA, lengthB));
+        if (order == 0) order = lengthA < lengthB ? -1 : lengthA > lengthB ? 1 : 0;
+        return reverse ? -order : order;
+    }
+    
+    void sort(EntryTable& entries, const SortOptions& options) {
+        if (entries.size() < 2) return;
+        reverse = options.reverse;
+        buildKeys(entries, options.mode);
+        auto compare = [this](const Key& a, const Key& b) { return less(a, b); };
+        
+        WorkStealingPool& pool = WorkStealingPool::shared();
+        if (keys.size() < parallelThreshold || pool.isWorkerThread()) {
+            std::sort(keys.begin(), keys.end(), compare);
+        } else {
+            // Sort slices on the pool, then merge neighbours pairwise
+            size_t slices = min(pool.size(), keys.size() / (parallelThreshold / 4));
+            vector<size_t> bounds;
+            for (size_t i = 0; i <= slices; i++) bounds.push_back(keys.size() * i / slices);
+            
+            TaskGroup sorting(pool);
+            for (size_t i = 0; i < slices; i++) {
+                sorting.submit([&, i] { std::sort(keys.begin() + bounds[i], keys.begin() + bounds[i + 1], compare); });
+            }
+            sorting.wait();
+            
+            for (size_t width = 1; width < slices; width *= 2) {
+                TaskGroup merging(pool);
+                for (size_t i = 0; i + width < slices; i += 2 * width) {
+                    size_t first = bounds[i], middle = bounds[i + width], last = bounds[min(i + 2 * width, slices)];
+                    merging.submit([&, first, middle, last] {
+                        inplace_merge(keys.begin() + first, keys.begin() + middle, keys.begin() + last, compare);
+                    });
+                }
+                merging.wait();
+            }
+        }
+        
+        order.clear();
+        for (const auto& key : keys) order.push_back(key.index);
+        entries.reorder(order);
+    }
+};
+
+// Keeps the first `limit` entries of a listing in sort order while it is
+// being read, in a bounded heap with the worst kept entry on top; memory
+// stays proportional to the limit no matter how large the directory is.
+class TopEntries {
+private:
+    struct Item {
+        uint64_t primary;
+        string key;
+        EntryInfo entry;
+    };
+    
+    size_t limit;
+    SortOptions order;
+    vector<Item> heap;
+    string scratch;
+    
+    bool before(const Item& a, const Item& b) const {
+        return EntrySorter::compareKeys(a.primary, a.key.data(), a.key.size(), b.primary, b.key.data(), b.key.size(), order.reverse) < 0;
+    }
+    
+public:
+    TopEntries(size_t limit, SortOptions order) : limit(limit), order(order) {
+        heap.reserve(limit);
+    }
+    
+    // Only entries that make the cut pay for a copy of their name
+    void offer(const char* name, EntryInfo& entry) {
+        if (limit == 0) return;
+        size_t length = strlen(name);
+        scratch.clear();
+        uint64_t primary = EntrySorter::appendKey(name, length, entry.size, entry.modified, order.mode, scratch);
+        auto worstOnTop = [this](const Item& a, const Item& b) { return before(a, b); };
+        
+        if (heap.size() < limit) {
+            entry.name.assign(name, length);
+            heap.push_back({primary, scratch, move(entry)});
+            push_heap(heap.begin(), heap.end(), worstOnTop);
+            return;
+        }
+        const Item& worst = heap.front();
+        if (EntrySorter::compareKeys(primary, scratch.data(), scratch.size(), worst.primary, worst.key.data(), worst.key.size(), order.reverse) >= 0) {
+            return;
+        }
+        pop_heap(heap.begin(), heap.end(), worstOnTop);
+        entry.name.assign(name, length);
+        heap.back() = {primary, scratch, move(entry)};
+        push_heap(heap.begin(), heap.end(), worstOnTop);
+    }
+    
+    // Moves the kept entries into `entries`, best first
+    void take(EntryTable& entries) {
+        sort_heap(heap.begin(), heap.end(), [this](const Item& a, const Item& b) { return before(a, b); });
+        entries.clear();
+        for (const auto& item : heap) entries.add(item.entry);
+        heap.clear();
+    }
+};
+
+// File Explorer class
+class FileExplorer {
+private:
+    fs::path currentPath;
+    fs::path copiedPath;
+    bool isCut = false;
+    bool useTrash = true;
+    bool batchMode = false;                 // no prompts: confirmations take the policy below
+    bool assumeYes = false;
+    bool noClobber = false;
+    mutable DirectoryCache listingCache;
+    mutable EntryTable listingTable;        // reused by every listing, keeps its capacity
+    TrashCan trash;
+    MetadataIndex metadataIndex;
+    PathResolver pathResolver;
+    JobScheduler jobs{2, clamp<size_t>(thread::hardware_concurrency(), 2, 16)};
+    
+    static fs::path indexFilePath() {
+        #ifdef _WIN32
+        const char* home = getenv("USERPROFILE");
+        #else
+        const char* home = getenv("HOME");
+        #endif
+        return (home ? fs::path(home) : fs::current_path()) / ".file-explorer-index";
+    }
+    
+public:
+    FileExplorer() {
+        // Start in the user's home directory
+        #ifdef _WIN32
+        const char* userProfile = getenv("USERPROFILE");
+        if (userProfile) {
+            currentPath = fs::path(userProfile);
+        } else {
+            currentPath = fs::current_path();
+        }
+        #else
+        const char* home = getenv("HOME");
+        if (home) {
+            currentPath = fs::path(home);
+        } else {
+            currentPath = fs::current_path();
+        }
+        #endif
+        
+        // A saved index is mapped as is; nothing is rescanned at startup
+        metadataIndex.load(indexFilePath());
+    }
+    
+    // Helper function to format file size in human-readable format
+    string formatFileSize(uintmax_t size) const {
+        const char* units[] = {"B", "KB", "MB", "GB", "TB"};
+        int unitIndex = 0;
+        double displaySize = static_cast<double>(size);
+        
+        while (displaySize >= 1024.0 && unitIndex < 4) {
+            displaySize /= 1024.0;
+            unitIndex++;
+        }
+        
+        stringstream ss;
+        ss << fixed << setprecision(1) << displaySize << " " << units[unitIndex];
+        return ss.str();
+    }
+    
+    // Helper function to format permissions from the fetched mode bits
+    string getPermissions(bool isDirectory, unsigned int mode) const {
+        string perms = isDirectory ? "d" : "-";
+        const char* symbols = "rwxrwxrwx";
+        
+        for (int bit = 0; bit < 9; bit++) {
+            perms += (mode & (0400 >> bit)) ? symbols[bit] : '-';
+        }
+        
+        return perms;
+    }
+    
+    // Helper function to format file time
+    string formatFileTime(time_t time) const {
+        // The reentrant variants skip the per-call time zone file check
+        struct tm local;
+        #ifdef _WIN32
+        localtime_s(&local, &time);
+        #else
+        localtime_r(&time, &local);
+        #endif
+        char buffer[80];
+        strftime(buffer, sizeof(buffer), "%b %d %H:%M", &local);
+        return string(buffer);
+    }
+    
+    // Reads a one-key answer; keys are read straight from the Windows console,
+    // and through cin when input is piped. Returns 0 at end of input.
+    static char readChoice() {
+        char choice = 0;
+        #ifdef _WIN32
+        if (_isatty(_fileno(stdin))) {
+            cout.flush();
+            choice = static_cast<char>(_getch());
+            cout << choice << "\n";
+            return choice;
+        }
+        #endif
+        if (!(cin >> choice)) {
+            return 0;
+        }
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        return choice;
+    }
+    
+    // Asks a yes/no question; in batch mode the answer is --yes, and a
+    // refusal is reported so scripts can tell why nothing happened
+    bool confirm(const string& question) const {
+        if (batchMode) {
+            if (!assumeYes) {
+                cout << question << " no (pass --yes to confirm in batch mode)\n";
+            }
+            return assumeYes;
+        }
+        cout << question << " (y/n): ";
+        char choice = readChoice();
+        return choice == 'y' || choice == 'Y';
+    }
+    
+    // One directory of a recursive listing, filled in by a pool worker
+    struct ListingNode {
+        fs::path path;
+        EntryTable entries;
+        string error;
+        vector<unique_ptr<ListingNode>> children;
+        bool ready = false;
+    };
+    
+    // Shared state of one parallel recursive listing
+    struct ListingWalk {
+        bool showHidden;
+        bool dirsOnly;
+        FetchLevel level;
+        SortOptions order;
+        mutex readyLock;
+        condition_variable readySignal;
+        TaskGroup group;
+        
+        ListingWalk(bool showHidden, bool dirsOnly, FetchLevel level, SortOptions order)
+            : showHidden(showHidden), dirsOnly(dirsOnly), level(level), order(order), group(WorkStealingPool::shared()) {}
+    };
+    
+    // Each thread reuses its own key arena across listings
+    static void sortEntries(EntryTable& entries, const SortOptions& order) {
+        static thread_local EntrySorter sorter;
+        sorter.sort(entries, order);
+    }
+    
+    // Worker side: read one directory and queue its subdirectories
+    static void readListingNode(ListingNode* node, ListingWalk& walk) {
+        try {
+            DirectoryReader::read(node->path, walk.showHidden, walk.dirsOnly, walk.level, node->entries);
+            sortEntries(node->entries, walk.order);
+            for (size_t i = 0; i < node->entries.size(); i++) {
+                if (node->entries.isDirectory(i)) {
+                    auto child = make_unique<ListingNode>();
+                    child->path = node->path / node->entries.name(i);
+                    node->children.push_back(move(child));
+                }
+            }
+        } catch (const fs::filesystem_error& e) {
+            node->error = e.what();
+        }
+        
+        // Children are queued before the node is published, so the printer
+        // never sees the children list change under it
+        for (auto& child : node->children) {
+            ListingNode* childNode = child.get();
+            walk.group.submit([childNode, &walk] { readListingNode(childNode, walk); });
+        }
+        
+        {
+            lock_guard<mutex> guard(walk.readyLock);
+            node->ready = true;
+        }
+        walk.readySignal.notify_all();
+    }
+    
+    // Printer side: depth-first in sorted order, freeing each subtree once
+    // shown; false when any directory in it could not be read
+    bool printListingNode(ListingNode& node, ListingWalk& walk, bool longFormat, int depth) const {
+        {
+            unique_lock<mutex> guard(walk.readyLock);
+            walk.readySignal.wait(guard, [&node] { return node.ready; });
+        }
+        
+        if (depth > 0) {
+            cout << "\n" << node.path.string() << ":\n";
+        }
+        
+        bool readable = node.error.empty();
+        if (!readable) {
+            setConsoleColor(COLOR_RED);
+            cout << "Error accessing directory: " << node.error << "\n";
+            setConsoleColor(COLOR_RESET);
+        } else {
+            printEntries(node.entries, longFormat);
+        }
+        
+        for (auto& child : node.children) {
+            readable = printListingNode(*child, walk, longFormat, depth + 1) && readable;
+            child.reset();
+        }
+        return readable;
+    }
+    
+    void printEntries(const EntryTable& entries, bool longFormat, size_t firstIndex = 1) const {
+        size_t index = firstIndex;
+        
+        for (size_t i = 0; i < entries.size(); i++) {
+            const char* name = entries.name(i);
+            bool isDirectory = entries.isDirectory(i);
+            if (longFormat) {
+                // Long format: permissions, size, date, name
+                string perms = getPermissions(isDirectory, entries.mode(i));
+                string timeStr = formatFileTime(entries.modified(i));
+                
+                if (isDirectory) {
+                    setConsoleColor(COLOR_CYAN);
+                    cout << perms << "  " << setw(10) << right << "<DIR>" << "  " 
+                         << timeStr << "  " << name << "\n";
+                    setConsoleColor(COLOR_RESET);
+                } else {
+                    setConsoleColor(COLOR_GREEN);
+                    cout << perms << "  " << setw(10) << right << formatFileSize(entries.fileSize(i)) << "  " 
+                         << timeStr << "  " << name << "\n";
+                    setConsoleColor(COLOR_RESET);
+                }
+            } else {
+                // Short format with index
+                cout << setfill(' ') << setw(2) << right << index << ". ";
+                if (isDirectory) {
+                    setConsoleColor(COLOR_CYAN);
+                    cout << "📁  " << name << "\n";
+                    setConsoleColor(COLOR_RESET);
+                } else {
+                    setConsoleColor(COLOR_GREEN);
+                    cout << "📄  " << name;
+                    cout << " (" << formatFileSize(entries.fileSize(i)) << ")\n";
+                    setConsoleColor(COLOR_RESET);
+                }
+            }
+            index++;
+        }
+    }
+    
+    // Advanced listing function with flags
+    // Prints pages as the directory is read, or only the best `limit` entries
+    // in sort order; memory stays at one page or `limit` entries either way
+    void listLarge(bool showHidden, bool longFormat, bool dirsOnly, FetchLevel level,
+                   SortOptions order, size_t limit, bool streaming) const {
+        static constexpr size_t pageSize = 1024;
+        size_t listed = 0;
+        if (limit == 0) return;
+        
+        if (streaming) {
+            EntryTable& page = listingTable;
+            page.clear();
+            DirectoryReader::stream(currentPath, showHidden, dirsOnly, level, [&](const char* name, EntryInfo& entry) {
+                page.add(name, strlen(name), entry);
+                if (page.size() == pageSize || listed + page.size() == limit) {
+                    printEntries(page, longFormat, listed + 1);
+                    cout.flush();
+                    listed += page.size();
+                    page.clear();
+                }
+                return listed < limit;
+            });
+            printEntries(page, longFormat, listed + 1);
+        } else {
+            TopEntries top(limit, order);
+            DirectoryReader::stream(currentPath, showHidden, dirsOnly, level, [&](const char* name, EntryInfo& entry) {
+                top.offer(name, entry);
+                return true;
+            });
+            top.take(listingTable);
+            printEntries(listingTable, longFormat);
+        }
+    }
+    
+    bool listDirectory(bool showHidden = false, bool longFormat = false, bool dirsOnly = false, bool recursive = false,
+                       SortOptions order = SortOptions(), size_t limit = SIZE_MAX, bool streaming = false) const {
+        bool listed = true;
+        if (!longFormat) {
+            cout << "\nFiles and folders in: " << currentPath.string() << "\n";
+        }
+        
+        // Collect all entries with the metadata this format needs in one pass
+        // (sorting by time needs directory mtimes too, from the same stat)
+        FetchLevel level = (longFormat || order.mode == SortMode::Time) ? FetchLevel::Full : FetchLevel::FileSizes;
+        
+        if (recursive) {
+            // Subdirectories are read in parallel while the tree is printed in order
+            ListingWalk walk(showHidden, dirsOnly, level, order);
+            ListingNode root;
+            root.path = currentPath;
+            walk.group.submit([&root, &walk] { readListingNode(&root, walk); });
+            listed = printListingNode(root, walk, longFormat, 0);
+            walk.group.wait();
+        } else if (streaming || limit != SIZE_MAX) {
+            // Huge directories bypass the listing cache, which would hold every entry
+            try {
+                listLarge(showHidden, longFormat, dirsOnly, level, order, limit, streaming);
+            } catch (const fs::filesystem_error& e) {
+                setConsoleColor(COLOR_RED);
+                cout << "Error accessing directory: " << e.what() << "\n";
+                setConsoleColor(COLOR_RESET);
+                listed = false;
+            }
+        } else {
+            try {
+                listingCache.read(currentPath, showHidden, dirsOnly, level, listingTable);
+                sortEntries(listingTable, order);
+                printEntries(listingTable, longFormat);
+            } catch (const fs::filesystem_error& e) {
+                setConsoleColor(COLOR_RED);
+                cout << "Error accessing directory: " << e.what() << "\n";
+                setConsoleColor(COLOR_RESET);
+                listed = false;
+            }
+        }
+        
+        cout << "\n";
+        return listed;
+    }
+    
+    // Backward compatibility wrapper
+    void displayCurrentDirectory() const {
+        listDirectory(false, false, false, false);
+    }
+    
+    bool navigate(const string& dirName) {
+        fs::path base = currentPath;
+        vector<string> names;
+        
+        // Handle special case: staying in current directory
+        if (dirName == ".") {
+            return true;
+        }
+        
+        if (dirName == "..") {
+            base = currentPath.parent_path();
+        } else if (dirName == "~") {
+            // Navigate to user home directory
             #ifdef _WIN32
             const char* userProfile = getenv("USERPROFILE");
             if (userProfile) {
-                newPath = fs::path(userProfile);
+                base = fs::path(userProfile);
+            } else {
+                return false;
+            }
+            #else
+            const char* home = getenv("HOME");
+            if (home) {
+                base = fs::path(home);
+            } else {
+                return false;
+            }
+            #endif
+        } else {
+            // Split multi-level paths ("codes/portfolio", "../..") into components;
+            // ".." only trims the path, so nothing is looked up for it
+            string component;
+            auto addComponent = [&] {
+                if (component == "..") {
+                    if (!names.empty()) {
+                        names.pop_back();
+                    } else {
+                        base = base.parent_path();
+                    }
+                } else if (!component.empty() && component != ".") {
+                    names.push_back(component);
+                }
+                component.clear();
+            };
+            for (char c : dirName) {
+                if (c == '/' || c == '\\') {
+                    addComponent();
+                } else {
+                    component += c;
+                }
+            }
+            addComponent();
+        }
+        
+        // One lookup per uncached component, with on-disk casing on Windows
+        fs::path newPath;
+        if (!pathResolver.resolve(base, names, newPath)) {
+            return false;
+        }
+        currentPath = newPath;
+        return true;
+    }
+    
+    bool viewFile(const string& fileName) {
+        fs::path filePath = currentPath / fileName;
+        
+        if (fs::exists(filePath) && fs::is_regular_file(filePath)) {
+            // Ask user for choice; scripts always get the file printed
+            char choice = '1';
+            if (!batchMode) {
+                cout << "Choose action:\n";
+                cout << "1. View in console\n";
+                cout << "2. Open with system app\n";
+                cout << "3. Page through file (large files)\n";
+                cout << "Choice: ";
+                
+                choice = readChoice();
+            }
+            
+            string choiceStr(1, choice);
+            
+            if (choiceStr == "3") {
+                // Memory-mapped pager with a lazily built line index
+                MappedFile mapped;
+                if (!mapped.open(filePath)) {
+                    setConsoleColor(COLOR_RED);
+                    cout << "Error: Could not open file for reading\n";
+                    setConsoleColor(COLOR_RESET);
+                    return false;
+                }
+                FilePager pager(mapped);
+                pager.run();
+            } else if (choiceStr == "1") {
+                // View in console with line numbers
+                ifstream file(filePath);
+                if (!file.is_open()) {
+                    setConsoleColor(COLOR_RED);
+                    cout << "Error: Could not open file for reading\n";
+                    setConsoleColor(COLOR_RESET);
+                    return false;
+                }
+                
+                // Draw header box
+                const int boxWidth = 80;
+                string title = "Content: " + fileName;
+                int padding = (boxWidth - title.length()) / 2;
+                int rightPadding = boxWidth - title.length() - padding;
+                
+                cout << "\n";
+                setConsoleColor(COLOR_CYAN);
+                string topLine(boxWidth, ' ');
+                for (int i = 0; i < boxWidth; i++) topLine[i] = '=';
+                cout << "╔";
+                for (int i = 0; i < boxWidth; i++) cout << "═";
+                cout << "╗\n";
+                cout << "║" << string(padding, ' ') << title << string(rightPadding, ' ') << "║\n";
+                cout << "╚";
+                for (int i = 0; i < boxWidth; i++) cout << "═";
+                cout << "╝\n";
+                setConsoleColor(COLOR_RESET);
+                
+                // Display file content with line numbers
+                string line;
+                int lineNum = 1;
+                while (getline(file, line)) {
+                    setConsoleColor(COLOR_YELLOW);
+                    cout << setw(4) << right << lineNum;
+                    setConsoleColor(COLOR_CYAN);
+                    cout << " │ ";
+                    setConsoleColor(COLOR_RESET);
+                    cout << line << "\n";
+                    lineNum++;
+                }
+                
+                file.close();
+                
+                // Draw footer box
+                setConsoleColor(COLOR_CYAN);
+                for (int i = 0; i < boxWidth + 2; i++) cout << "═";
+                setConsoleColor(COLOR_RESET);
+                cout << "\n";
+                
+            } else if (choiceStr == "2") {
+                // Open with system application - show "Open with" dialog
+                setConsoleColor(COLOR_GREEN);
+                cout << "Opening 'Open with' dialog for " << fileName << "...\n";
+                setConsoleColor(COLOR_RESET);
+                
+                #ifdef _WIN32
+                // Windows: Use rundll32 to force "Open with" dialog
+                // Get absolute path
+                fs::path absPath = fs::absolute(filePath);
+                string pathStr = absPath.string();
+                
+                // Replace backslashes with forward slashes for rundll32
+                for (char& c : pathStr) {
+                    if (c == '/') c = '\\';
+                }
+                
+                string command = "rundll32.exe shell32.dll,OpenAs_RunDLL " + pathStr;
+                cout.flush();
+                system(command.c_str());
+                #else
+                // Linux: Try to show app chooser if available, otherwise use xdg-open
+                string command = "xdg-open \"" + filePath.string() + "\" &";
+                cout.flush();
+                system(command.c_str());
+                #endif
+            } else {
+                cout << "Invalid choice. Operation cancelled.\n";
+                return false;
+            }
+            
+            return true;
+        }
+        return false;
+    }
+    
+    bool editFile(const string& fileName) {
+        fs::path filePath = currentPath / fileName;
+        
+        if (fs::exists(filePath) && fs::is_regular_file(filePath)) {
+            if (batchMode) {
+                setConsoleColor(COLOR_RED);
+                cout << "Error: edit needs an interactive session\n";
+                setConsoleColor(COLOR_RESET);
+                return false;
+            }
+            
+            // Ask user for choice
+            cout << "Choose action:\n";
+            cout << "1. Edit in text editor\n";
+            cout << "2. Open with system app\n";
+            cout << "Choice: ";
+            
+            char choice = readChoice();
+            
+            string choiceStr(1, choice);
+            
+            if (choiceStr == "1") {
+                // Edit with system text editor
+                setConsoleColor(COLOR_GREEN);
+                cout << "Opening " << fileName << " in text editor...\n";
+                setConsoleColor(COLOR_RESET);
+                
+                #ifdef _WIN32
+                // Windows: Use notepad
+                string command = "notepad \"" + filePath.string() + "\"";
+                cout.flush();
+                system(command.c_str());
+                #else
+                // Linux: Use nano
+                string command = "nano \"" + filePath.string() + "\"";
+                cout.flush();
+                system(command.c_str());
+                #endif
+                
+            } else if (choiceStr == "2") {
+                // Open with system application - show "Open with" dialog
+                setConsoleColor(COLOR_GREEN);
+                cout << "Opening 'Open with' dialog for " << fileName << "...\n";
+                setConsoleColor(COLOR_RESET);
+                
+                #ifdef _WIN32
+                // Windows: Use rundll32 to force "Open with" dialog
+                fs::path absPath = fs::absolute(filePath);
+                string pathStr = absPath.string();
+                
+                // Ensure backslashes
+                for (char& c : pathStr) {
+                    if (c == '/') c = '\\';
+                }
+                
+                string command = "rundll32.exe shell32.dll,OpenAs_RunDLL " + pathStr;
+                cout.flush();
+                system(command.c_str());
+                #else
+                // Linux: Use xdg-open
+                string command = "xdg-open \"" + filePath.string() + "\" &";
+                cout.flush();
+                system(command.c_str());
+                #endif
             } else {
+                cout << "Invalid choice. Operation cancelled.\n";
                 return false;
             }
-            #else
-            const char* home = getenv("HOME");
-            if (home) {
-                newPath = fs::path(home);
-            } else {
+            
+            return true;
+        }
+        return false;
+    }
+    
+    bool deleteItem(const string& itemName, bool background = false) {
+        fs::path itemPath = currentPath / itemName;
+        
+        if (!fs::exists(itemPath)) {
+            cout << "Error: Item '" << itemName << "' not found.\n";
+            return false;
+        }
+        
+        if (confirm("Are you sure you want to delete '" + itemName + "'?")) {
+            try {
+                string reason;
+                if (useTrash && trash.moveToTrash(itemPath, reason)) {
+                    setConsoleColor(COLOR_GREEN);
+                    cout << "Moved to trash: " << itemName << " (restore " << itemName << " to undo)\n";
+                    setConsoleColor(COLOR_RESET);
+                    return true;
+                }
+                // Agreeing to the trash is not agreeing to lose the item for good
+                if (useTrash) {
+                    setConsoleColor(COLOR_YELLOW);
+                    cout << "Cannot move '" << itemName << "' to the trash: " << reason << "\n";
+                    setConsoleColor(COLOR_RESET);
+                    if (!confirm("Delete '" + itemName + "' permanently instead?")) {
+                        return false;
+                    }
+                }
+                if (background && fs::is_directory(fs::symlink_status(itemPath))) {
+                    auto job = jobs.submit("delete " + itemName, "Deleting", [itemPath](WorkStealingPool& pool, TransferProgress& progress) {
+                        progress.totalFiles = measure(pool, itemPath).second;
+                        progress.checkCancelled();
+                        DeleteEngine engine(pool, progress);
+                        engine.start(itemPath);
+                        while (!engine.waitFor(chrono::seconds(1))) {}
+                    });
+                    announceJob(*job, itemName);
+                    return true;
+                }
+                if (fs::is_directory(fs::symlink_status(itemPath))) {
+                    TransferProgress progress;
+                    DeleteEngine engine(WorkStealingPool::shared(), progress);
+                    engine.start(itemPath);
+                    waitWithProgress(engine, progress, "Deleting", false);
+                } else {
+                    fs::remove(itemPath);
+                }
+                setConsoleColor(COLOR_GREEN);
+                cout << "Deleted: " << itemName << "\n";
+                setConsoleColor(COLOR_RESET);
+                return true;
+            } catch (const fs::filesystem_error& e) {
+                setConsoleColor(COLOR_RED);
+                cout << "Error deleting item: " << e.what() << "\n";
+                setConsoleColor(COLOR_RESET);
                 return false;
             }
-            #endif
+        }
+        return false;
+    }
+    
+    // Batch mode never reads answers from the command stream: prompts are
+    // confirmed only with `yes`, and `skipExisting` leaves paste targets alone
+    void setBatchMode(bool yes, bool skipExisting) {
+        batchMode = true;
+        assumeYes = yes;
+        noClobber = skipExisting;
+    }
+    
+    bool listJobs() {
+        vector<shared_ptr<JobScheduler::Job>> all = jobs.list();
+        if (all.empty()) {
+            cout << "No background jobs\n";
+            return true;
+        }
+        for (const auto& job : all) {
+            printJob(*job);
+        }
+        // Like a shell, finished jobs are shown one last time
+        jobs.takeFinished();
+        return true;
+    }
+    
+    // Shows a job's progress until it ends; id 0 is the newest job
+    bool foregroundJob(size_t id) {
+        shared_ptr<JobScheduler::Job> job = jobs.find(id);
+        if (!job) {
+            setConsoleColor(COLOR_RED);
+            cout << "Error: No such job" << (id ? " [" + to_string(id) + "]" : "") << "\n";
+            setConsoleColor(COLOR_RESET);
+            return false;
+        }
+        
+        bool terminal = ConsoleRenderer::instance().isTerminal();
+        bool drawn = false;
+        while (!jobs.waitFor(*job, chrono::milliseconds(250))) {
+            if (terminal) {
+                cout << "\r[" << job->id << "] " << describeJob(*job) << "   ";
+                cout.flush();
+                drawn = true;
+            }
+        }
+        if (drawn) cout << "\n";
+        printJob(*job);
+        jobs.forget(job->id);
+        return job->state == JobScheduler::State::Done;
+    }
+    
+    // Asks a job to stop and gives it a moment to reach a safe point
+    bool cancelJob(size_t id) {
+        if (!jobs.cancel(id)) {
+            setConsoleColor(COLOR_RED);
+            cout << "Error: No running job [" << id << "]\n";
+            setConsoleColor(COLOR_RESET);
+            return false;
+        }
+        shared_ptr<JobScheduler::Job> job = jobs.find(id);
+        if (job && jobs.waitFor(*job, chrono::seconds(2))) {
+            printJob(*job);
+            jobs.forget(id);
         } else {
-            // Check if path contains separators (multi-level path like "codes/portfolio" or "../..")
-            bool isMultiLevel = (dirName.find('/') != string::npos || dirName.find('\\') != string::npos);
-            
-            if (isMultiLevel) {
-                // Split path into components
-                vector<string> components;
-                string component;
-                for (char c : dirName) {
-                    if (c == '/' || c == '\\') {
-                        if (!component.empty()) {
-                            components.push_back(component);
-                            component.clear();
-                        }
-                    } else {
-                        component += c;
-                    }
+            cout << "[" << id << "] Stopping at the next safe point\n";
+        }
+        return true;
+    }
+    
+    // Prints jobs that finished since the last prompt
+    void reportFinishedJobs() {
+        for (const auto& job : jobs.takeFinished()) {
+            printJob(*job);
+        }
+    }
+    
+    // Waits for every background job; false when any of them did not succeed
+    bool waitForJobs() {
+        bool succeeded = true;
+        for (const auto& job : jobs.list()) {
+            while (!jobs.waitFor(*job, chrono::seconds(1))) {}
+            succeeded = succeeded && job->state == JobScheduler::State::Done;
+        }
+        reportFinishedJobs();
+        return succeeded;
+    }
+    
+    size_t activeJobs() {
+        return jobs.active();
+    }
+    
+    void setTrashMode(bool enabled) {
+        useTrash = enabled;
+        cout << "Trash mode " << (enabled ? "on: delete moves items to the trash" : "off: delete removes items permanently") << "\n";
+    }
+    
+    void listTrash() {
+        vector<TrashCan::Entry> entries = trash.entries(currentPath);
+        if (entries.empty()) {
+            cout << "Trash is empty.\n";
+            return;
+        }
+        
+        cout << "\nTrash (" << (useTrash ? "on" : "off") << "):\n";
+        for (size_t i = 0; i < entries.size(); i++) {
+            cout << setw(2) << (i + 1) << ". " << entries[i].original.filename().string()
+                 << "  " << formatFileTime(entries[i].deleted) << "  from " << entries[i].original.parent_path().string() << "\n";
+        }
+        cout << "\n";
+    }
+    
+    bool restoreItem(const string& itemName) {
+        try {
+            fs::path restored = trash.restore(currentPath, itemName);
+            setConsoleColor(COLOR_GREEN);
+            cout << "Restored: " << restored.string() << "\n";
+            setConsoleColor(COLOR_RESET);
+            return true;
+        } catch (const fs::filesystem_error& e) {
+            setConsoleColor(COLOR_RED);
+            cout << "Error restoring item: " << e.what() << "\n";
+            setConsoleColor(COLOR_RESET);
+            return false;
+        }
+    }
+    
+    bool copyItem(const string& itemName) {
+        fs::path itemPath = currentPath / itemName;
+        
+        if (fs::exists(itemPath)) {
+            copiedPath = itemPath;
+            isCut = false;
+            setConsoleColor(COLOR_GREEN);
+            cout << "Copied: " << itemName << "\n";
+            setConsoleColor(COLOR_RESET);
+            return true;
+        }
+        return false;
+    }
+    
+    bool cutItem(const string& itemName) {
+        fs::path itemPath = currentPath / itemName;
+        
+        if (fs::exists(itemPath)) {
+            copiedPath = itemPath;
+            isCut = true;
+            setConsoleColor(COLOR_GREEN);
+            cout << "Cut: " << itemName << "\n";
+            setConsoleColor(COLOR_RESET);
+            return true;
+        }
+        return false;
+    }
+    
+    // True when `path` is `root` itself or lies somewhere beneath it
+    static bool isSameOrInside(const fs::path& path, const fs::path& root) {
+        fs::path relative = fs::weakly_canonical(path).lexically_relative(fs::weakly_canonical(root));
+        return !relative.empty() && *relative.begin() != "..";
+    }
+    
+    string describeTransfer(const TransferProgress& progress, bool withBytes = true) const {
+        stringstream ss;
+        if (withBytes) {
+            ss << progress.files << " files, " << formatFileSize(progress.bytes) << " in "
+               << fixed << setprecision(1) << progress.seconds() << "s, "
+               << formatFileSize(static_cast<uintmax_t>(progress.bytesPerSecond())) << "/s";
+        } else {
+            ss << progress.files << " files, " << progress.directories << " directories in "
+               << fixed << setprecision(1) << progress.seconds() << "s";
+        }
+        return ss.str();
+    }
+    
+    // Total size and file count of `root`, from a parallel walk; these give
+    // background jobs their ETA
+    static pair<uint64_t, uint64_t> measure(WorkStealingPool& pool, const fs::path& root) {
+        error_code error;
+        fs::file_status status = fs::symlink_status(root, error);
+        if (fs::is_regular_file(status)) {
+            uintmax_t size = fs::file_size(root, error);
+            return {error ? 0 : size, 1};
+        }
+        if (!fs::is_directory(status)) {
+            return {0, 1};
+        }
+        
+        TransferProgress scratch;
+        DiskUsageWalker walker(pool, scratch, 0);
+        walker.start(root);
+        while (!walker.waitFor(chrono::seconds(1))) {}
+        vector<DiskUsageWalker::Usage> usage = walker.directories(0);
+        return usage.empty() ? pair<uint64_t, uint64_t>{0, 0} : pair<uint64_t, uint64_t>{usage[0].apparent, usage[0].files};
+    }
+    
+    // Hands the current paste to a background job. A cut within one
+    // filesystem is a single rename, so it still happens right away.
+    bool startPasteJob(const fs::path& destPath, bool verify, const fs::path& manifestPath) {
+        fs::path source = copiedPath;
+        string name = source.filename().string();
+        
+        if (isCut) {
+            error_code renameError;
+            fs::rename(source, destPath, renameError);
+            if (!renameError) {
+                setConsoleColor(COLOR_GREEN);
+                cout << "Moved: " << name << "\n";
+                setConsoleColor(COLOR_RESET);
+                copiedPath.clear();
+                return true;
+            }
+            if (renameError != errc::cross_device_link) {
+                throw fs::filesystem_error("rename", source, destPath, renameError);
+            }
+            
+            auto job = jobs.submit("paste " + name, "Moving", [source, destPath](WorkStealingPool& pool, TransferProgress& progress) {
+                auto [bytes, files] = measure(pool, source);
+                progress.totalBytes = bytes;
+                progress.totalFiles = files;
+                progress.checkCancelled();
+                #ifdef _WIN32
+                CopyEngine engine(pool, progress);
+                engine.start(source, destPath);
+                engine.wait();
+                progress.checkCancelled();
+                fs::remove_all(source);
+                #else
+                MovePipeline pipeline(progress);
+                pipeline.start(source, destPath);
+                while (!pipeline.waitFor(chrono::seconds(1))) {}
+                #endif
+            });
+            copiedPath.clear();
+            announceJob(*job, name);
+            return true;
+        }
+        
+        auto job = jobs.submit("paste " + name, "Copying", [source, destPath, verify, manifestPath](WorkStealingPool& pool, TransferProgress& progress) {
+            auto [bytes, files] = measure(pool, source);
+            progress.totalBytes = bytes;
+            progress.totalFiles = files;
+            progress.checkCancelled();
+            CopyEngine engine(pool, progress);
+            if (verify) {
+                engine.verifyWhileCopying();
+            }
+            engine.start(source, destPath);
+            engine.wait();
+            progress.checkCancelled();
+            if (!manifestPath.empty()) {
+                ManifestVerifier::save(manifestPath, engine.manifest());
+            }
+        });
+        announceJob(*job, name);
+        return true;
+    }
+    
+    static void announceJob(const JobScheduler::Job& job, const string& name) {
+        setConsoleColor(COLOR_GREEN);
+        cout << "[" << job.id << "] " << job.verb << " '" << name << "' in the background (fg " << job.id
+             << " to watch, cancel " << job.id << " to stop)\n";
+        setConsoleColor(COLOR_RESET);
+    }
+    
+    static string formatDuration(double seconds) {
+        long total = static_cast<long>(seconds + 0.5);
+        char buffer[32];
+        if (total >= 3600) {
+            snprintf(buffer, sizeof(buffer), "%ld:%02ld:%02ld", total / 3600, total / 60 % 60, total % 60);
+        } else {
+            snprintf(buffer, sizeof(buffer), "%ld:%02ld", total / 60, total % 60);
+        }
+        return buffer;
+    }
+    
+    // One line on a job: live counters with rate and ETA while it runs,
+    // the outcome once it has finished
+    string describeJob(const JobScheduler::Job& job) const {
+        const TransferProgress& progress = job.progress;
+        JobScheduler::State state = job.state;
+        bool withBytes = job.verb != "Deleting";
+        stringstream ss;
+        
+        if (state == JobScheduler::State::Queued) {
+            ss << "Queued";
+            return ss.str();
+        }
+        if (state == JobScheduler::State::Failed) {
+            ss << "Failed: " << job.error;
+            return ss.str();
+        }
+        
+        double seconds = state == JobScheduler::State::Running ? progress.seconds() : job.seconds;
+        ss << (state == JobScheduler::State::Running ? job.verb : state == JobScheduler::State::Done ? "Done" : "Cancelled")
+           << ": " << progress.files;
+        if (state == JobScheduler::State::Running && progress.totalFiles) {
+            ss << "/" << progress.totalFiles;
+        }
+        ss << " files";
+        if (withBytes) {
+            ss << ", " << formatFileSize(progress.bytes);
+            if (state == JobScheduler::State::Running && progress.totalBytes) {
+                ss << " of " << formatFileSize(progress.totalBytes);
+            }
+            ss << ", " << formatFileSize(static_cast<uintmax_t>(seconds > 0 ? progress.bytes / seconds : 0)) << "/s";
+        }
+        ss << " in " << formatDuration(seconds);
+        
+        if (state == JobScheduler::State::Running) {
+            double left = progress.secondsLeft();
+            if (progress.cancelled) {
+                ss << ", stopping";
+            } else if (left >= 0) {
+                ss << ", ETA " << formatDuration(left);
+            }
+        }
+        return ss.str();
+    }
+    
+    void printJob(const JobScheduler::Job& job) const {
+        JobScheduler::State state = job.state;
+        setConsoleColor(state == JobScheduler::State::Failed ? COLOR_RED : state == JobScheduler::State::Done ? COLOR_GREEN : COLOR_RESET);
+        cout << "[" << job.id << "] " << left << setw(24) << job.command << right << " " << describeJob(job) << "\n";
+        setConsoleColor(COLOR_RESET);
+    }
+    
+    // Waits for a running engine, redrawing a one-line progress report on terminals
+    template <typename Engine>
+    void waitWithProgress(Engine& engine, const TransferProgress& progress, const string& verb, bool withBytes = true) const {
+        bool terminal = ConsoleRenderer::instance().isTerminal();
+        bool drawn = false;
+        
+        try {
+            while (!engine.waitFor(chrono::milliseconds(250))) {
+                if (terminal) {
+                    cout << "\r" << verb << ": " << describeTransfer(progress, withBytes) << "   ";
+                    cout.flush();
+                    drawn = true;
+                }
+            }
+        } catch (...) {
+            if (drawn) cout << "\n";
+            throw;
+        }
+        if (drawn) cout << "\n";
+    }
+    
+    // `verify` hashes the data while it is copied; a non-empty
+    // `manifestName` also saves the checksums there for the verify command
+    bool pasteItem(bool background = false, bool verify = false, const string& manifestName = "") {
+        if (copiedPath.empty()) {
+            cout << "Error: Nothing to paste.\n";
+            return false;
+        }
+        if (verify && isCut) {
+            cout << "Error: --verify applies to copies; a cut item is moved\n";
+            return false;
+        }
+        
+        fs::path destPath = currentPath / copiedPath.filename();
+        fs::path manifestPath = manifestName.empty() ? fs::path() : currentPath / manifestName;
+        
+        try {
+            if (!isCut && isSameOrInside(destPath, copiedPath)) {
+                setConsoleColor(COLOR_RED);
+                cout << "Error: Cannot paste '" << copiedPath.filename().string() << "' into itself\n";
+                setConsoleColor(COLOR_RESET);
+                return false;
+            }
+            
+            if (fs::exists(destPath)) {
+                if (batchMode && noClobber) {
+                    cout << "Skipped: '" << copiedPath.filename().string() << "' already exists\n";
+                    return true;
                 }
-                if (!component.empty()) {
-                    components.push_back(component);
+                if (!confirm("'" + copiedPath.filename().string() + "' already exists. Overwrite?")) {
+                    return false;
                 }
+            }
+            
+            if (background) {
+                return startPasteJob(destPath, verify, manifestPath);
+            }
+            
+            if (isCut) {
+                error_code renameError;
+                fs::rename(copiedPath, destPath, renameError);
                 
-                // Navigate through each component with case-correction
-                newPath = currentPath;
-                for (const string& comp : components) {
-                    if (comp == "..") {
-                        // Move to parent directory
-                        newPath = newPath.parent_path();
-                    } else if (comp == ".") {
-                        // Stay in current directory
-                        continue;
-                    } else {
-                        // Regular directory name
-                        fs::path tempPath = newPath / comp;
-                        
-                        #ifdef _WIN32
-                        // Find correct casing for this component
-                        if (fs::exists(tempPath) && fs::is_directory(tempPath)) {
-                            try {
-                                for (const auto& entry : fs::directory_iterator(newPath)) {
-                                    if (entry.is_directory()) {
-                                        string entryName = entry.path().filename().string();
-                                        string searchName = comp;
-                                        
-                                        // Case-insensitive comparison
-                                        transform(entryName.begin(), entryName.end(), entryName.begin(), ::tolower);
-                                        transform(searchName.begin(), searchName.end(), searchName.begin(), ::tolower);
-                                        
-                                        if (entryName == searchName) {
-                                            tempPath = entry.path();
-                                            break;
-                                        }
-                                    }
-                                }
-                            } catch (const fs::filesystem_error&) {
-                                // Continue with tempPath as-is
-                            }
-                        }
-                        #endif
-                        
-                        // Check if this component exists
-                        if (!fs::exists(tempPath) || !fs::is_directory(tempPath)) {
-                            return false;
-                        }
-                        
-                        newPath = tempPath;
-                    }
+                if (renameError == errc::cross_device_link) {
+                    // Different mounts: stream the data over and remove
+                    // sources as their copies are confirmed
+                    TransferProgress progress;
+                    #ifdef _WIN32
+                    CopyEngine engine(WorkStealingPool::shared(), progress);
+                    engine.start(copiedPath, destPath);
+                    waitWithProgress(engine, progress, "Moving");
+                    fs::remove_all(copiedPath);
+                    #else
+                    MovePipeline pipeline(progress);
+                    pipeline.start(copiedPath, destPath);
+                    waitWithProgress(pipeline, progress, "Moving");
+                    #endif
+                } else if (renameError) {
+                    throw fs::filesystem_error("rename", copiedPath, destPath, renameError);
                 }
+                
+                setConsoleColor(COLOR_GREEN);
+                cout << "Moved: " << copiedPath.filename().string() << "\n";
+                setConsoleColor(COLOR_RESET);
+                copiedPath.clear();
             } else {
-                // Single directory name - original logic
-                newPath = currentPath / dirName;
+                TransferProgress progress;
+                CopyEngine engine(WorkStealingPool::shared(), progress);
+                if (verify) {
+                    engine.verifyWhileCopying();
+                }
+                engine.start(copiedPath, destPath);
+                waitWithProgress(engine, progress, verify ? "Copying and hashing" : "Copying");
                 
-                // On Windows, find the actual directory with correct casing
-                #ifdef _WIN32
-                if (fs::exists(newPath) && fs::is_directory(newPath)) {
-                    try {
-                        for (const auto& entry : fs::directory_iterator(currentPath)) {
-                            if (entry.is_directory()) {
-                                string entryName = entry.path().filename().string();
-                                string searchName = dirName;
-                                
-                                // Case-insensitive comparison
-                                transform(entryName.begin(), entryName.end(), entryName.begin(), ::tolower);
-                                transform(searchName.begin(), searchName.end(), searchName.begin(), ::tolower);
-                                
-                                if (entryName == searchName) {
-                                    newPath = entry.path();
-                                    break;
-                                }
-                            }
-                        }
-                    } catch (const fs::filesystem_error&) {
-                        // If we can't iterate, just use the path as-is
+                setConsoleColor(COLOR_GREEN);
+                cout << "Pasted: " << copiedPath.filename().string() << " (" << describeTransfer(progress) << ")\n";
+                if (verify) {
+                    vector<ChecksumEntry> checksums = engine.manifest();
+                    cout << "Hashed " << checksums.size() << " files while copying (XXH64), all synced to disk\n";
+                    if (!manifestPath.empty()) {
+                        ManifestVerifier::save(manifestPath, checksums);
+                        cout << "Manifest: " << manifestPath.lexically_relative(currentPath).string()
+                             << " (check later with: verify " << manifestName << ")\n";
                     }
                 }
-                #endif
+                setConsoleColor(COLOR_RESET);
             }
-        }
-        
-        if (fs::exists(newPath) && fs::is_directory(newPath)) {
-            currentPath = newPath;
             return true;
+        } catch (const fs::filesystem_error& e) {
+            setConsoleColor(COLOR_RED);
+            cout << "Error pasting item: " << e.what() << "\n";
+            setConsoleColor(COLOR_RESET);
+            return false;
         }
-        return false;
     }
     
-    bool viewFile(const string& fileName) {
-        fs::path filePath = currentPath / fileName;
+    bool diskUsage(const string& itemName, int maxDepth, size_t topCount) {
+        fs::path target = itemName.empty() ? currentPath : currentPath / itemName;
+        if (!fs::is_directory(target)) {
+            cout << "Error: '" << itemName << "' is not a valid directory\n";
+            return false;
+        }
         
-        if (fs::exists(filePath) && fs::is_regular_file(filePath)) {
-            // Ask user for choice
-            cout << "Choose action:\n";
-            cout << "1. View in console\n";
-            cout << "2. Open with system app\n";
-            cout << "Choice: ";
-            
-            char choice;
-            #ifdef _WIN32
-            choice = _getch();
-            cout << choice << endl;
-            #else
-            cin >> choice;
-            cin.ignore();
-            #endif
+        try {
+            TransferProgress progress;
+            DiskUsageWalker walker(WorkStealingPool::shared(), progress, topCount);
+            walker.start(target);
+            waitWithProgress(walker, progress, "Scanning", false);
             
-            string choiceStr(1, choice);
+            cout << "\n" << setw(12) << "Apparent" << setw(12) << "Allocated" << setw(10) << "Files" << "  Path\n";
+            for (const auto& usage : walker.directories(maxDepth)) {
+                cout << setw(12) << formatFileSize(usage.apparent) << setw(12) << formatFileSize(usage.allocated)
+                     << setw(10) << usage.files << "  " << usage.path.lexically_relative(currentPath).string() << "\n";
+            }
             
-            if (choiceStr == "1") {
-                // View in console with line numbers
-                ifstream file(filePath);
-                if (!file.is_open()) {
-                    setConsoleColor(COLOR_RED);
-                    cout << "Error: Could not open file for reading" << endl;
-                    setConsoleColor(COLOR_RESET);
-                    return false;
+            vector<pair<uint64_t, fs::path>> largest = walker.largestFiles();
+            if (!largest.empty()) {
+                cout << "\nLargest files:\n";
+                for (size_t i = 0; i < largest.size(); i++) {
+                    cout << setw(2) << (i + 1) << ". " << setw(10) << formatFileSize(largest[i].first)
+                         << "  " << largest[i].second.lexically_relative(currentPath).string() << "\n";
                 }
-                
-                // Draw header box
-                const int boxWidth = 80;
-                string title = "Content: " + fileName;
-                int padding = (boxWidth - title.length()) / 2;
-                int rightPadding = boxWidth - title.length() - padding;
-                
-                cout << "\n";
-                setConsoleColor(COLOR_CYAN);
-                string topLine(boxWidth, ' ');
-                for (int i = 0; i < boxWidth; i++) topLine[i] = '=';
-                cout << "╔";
-                for (int i = 0; i < boxWidth; i++) cout << "═";
-                cout << "╗\n";
-                cout << "║" << string(padding, ' ') << title << string(rightPadding, ' ') << "║\n";
-                cout << "╚";
-                for (int i = 0; i < boxWidth; i++) cout << "═";
-                cout << "╝\n";
+            }
+            
+            if (walker.unreadableDirectories() > 0) {
+                setConsoleColor(COLOR_RED);
+                cout << walker.unreadableDirectories() << " directories could not be read\n";
                 setConsoleColor(COLOR_RESET);
-                
-                // Display file content with line numbers
-                string line;
-                int lineNum = 1;
-                while (getline(file, line)) {
-                    setConsoleColor(COLOR_YELLOW);
-                    cout << setw(4) << right << lineNum;
-                    setConsoleColor(COLOR_CYAN);
-                    cout << " │ ";
-                    setConsoleColor(COLOR_RESET);
-                    cout << line << "\n";
-                    lineNum++;
+            }
+            cout << "Scanned " << describeTransfer(progress, false) << "\n\n";
+        } catch (const fs::filesystem_error& e) {
+            setConsoleColor(COLOR_RED);
+            cout << "Error scanning directory: " << e.what() << "\n";
+            setConsoleColor(COLOR_RESET);
+            return false;
+        }
+        return true;
+    }
+    
+    bool findItems(const string& rootName, const FindQuery& query) {
+        fs::path root = rootName.empty() ? currentPath : currentPath / rootName;
+        if (!fs::is_directory(root)) {
+            cout << "Error: '" << rootName << "' is not a valid directory\n";
+            return false;
+        }
+        
+        try {
+            TransferProgress progress;
+            auto lastFlush = chrono::steady_clock::now();
+            FindWalker walker(WorkStealingPool::shared(), query, progress, [&](const fs::path& path) {
+                cout << path.lexically_relative(currentPath).string() << "\n";
+                auto now = chrono::steady_clock::now();
+                if (now - lastFlush >= chrono::milliseconds(100)) {
+                    cout.flush();
+                    lastFlush = now;
                 }
-                
-                file.close();
-                
-                // Draw footer box
-                setConsoleColor(COLOR_CYAN);
-                for (int i = 0; i < boxWidth + 2; i++) cout << "═";
-                setConsoleColor(COLOR_RESET);
-                cout << "\n";
-                
-            } else if (choiceStr == "2") {
-                // Open with system application - show "Open with" dialog
-                setConsoleColor(COLOR_GREEN);
-                cout << "Opening 'Open with' dialog for " << fileName << "..." << endl;
+            });
+            walker.start(root);
+            
+            // Matches print as they arrive; quiet stretches still get flushed
+            while (!walker.waitFor(chrono::milliseconds(250))) {
+                walker.withSinkLocked([] { cout.flush(); });
+            }
+            
+            if (walker.unreadableDirectories() > 0) {
+                setConsoleColor(COLOR_RED);
+                cout << walker.unreadableDirectories() << " directories could not be read\n";
                 setConsoleColor(COLOR_RESET);
-                
-                #ifdef _WIN32
-                // Windows: Use rundll32 to force "Open with" dialog
-                // Get absolute path
-                fs::path absPath = fs::absolute(filePath);
-                string pathStr = absPath.string();
-                
-                // Replace backslashes with forward slashes for rundll32
-                for (char& c : pathStr) {
-                    if (c == '/') c = '\\';
+            }
+            cout << walker.matches() << " matches among " << progress.files << " entries in "
+                 << fixed << setprecision(1) << progress.seconds() << "s\n";
+        } catch (const fs::filesystem_error& e) {
+            setConsoleColor(COLOR_RED);
+            cout << "Error searching directory: " << e.what() << "\n";
+            setConsoleColor(COLOR_RESET);
+            return false;
+        }
+        return true;
+    }
+    
+    bool findDuplicates(const string& rootName) {
+        fs::path root = rootName.empty() ? currentPath : currentPath / rootName;
+        if (!fs::is_directory(root)) {
+            cout << "Error: '" << rootName << "' is not a valid directory\n";
+            return false;
+        }
+        
+        try {
+            auto started = chrono::steady_clock::now();
+            DuplicateFinder finder(WorkStealingPool::shared());
+            
+            TransferProgress walkProgress;
+            finder.start(root, walkProgress);
+            waitWithProgress(finder, walkProgress, "Scanning", false);
+            size_t sameSize = finder.bucketBySize();
+            
+            TransferProgress sampleProgress;
+            finder.startSampling(sampleProgress);
+            waitWithProgress(finder, sampleProgress, "Sampling");
+            size_t sameSample = finder.bucketByHash();
+            
+            TransferProgress hashProgress;
+            finder.startFullHash(hashProgress);
+            waitWithProgress(finder, hashProgress, "Hashing");
+            finder.bucketByHash();
+            
+            vector<DuplicateFinder::Group> groups = finder.groups();
+            uint64_t redundantFiles = 0;
+            uint64_t reclaimable = 0;
+            for (const auto& group : groups) {
+                cout << "\n" << group.paths.size() << " copies of " << formatFileSize(group.size) << ":\n";
+                for (const auto& path : group.paths) {
+                    cout << "  " << path.lexically_relative(currentPath).string() << "\n";
                 }
-                
-                string command = "rundll32.exe shell32.dll,OpenAs_RunDLL " + pathStr;
-                system(command.c_str());
-                #else
-                // Linux: Try to show app chooser if available, otherwise use xdg-open
-                string command = "xdg-open \"" + filePath.string() + "\" &";
-                system(command.c_str());
-                #endif
-            } else {
-                cout << "Invalid choice. Operation cancelled." << endl;
-                return false;
+                redundantFiles += group.paths.size() - 1;
+                reclaimable += group.size * (group.paths.size() - 1);
             }
             
-            return true;
+            if (finder.unreadableItems() > 0) {
+                setConsoleColor(COLOR_RED);
+                cout << finder.unreadableItems() << " files or directories could not be read\n";
+                setConsoleColor(COLOR_RESET);
+            }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+            cout << "\n" << groups.size() << " sets of duplicates, " << redundantFiles << " redundant files, "
+                 << formatFileSize(reclaimable) << " reclaimable\n";
+            cout << "Scanned " << walkProgress.files << " entries; " << sameSize << " files shared a size, "
+                 << sameSample << " also their first and last 4 KB; read " << formatFileSize(sampleProgress.bytes + hashProgress.bytes)
+                 << " in " << fixed << setprecision(1) << seconds << "s\n";
+        } catch (const fs::filesystem_error& e) {
+            setConsoleColor(COLOR_RED);
+            cout << "Error searching for duplicates: " << e.what() << "\n";
+            setConsoleColor(COLOR_RESET);
+            return false;
         }
-        return false;
+        return true;
     }
     
-    bool editFile(const string& fileName) {
-        fs::path filePath = currentPath / fileName;
+    bool verifyManifest(const string& manifestName) {
+        fs::path manifestPath = currentPath / manifestName;
+        vector<ChecksumEntry> entries;
+        string error;
+        if (!ManifestVerifier::load(manifestPath, entries, error)) {
+            setConsoleColor(COLOR_RED);
+            cout << "Error: " << error << "\n";
+            setConsoleColor(COLOR_RESET);
+            return false;
+        }
         
-        if (fs::exists(filePath) && fs::is_regular_file(filePath)) {
-            // Ask user for choice
-            cout << "Choose action:\n";
-            cout << "1. Edit in text editor\n";
-            cout << "2. Open with system app\n";
-            cout << "Choice: ";
-            
-            char choice;
-            #ifdef _WIN32
-            choice = _getch();
-            cout << choice << endl;
-            #else
-            cin >> choice;
-            cin.ignore();
-            #endif
+        TransferProgress progress;
+        ManifestVerifier verifier(WorkStealingPool::shared(), progress);
+        verifier.start(entries);
+        waitWithProgress(verifier, progress, "Verifying");
+        
+        size_t failures = 0;
+        for (const auto& item : verifier.results()) {
+            const char* problem = item.result == ManifestVerifier::Result::Mismatch ? "CHANGED " :
+                                  item.result == ManifestVerifier::Result::WrongSize ? "SIZE    " :
+                                  item.result == ManifestVerifier::Result::Missing ? "MISSING " : nullptr;
+            if (problem) {
+                setConsoleColor(COLOR_RED);
+                cout << problem << item.entry.path.lexically_relative(currentPath).string() << "\n";
+                setConsoleColor(COLOR_RESET);
+                failures++;
+            }
+        }
+        
+        setConsoleColor(failures ? COLOR_RED : COLOR_GREEN);
+        cout << (entries.size() - failures) << " of " << entries.size() << " files match the manifest ("
+             << describeTransfer(progress) << ")\n";
+        setConsoleColor(COLOR_RESET);
+        return failures == 0;
+    }
+    
+    // Makes `destinationName` a copy of `sourceName` by transferring only
+    // what differs; `dryRun` prints the plan and changes nothing
+    bool syncTrees(const string& sourceName, const string& destinationName, bool byChecksum, bool deleteExtras, bool dryRun) {
+        fs::path source = currentPath / sourceName;
+        fs::path destination = currentPath / destinationName;
+        if (!fs::is_directory(source)) {
+            cout << "Error: '" << sourceName << "' is not a valid directory\n";
+            return false;
+        }
+        error_code ec;
+        bool destinationExists = fs::exists(fs::symlink_status(destination, ec));
+        if (destinationExists && !fs::is_directory(destination)) {
+            cout << "Error: '" << destinationName << "' exists and is not a directory\n";
+            return false;
+        }
+        if (isSameOrInside(destination, source) || isSameOrInside(source, destination)) {
+            cout << "Error: Source and destination must not contain each other\n";
+            return false;
+        }
+        
+        try {
+            TransferProgress planProgress;
+            SyncPlanner planner(WorkStealingPool::shared(), planProgress, source, destination, byChecksum, deleteExtras);
+            planner.start(destinationExists);
+            waitWithProgress(planner, planProgress, "Comparing", false);
+            vector<SyncAction> plan = planner.plan();
             
-            string choiceStr(1, choice);
+            uint64_t copies = 0, copyBytes = 0, updates = 0, updateBytes = 0, removals = 0;
+            for (const auto& action : plan) {
+                string name = action.relative.string();
+                switch (action.kind) {
+                    case SyncAction::Kind::MakeDirectory:
+                        cout << "new     " << name << (char)fs::path::preferred_separator << "\n";
+                        break;
+                    case SyncAction::Kind::Copy:
+                        cout << "new     " << name << " (" << formatFileSize(action.size) << ")\n";
+                        copies++;
+                        copyBytes += action.size;
+                        break;
+                    case SyncAction::Kind::Update:
+                        cout << "update  " << name << " (" << formatFileSize(action.size) << (action.delta ? ", delta" : "") << ")\n";
+                        updates++;
+                        updateBytes += action.size;
+                        break;
+                    case SyncAction::Kind::Link:
+                        cout << "link    " << name << " -> " << action.target << "\n";
+                        copies++;
+                        break;
+                    case SyncAction::Kind::Remove:
+                        cout << "delete  " << name << (action.directory ? string(1, (char)fs::path::preferred_separator) : "") << "\n";
+                        removals++;
+                        break;
+                }
+            }
             
-            if (choiceStr == "1") {
-                // Edit with system text editor
-                setConsoleColor(COLOR_GREEN);
-                cout << "Opening " << fileName << " in text editor..." << endl;
+            if (planner.unreadableItems() > 0) {
+                setConsoleColor(COLOR_RED);
+                cout << planner.unreadableItems() << " directories could not be read and were skipped\n";
                 setConsoleColor(COLOR_RESET);
-                
-                #ifdef _WIN32
-                // Windows: Use notepad
-                string command = "notepad \"" + filePath.string() + "\"";
-                system(command.c_str());
-                #else
-                // Linux: Use nano
-                string command = "nano \"" + filePath.string() + "\"";
-                system(command.c_str());
-                #endif
-                
-            } else if (choiceStr == "2") {
-                // Open with system application - show "Open with" dialog
-                setConsoleColor(COLOR_GREEN);
-                cout << "Opening 'Open with' dialog for " << fileName << "..." << endl;
+            }
+            cout << (dryRun ? "Dry run: " : "Plan: ") << copies << " new (" << formatFileSize(copyBytes) << "), "
+                 << updates << " changed (" << formatFileSize(updateBytes) << "), " << removals << " to delete; "
+                 << planner.unchangedFiles() << " unchanged of " << planProgress.files << " entries compared in "
+                 << fixed << setprecision(1) << planProgress.seconds() << "s\n";
+            if (dryRun || plan.empty()) {
+                return planner.unreadableItems() == 0;
+            }
+            
+            if (!destinationExists) {
+                fs::create_directories(destination);
+            }
+            TransferProgress progress;
+            progress.totalBytes = copyBytes + updateBytes;
+            SyncEngine engine(WorkStealingPool::shared(), progress, source, destination, plan);
+            engine.startRemovals();
+            waitWithProgress(engine, progress, "Deleting", false);
+            engine.makeDirectories();
+            progress.files = 0;
+            engine.startTransfers();
+            waitWithProgress(engine, progress, "Syncing");
+            engine.startMetadata();
+            waitWithProgress(engine, progress, "Setting times", false);
+            
+            setConsoleColor(COLOR_GREEN);
+            cout << "Synced " << describeTransfer(progress) << "\n";
+            setConsoleColor(COLOR_RESET);
+            if (engine.deltaCount() > 0) {
+                cout << "Delta: " << engine.deltaCount() << " files, wrote " << formatFileSize(engine.deltaBytesWritten())
+                     << " and kept " << formatFileSize(engine.deltaBytesReused()) << " of the old copies\n";
+            }
+        } catch (const fs::filesystem_error& e) {
+            setConsoleColor(COLOR_RED);
+            cout << "Error during sync: " << e.what() << "\n";
+            setConsoleColor(COLOR_RESET);
+            return false;
+        }
+        return true;
+    }
+    
+    bool packDirectory(const string& directoryName, const string& archiveName) {
+        fs::path root = currentPath / directoryName;
+        fs::path archive = currentPath / archiveName;
+        if (!fs::is_directory(root)) {
+            cout << "Error: '" << directoryName << "' is not a valid directory\n";
+            return false;
+        }
+        if (fs::exists(archive) && !confirm("'" + archiveName + "' already exists. Overwrite?")) {
+            return false;
+        }
+        
+        try {
+            ArchiveWriter writer(WorkStealingPool::shared(), fs::weakly_canonical(root), fs::weakly_canonical(archive));
+            TransferProgress scanProgress;
+            writer.startScan(scanProgress);
+            waitWithProgress(writer, scanProgress, "Scanning", false);
+            TransferProgress progress;
+            writer.startPacking(progress);
+            waitWithProgress(writer, progress, "Packing");
+            
+            if (writer.unreadableItems() > 0) {
+                setConsoleColor(COLOR_RED);
+                cout << writer.unreadableItems() << " directories could not be read and were left out\n";
                 setConsoleColor(COLOR_RESET);
-                
-                #ifdef _WIN32
-                // Windows: Use rundll32 to force "Open with" dialog
-                fs::path absPath = fs::absolute(filePath);
-                string pathStr = absPath.string();
-                
-                // Ensure backslashes
-                for (char& c : pathStr) {
-                    if (c == '/') c = '\\';
+            }
+            double ratio = writer.dataSize() ? 100.0 * writer.size() / writer.dataSize() : 100.0;
+            setConsoleColor(COLOR_GREEN);
+            cout << "Packed " << writer.members().size() << " entries, " << formatFileSize(writer.dataSize()) << " into "
+                 << formatFileSize(writer.size()) << " (" << fixed << setprecision(1) << ratio << "%) in "
+                 << progress.seconds() << "s, " << formatFileSize(static_cast<uintmax_t>(progress.bytesPerSecond())) << "/s\n";
+            setConsoleColor(COLOR_RESET);
+        } catch (const fs::filesystem_error& e) {
+            setConsoleColor(COLOR_RED);
+            cout << "Error packing directory: " << e.what() << "\n";
+            setConsoleColor(COLOR_RESET);
+            return false;
+        }
+        return true;
+    }
+    
+    // Extracts into `directoryName` (the current directory when empty), or
+    // only lists the members; `member` picks one member and its contents
+    bool unpackArchive(const string& archiveName, const string& directoryName, const string& member, bool listOnly) {
+        fs::path destination = directoryName.empty() ? currentPath : currentPath / directoryName;
+        ArchiveReader reader(WorkStealingPool::shared());
+        string error;
+        if (!reader.open(currentPath / archiveName, error)) {
+            setConsoleColor(COLOR_RED);
+            cout << "Error: " << error << "\n";
+            setConsoleColor(COLOR_RESET);
+            return false;
+        }
+        
+        string prefix = member;
+        replace(prefix.begin(), prefix.end(), '\\', '/');
+        while (!prefix.empty() && prefix.back() == '/') prefix.pop_back();
+        if (reader.select(prefix) == 0) {
+            cout << "Error: '" << member << "' is not in the archive\n";
+            return false;
+        }
+        
+        if (listOnly) {
+            uint64_t total = 0;
+            for (const auto& entry : reader.members()) {
+                if (!prefix.empty() && entry.path != prefix && entry.path.compare(0, prefix.size() + 1, prefix + "/") != 0) continue;
+                if (entry.type == ArchiveEntry::Type::Directory) {
+                    cout << setw(12) << "<DIR>" << "  " << entry.path << "/\n";
+                } else if (entry.type == ArchiveEntry::Type::Link) {
+                    cout << setw(12) << "<LINK>" << "  " << entry.path << " -> " << entry.target << "\n";
+                } else {
+                    cout << setw(12) << formatFileSize(entry.size) << "  " << entry.path << "\n";
+                    total += entry.size;
                 }
-                
-                string command = "rundll32.exe shell32.dll,OpenAs_RunDLL " + pathStr;
-                system(command.c_str());
-                #else
-                // Linux: Use xdg-open
-                string command = "xdg-open \"" + filePath.string() + "\" &";
-                system(command.c_str());
-                #endif
-            } else {
-                cout << "Invalid choice. Operation cancelled." << endl;
-                return false;
             }
+            uint64_t stored = 0;
+            for (const auto& chunk : reader.chunkTable()) {
+                stored += chunk.storedLength;
+            }
+            cout << reader.members().size() << " entries, " << formatFileSize(total) << " listed; the archive holds "
+                 << reader.chunkTable().size() << " chunks, " << formatFileSize(stored) << " compressed\n";
+            return true;
+        }
+        
+        if (!fs::is_directory(destination)) {
+            cout << "Error: '" << directoryName << "' is not a valid directory\n";
+            return false;
+        }
+        try {
+            // Parents of a single member are made as needed
+            if (!prefix.empty()) {
+                fs::create_directories((destination / fs::u8path(prefix)).parent_path());
+            }
+            TransferProgress progress;
+            reader.start(destination, progress);
+            waitWithProgress(reader, progress, "Unpacking");
+            reader.startMetadata();
+            waitWithProgress(reader, progress, "Setting times", false);
+            reader.finishLinksAndDirectories();
             
-            return true;
+            setConsoleColor(COLOR_GREEN);
+            cout << "Unpacked " << describeTransfer(progress) << "\n";
+            setConsoleColor(COLOR_RESET);
+        } catch (const fs::filesystem_error& e) {
+            setConsoleColor(COLOR_RED);
+            cout << "Error unpacking archive: " << e.what() << "\n";
+            setConsoleColor(COLOR_RESET);
+            return false;
         }
-        return false;
+        return true;
     }
     
-    bool deleteItem(const string& itemName) {
-        fs::path itemPath = currentPath / itemName;
-        
-        if (!fs::exists(itemPath)) {
-            cout << "Error: Item '" << itemName << "' not found." << endl;
+    bool searchContents(const string& pattern, const string& targetName, bool ignoreCase, bool filesOnly, bool includeHidden) {
+        fs::path target = targetName.empty() ? currentPath : currentPath / targetName;
+        if (!fs::exists(target)) {
+            cout << "Error: '" << targetName << "' not found.\n";
             return false;
         }
         
-        cout << "Are you sure you want to delete '" << itemName << "'? (y/n): ";
-        char choice;
-        #ifdef _WIN32
-        choice = _getch();
-        cout << choice << endl;
-        #else
-        cin >> choice;
-        cin.ignore();
-        #endif
+        GrepQuery query;
+        try {
+            auto flags = regex::ECMAScript | regex::optimize;
+            if (ignoreCase) flags |= regex::icase;
+            query.pattern = regex(pattern, flags);
+        } catch (const regex_error& e) {
+            cout << "Error: invalid regular expression: " << e.what() << "\n";
+            return false;
+        }
+        query.scanner = LiteralScanner(LiteralScanner::requiredLiteral(pattern, query.literalOnly), ignoreCase);
+        query.filesOnly = filesOnly;
+        query.includeHidden = includeHidden;
         
-        if (choice == 'y' || choice == 'Y') {
-            try {
-                if (fs::is_directory(itemPath)) {
-                    fs::remove_all(itemPath);
-                } else {
-                    fs::remove(itemPath);
+        try {
+            TransferProgress progress;
+            auto lastFlush = chrono::steady_clock::now();
+            ContentSearch search(WorkStealingPool::shared(), query, progress, [&](const string& output) {
+                // Paths come out absolute; show them relative to where the user is
+                string prefix = currentPath.string() + static_cast<char>(fs::path::preferred_separator);
+                size_t start = 0;
+                while (start < output.size()) {
+                    size_t end = output.find('\n', start);
+                    if (output.compare(start, prefix.size(), prefix) == 0) start += prefix.size();
+                    cout.write(output.data() + start, static_cast<streamsize>(end + 1 - start));
+                    start = end + 1;
                 }
-                setConsoleColor(COLOR_GREEN);
-                cout << "Deleted: " << itemName << endl;
-                setConsoleColor(COLOR_RESET);
-                return true;
-            } catch (const fs::filesystem_error& e) {
+                auto now = chrono::steady_clock::now();
+                if (now - lastFlush >= chrono::milliseconds(100)) {
+                    cout.flush();
+                    lastFlush = now;
+                }
+            });
+            search.start(target);
+            
+            while (!search.waitFor(chrono::milliseconds(250))) {
+                search.withSinkLocked([] { cout.flush(); });
+            }
+            
+            if (search.unreadableItems() > 0) {
                 setConsoleColor(COLOR_RED);
-                cout << "Error deleting item: " << e.what() << endl;
+                cout << search.unreadableItems() << " files or directories could not be read\n";
                 setConsoleColor(COLOR_RESET);
-                return false;
             }
+            cout << search.lines() << " matching lines in " << search.filesMatched() << " files (searched "
+                 << progress.files << " files, " << formatFileSize(progress.bytes) << " in "
+                 << fixed << setprecision(1) << progress.seconds() << "s)\n";
+        } catch (const fs::filesystem_error& e) {
+            setConsoleColor(COLOR_RED);
+            cout << "Error searching files: " << e.what() << "\n";
+            setConsoleColor(COLOR_RESET);
+            return false;
         }
-        return false;
+        return true;
     }
     
-    bool copyItem(const string& itemName) {
-        fs::path itemPath = currentPath / itemName;
+    bool buildIndex(const string& rootName, bool incremental) {
+        fs::path root;
+        if (incremental) {
+            if (!metadataIndex.loaded()) {
+                cout << "Error: no index to update. Use 'index build' first.\n";
+                return false;
+            }
+            root = metadataIndex.root();
+        } else {
+            root = fs::absolute(rootName.empty() ? currentPath : currentPath / rootName).lexically_normal();
+            if (root.has_relative_path() && !root.has_filename()) root = root.parent_path();
+        }
+        if (!fs::is_directory(root)) {
+            cout << "Error: '" << root.string() << "' is not a valid directory\n";
+            return false;
+        }
         
-        if (fs::exists(itemPath)) {
-            copiedPath = itemPath;
-            isCut = false;
+        try {
+            TransferProgress progress;
+            IndexBuilder builder(WorkStealingPool::shared(), progress, incremental ? &metadataIndex : nullptr);
+            builder.start(root);
+            waitWithProgress(builder, progress, incremental ? "Updating index" : "Indexing", false);
+            
+            // The old mapping has to go before the file is replaced (Windows cannot rename over it)
+            metadataIndex.unload();
+            builder.write(indexFilePath());
+            metadataIndex.load(indexFilePath());
+            
             setConsoleColor(COLOR_GREEN);
-            cout << "Copied: " << itemName << endl;
+            cout << "Indexed " << root.string() << ": " << metadataIndex.count() << " entries, "
+                 << builder.rescanned() << " directories read in " << fixed << setprecision(1) << progress.seconds() << "s\n";
             setConsoleColor(COLOR_RESET);
-            return true;
+            if (builder.unreadableDirectories() > 0) {
+                setConsoleColor(COLOR_RED);
+                cout << builder.unreadableDirectories() << " directories could not be read\n";
+                setConsoleColor(COLOR_RESET);
+            }
+        } catch (const fs::filesystem_error& e) {
+            metadataIndex.load(indexFilePath());
+            setConsoleColor(COLOR_RED);
+            cout << "Error building index: " << e.what() << "\n";
+            setConsoleColor(COLOR_RESET);
+            return false;
         }
-        return false;
+        return true;
     }
     
-    bool cutItem(const string& itemName) {
-        fs::path itemPath = currentPath / itemName;
-        
-        if (fs::exists(itemPath)) {
-            copiedPath = itemPath;
-            isCut = true;
-            setConsoleColor(COLOR_GREEN);
-            cout << "Cut: " << itemName << endl;
-            setConsoleColor(COLOR_RESET);
-            return true;
+    void indexStatus() const {
+        if (!metadataIndex.loaded()) {
+            cout << "No index. Use 'index build [directory]' to create one.\n";
+            return;
         }
-        return false;
+        cout << "Index of " << metadataIndex.root().string() << "\n";
+        cout << "  " << metadataIndex.count() << " entries, " << metadataIndex.files(0) << " files, "
+             << formatFileSize(metadataIndex.total(0)) << " total\n";
+        cout << "  Built " << formatFileTime(metadataIndex.builtAt()) << ", "
+             << formatFileSize(metadataIndex.fileBytes()) << " on disk\n";
     }
     
-    bool pasteItem() {
-        if (copiedPath.empty()) {
-            cout << "Error: Nothing to paste." << endl;
+    bool indexFind(const string& pattern, char type) const {
+        if (!metadataIndex.loaded()) {
+            cout << "Error: no index. Use 'index build' first.\n";
             return false;
         }
         
-        fs::path destPath = currentPath / copiedPath.filename();
+        auto started = chrono::steady_clock::now();
+        GlobMatcher glob(pattern);
+        uint32_t count = static_cast<uint32_t>(metadataIndex.count());
+        WorkStealingPool& pool = WorkStealingPool::shared();
+        uint32_t chunk = max<uint32_t>(64 * 1024, count / static_cast<uint32_t>(pool.size() * 4) + 1);
+        vector<vector<uint32_t>> found((count + chunk - 1) / chunk);
         
-        try {
-            if (fs::exists(destPath)) {
-                cout << "'" << copiedPath.filename().string() << "' already exists. Overwrite? (y/n): ";
-                char choice;
-                #ifdef _WIN32
-                choice = _getch();
-                cout << choice << endl;
-                #else
-                cin >> choice;
-                cin.ignore();
-                #endif
-                
-                if (choice != 'y' && choice != 'Y') {
-                    return false;
-                }
-            }
-            
-            if (isCut) {
-                fs::rename(copiedPath, destPath);
-                setConsoleColor(COLOR_GREEN);
-                cout << "Moved: " << copiedPath.filename().string() << endl;
-                setConsoleColor(COLOR_RESET);
-                copiedPath.clear();
-            } else {
-                if (fs::is_directory(copiedPath)) {
-                    fs::copy(copiedPath, destPath, fs::copy_options::recursive | fs::copy_options::overwrite_existing);
-                } else {
-                    fs::copy(copiedPath, destPath, fs::copy_options::overwrite_existing);
+        // The name column is scanned in parallel slices; results keep index order
+        TaskGroup group(pool);
+        for (size_t slice = 0; slice < found.size(); slice++) {
+            group.submit([&, slice] {
+                uint32_t first = static_cast<uint32_t>(slice * chunk);
+                uint32_t last = min(count, first + chunk);
+                for (uint32_t i = max<uint32_t>(first, 1); i < last; i++) {
+                    if (type) {
+                        MetadataIndex::Type entryType = metadataIndex.type(i);
+                        char code = entryType == MetadataIndex::Directory ? 'd' : entryType == MetadataIndex::Symlink ? 'l' : 'f';
+                        if (code != type) continue;
+                    }
+                    if (glob.matches(metadataIndex.name(i))) found[slice].push_back(i);
                 }
-                setConsoleColor(COLOR_GREEN);
-                cout << "Pasted: " << copiedPath.filename().string() << endl;
-                setConsoleColor(COLOR_RESET);
+            });
+        }
+        group.wait();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        
+        uint64_t matches = 0;
+        for (const auto& slice : found) {
+            for (uint32_t i : slice) {
+                cout << metadataIndex.pathOf(i).string() << "\n";
+                matches++;
             }
-            return true;
-        } catch (const fs::filesystem_error& e) {
-            setConsoleColor(COLOR_RED);
-            cout << "Error pasting item: " << e.what() << endl;
-            setConsoleColor(COLOR_RESET);
+        }
+        cout << matches << " matches among " << count << " indexed entries in "
+             << fixed << setprecision(3) << seconds * 1000 << " ms\n";
+        return true;
+    }
+    
+    bool indexDiskUsage(const string& itemName, int maxDepth) const {
+        if (!metadataIndex.loaded()) {
+            cout << "Error: no index. Use 'index build' first.\n";
+            return false;
+        }
+        fs::path target = fs::absolute(itemName.empty() ? currentPath : currentPath / itemName);
+        int64_t entry = metadataIndex.locate(target);
+        if (entry < 0 || metadataIndex.type(static_cast<uint32_t>(entry)) != MetadataIndex::Directory) {
+            cout << "Error: '" << target.string() << "' is not an indexed directory\n";
             return false;
         }
+        
+        cout << "\n" << setw(12) << "Size" << setw(10) << "Files" << "  Path (as of " << formatFileTime(metadataIndex.builtAt()) << ")\n";
+        function<void(uint32_t, int)> show = [&](uint32_t i, int depth) {
+            cout << setw(12) << formatFileSize(metadataIndex.total(i)) << setw(10) << metadataIndex.files(i) << "  "
+                 << metadataIndex.pathOf(i).lexically_relative(currentPath).string() << "\n";
+            if (depth >= maxDepth) return;
+            vector<uint32_t> subdirectories;
+            metadataIndex.forEachChild(i, [&](uint32_t child) {
+                if (metadataIndex.type(child) == MetadataIndex::Directory) subdirectories.push_back(child);
+            });
+            sort(subdirectories.begin(), subdirectories.end(), [&](uint32_t a, uint32_t b) {
+                return strcmp(metadataIndex.name(a), metadataIndex.name(b)) < 0;
+            });
+            for (uint32_t child : subdirectories) show(child, depth + 1);
+        };
+        show(static_cast<uint32_t>(entry), 0);
+        cout << "\n";
+        return true;
     }
     
     bool createDirectory(const string& dirName) {
         fs::path newDirPath = currentPath / dirName;
         
         if (fs::exists(newDirPath)) {
-            cout << "Error: '" << dirName << "' already exists." << endl;
+            cout << "Error: '" << dirName << "' already exists.\n";
             return false;
         }
         
         try {
             fs::create_directory(newDirPath);
             setConsoleColor(COLOR_GREEN);
-            cout << "Directory created: " << dirName << endl;
+            cout << "Directory created: " << dirName << "\n";
             setConsoleColor(COLOR_RESET);
             return true;
         } catch (const fs::filesystem_error& e) {
             setConsoleColor(COLOR_RED);
-            cout << "Error creating directory: " << e.what() << endl;
+            cout << "Error creating directory: " << e.what() << "\n";
             setConsoleColor(COLOR_RESET);
             return false;
         }
@@ -735,7 +8439,7 @@ public:
         fs::path newFilePath = currentPath / finalFileName;
         
         if (fs::exists(newFilePath)) {
-            cout << "Error: '" << finalFileName << "' already exists." << endl;
+            cout << "Error: '" << finalFileName << "' already exists.\n";
             return false;
         }
         
@@ -744,14 +8448,14 @@ public:
             if (file.is_open()) {
                 file.close();
                 setConsoleColor(COLOR_GREEN);
-                cout << "File created: " << finalFileName << endl;
+                cout << "File created: " << finalFileName << "\n";
                 setConsoleColor(COLOR_RESET);
                 return true;
             }
             return false;
         } catch (const exception& e) {
             setConsoleColor(COLOR_RED);
-            cout << "Error creating file: " << e.what() << endl;
+            cout << "Error creating file: " << e.what() << "\n";
             setConsoleColor(COLOR_RESET);
             return false;
         }
@@ -791,16 +8495,114 @@ vector<string> splitString(const string& s, char delimiter) {
     return tokens;
 }
 
+// Quotes and escapes a string for the JSON the explorer writes
+string jsonQuote(const string& text) {
+    string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+// Per-command totals for the stats command, plus an optional JSON-lines
+// trace with one record per command. The counters are always on; with no
+// trace open a command costs two counter snapshots and a map update.
+class CommandProfile {
+public:
+    struct Totals {
+        uint64_t calls = 0;
+        uint64_t failures = 0;
+        double millis = 0;
+        double maxMillis = 0;
+        Metrics::Snapshot counters{};
+    };
+    
+private:
+    map<string, Totals> byCommand;
+    string lastLine;
+    int lastStatus = 0;
+    double lastMillis = 0;
+    Metrics::Snapshot lastCounters{};
+    ofstream trace;
+    string tracePath;
+    
+public:
+    void record(const string& command, const string& line, int status, double millis, const Metrics::Snapshot& counters) {
+        Totals& totals = byCommand[command];
+        totals.calls++;
+        if (status != 0) totals.failures++;
+        totals.millis += millis;
+        totals.maxMillis = max(totals.maxMillis, millis);
+        for (size_t i = 0; i < Metrics::count; i++) totals.counters[i] += counters[i];
+        lastLine = line;
+        lastStatus = status;
+        lastMillis = millis;
+        lastCounters = counters;
+        
+        if (trace.is_open()) {
+            auto now = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch());
+            trace << "{\"time_ms\": " << now.count() << ", \"command\": " << jsonQuote(command)
+                  << ", \"line\": " << jsonQuote(line) << ", \"status\": " << status << ", \"wall_ms\": " << millis;
+            for (size_t i = 0; i < Metrics::count; i++) {
+                trace << ", \"" << Metrics::key(i) << "\": " << counters[i];
+            }
+            trace << "}\n";
+            trace.flush();      // a trace is most useful right after a crash
+        }
+    }
+    
+    void reset() {
+        byCommand.clear();
+        lastLine.clear();
+        lastStatus = 0;
+        lastMillis = 0;
+        lastCounters = Metrics::Snapshot{};
+    }
+    
+    // Appends to `path`; an empty path closes the trace
+    bool openTrace(const string& path) {
+        if (trace.is_open()) trace.close();
+        tracePath.clear();
+        if (path.empty()) {
+            return true;
+        }
+        trace.open(path, ios::app);
+        if (!trace.is_open()) {
+            return false;
+        }
+        trace << fixed << setprecision(3);
+        tracePath = path;
+        return true;
+    }
+    
+    const map<string, Totals>& commands() const { return byCommand; }
+    const string& lastCommand() const { return lastLine; }
+    int lastCommandStatus() const { return lastStatus; }
+    double lastCommandMillis() const { return lastMillis; }
+    const Metrics::Snapshot& lastCommandCounters() const { return lastCounters; }
+    const string& traceFile() const { return tracePath; }
+};
+
 // Command handler
 class CommandHandler {
 private:
     FileExplorer& explorer;
     bool running;
+    CommandProfile profile;
     
-    void handleCd(const vector<string>& args) {
+    bool handleCd(const vector<string>& args) {
         if (args.size() < 2) {
-            cout << "Error: cd command requires a directory name" << endl;
-            return;
+            cout << "Error: cd command requires a directory name\n";
+            return false;
         }
         
         // Join all arguments after 'cd' to handle spaces in directory names
@@ -810,14 +8612,16 @@ private:
         }
         
         if (!explorer.navigate(target)) {
-            cout << "Error: '" << target << "' is not a valid directory" << endl;
+            cout << "Error: '" << target << "' is not a valid directory\n";
+            return false;
         }
+        return true;
     }
     
-    void handleView(const vector<string>& args) {
+    bool handleView(const vector<string>& args) {
         if (args.size() < 2) {
-            cout << "Error: view command requires a file name" << endl;
-            return;
+            cout << "Error: view command requires a file name\n";
+            return false;
         }
         
         // Join all arguments to handle spaces in file names
@@ -827,29 +8631,312 @@ private:
         }
         
         if (!explorer.viewFile(fileName)) {
-            cout << "Error: Could not view file '" << fileName << "'" << endl;
+            cout << "Error: Could not view file '" << fileName << "'\n";
+            return false;
+        }
+        return true;
+    }
+    
+    bool handleDelete(const vector<string>& args, bool background) {
+        if (args.size() < 2) {
+            cout << "Error: delete command requires an item name\n";
+            return false;
+        }
+        
+        // Join all arguments to handle spaces in names
+        string itemName = args[1];
+        for (size_t i = 2; i < args.size(); i++) {
+            itemName += " " + args[i];
+        }
+        
+        return explorer.deleteItem(itemName, background);
+    }
+    
+    bool handleTrash(const vector<string>& args) {
+        if (args.size() < 2) {
+            explorer.listTrash();
+        } else if (args[1] == "on") {
+            explorer.setTrashMode(true);
+        } else if (args[1] == "off") {
+            explorer.setTrashMode(false);
+        } else {
+            cout << "Error: usage is trash [on|off]\n";
+            return false;
+        }
+        return true;
+    }
+    
+    bool handleRestore(const vector<string>& args) {
+        if (args.size() < 2) {
+            cout << "Error: restore command requires an item name\n";
+            return false;
+        }
+        
+        // Join all arguments to handle spaces in names
+        string itemName = args[1];
+        for (size_t i = 2; i < args.size(); i++) {
+            itemName += " " + args[i];
+        }
+        
+        return explorer.restoreItem(itemName);
+    }
+    
+    bool handleDu(const vector<string>& args) {
+        int maxDepth = 1;
+        size_t topCount = 0;
+        string itemName;
+        
+        for (size_t i = 1; i < args.size(); i++) {
+            if ((args[i] == "-d" || args[i] == "-n") && i + 1 < args.size()) {
+                char* end = nullptr;
+                long value = strtol(args[i + 1].c_str(), &end, 10);
+                if (*end != '\0' || value < 0) {
+                    cout << "Error: " << args[i] << " expects a non-negative number\n";
+                    return false;
+                }
+                if (args[i] == "-d") {
+                    maxDepth = static_cast<int>(min<long>(value, INT_MAX));
+                } else {
+                    topCount = static_cast<size_t>(value);
+                }
+                i++;
+            } else {
+                // Remaining words form the directory name
+                itemName += (itemName.empty() ? "" : " ") + args[i];
+            }
+        }
+        
+        return explorer.diskUsage(itemName, maxDepth, topCount);
+    }
+    
+    // Parses "[+|-]N" into a comparison and a value
+    static bool parseComparison(const string& text, int& compare, uint64_t& value, string& suffix) {
+        size_t start = 0;
+        compare = 0;
+        if (!text.empty() && (text[0] == '+' || text[0] == '-')) {
+            compare = text[0] == '+' ? 1 : -1;
+            start = 1;
+        }
+        size_t end = start;
+        while (end < text.size() && isdigit(static_cast<unsigned char>(text[end]))) end++;
+        if (end == start) return false;
+        value = strtoull(text.substr(start, end - start).c_str(), nullptr, 10);
+        suffix = text.substr(end);
+        return true;
+    }
+    
+    bool handleFind(const vector<string>& args) {
+        FindQuery query;
+        string rootName;
+        
+        for (size_t i = 1; i < args.size(); i++) {
+            const string& option = args[i];
+            if (option[0] != '-') {
+                if (!rootName.empty()) {
+                    cout << "Error: find takes a single starting directory\n";
+                    return false;
+                }
+                rootName = option;
+                continue;
+            }
+            if (i + 1 >= args.size()) {
+                cout << "Error: " << option << " requires a value\n";
+                return false;
+            }
+            const string& value = args[++i];
+            
+            if (option == "-name") {
+                query.glob = GlobMatcher(value);
+                query.useRegex = false;
+            } else if (option == "-regex") {
+                try {
+                    query.pattern = regex(value, regex::ECMAScript | regex::optimize);
+                    query.useRegex = true;
+                } catch (const regex_error& e) {
+                    cout << "Error: invalid regular expression: " << e.what() << "\n";
+                    return false;
+                }
+            } else if (option == "-type") {
+                if (value != "f" && value != "d" && value != "l") {
+                    cout << "Error: -type expects f, d or l\n";
+                    return false;
+                }
+                query.type = value[0];
+            } else if (option == "-size") {
+                string suffix;
+                if (!parseComparison(value, query.sizeCompare, query.sizeValue, suffix) || suffix.size() > 1) {
+                    cout << "Error: -size expects [+|-]N[c|k|M|G]\n";
+                    return false;
+                }
+                char unit = suffix.empty() ? 'b' : suffix[0];
+                query.sizeUnit = unit == 'c' ? 1 : unit == 'k' ? 1024 : unit == 'M' ? 1024 * 1024 :
+                                 unit == 'G' ? 1024ULL * 1024 * 1024 : unit == 'b' ? 512 : 0;
+                if (query.sizeUnit == 0) {
+                    cout << "Error: -size expects [+|-]N[c|k|M|G]\n";
+                    return false;
+                }
+            } else if (option == "-mtime") {
+                string suffix;
+                uint64_t days = 0;
+                if (!parseComparison(value, query.ageCompare, days, suffix) || !suffix.empty()) {
+                    cout << "Error: -mtime expects [+|-]N\n";
+                    return false;
+                }
+                query.ageDays = static_cast<long>(min<uint64_t>(days, LONG_MAX));
+            } else {
+                cout << "Unknown option: " << option << "\n";
+                return false;
+            }
+        }
+        
+        return explorer.findItems(rootName, query);
+    }
+    
+    bool handleGrep(const vector<string>& args) {
+        bool ignoreCase = false;
+        bool filesOnly = false;
+        bool includeHidden = false;
+        vector<string> operands;
+        
+        for (size_t i = 1; i < args.size(); i++) {
+            const string& arg = args[i];
+            if (arg.size() > 1 && arg[0] == '-' && operands.empty()) {
+                for (size_t j = 1; j < arg.size(); j++) {
+                    switch (arg[j]) {
+                        case 'i':
+                            ignoreCase = true;
+                            break;
+                        case 'l':
+                            filesOnly = true;
+                            break;
+                        case 'a':
+                            includeHidden = true;
+                            break;
+                        default:
+                            cout << "Unknown option: -" << arg[j] << "\n";
+                            return false;
+                    }
+                }
+            } else {
+                operands.push_back(arg);
+            }
+        }
+        
+        if (operands.empty() || operands.size() > 2) {
+            cout << "Error: usage is grep [-i] [-l] [-a] <pattern> [path]\n";
+            return false;
+        }
+        return explorer.searchContents(operands[0], operands.size() > 1 ? operands[1] : "", ignoreCase, filesOnly, includeHidden);
+    }
+    
+    bool handleIndex(const vector<string>& args) {
+        string action = args.size() > 1 ? args[1] : "status";
+        
+        if (action == "status") {
+            explorer.indexStatus();
+        } else if (action == "build") {
+            return explorer.buildIndex(args.size() > 2 ? args[2] : "", false);
+        } else if (action == "update") {
+            return explorer.buildIndex("", true);
+        } else if (action == "find") {
+            if (args.size() < 3) {
+                cout << "Error: usage is index find <glob> [-type f|d|l]\n";
+                return false;
+            }
+            char type = 0;
+            if (args.size() > 4 && args[3] == "-type" && (args[4] == "f" || args[4] == "d" || args[4] == "l")) {
+                type = args[4][0];
+            } else if (args.size() > 3) {
+                cout << "Error: usage is index find <glob> [-type f|d|l]\n";
+                return false;
+            }
+            return explorer.indexFind(args[2], type);
+        } else if (action == "du") {
+            int maxDepth = 1;
+            string itemName;
+            for (size_t i = 2; i < args.size(); i++) {
+                if (args[i] == "-d" && i + 1 < args.size()) {
+                    maxDepth = atoi(args[++i].c_str());
+                } else {
+                    itemName += (itemName.empty() ? "" : " ") + args[i];
+                }
+            }
+            return explorer.indexDiskUsage(itemName, maxDepth);
+        } else {
+            cout << "Error: usage is index [status|build [dir]|update|find <glob>|du [-d N] [dir]]\n";
+            return false;
+        }
+        return true;
+    }
+    
+    bool handleStats(const vector<string>& args) {
+        if (args.size() > 1 && args[1] == "reset") {
+            profile.reset();
+            cout << "Command statistics cleared\n";
+            return true;
+        }
+        if (args.size() > 1 && args[1] == "trace") {
+            string path;
+            for (size_t i = 2; i < args.size(); i++) path += (path.empty() ? "" : " ") + args[i];
+            if (path.empty()) {
+                cout << "Error: usage is stats trace <file>|off\n";
+                return false;
+            } else if (path == "off") {
+                profile.openTrace("");
+                cout << "Trace closed\n";
+            } else if (profile.openTrace(path)) {
+                setConsoleColor(COLOR_GREEN);
+                cout << "Tracing commands to " << path << "\n";
+                setConsoleColor(COLOR_RESET);
+            } else {
+                setConsoleColor(COLOR_RED);
+                cout << "Error: cannot open trace file " << path << "\n";
+                setConsoleColor(COLOR_RESET);
+                return false;
+            }
+            return true;
         }
-    }
-    
-    void handleDelete(const vector<string>& args) {
-        if (args.size() < 2) {
-            cout << "Error: delete command requires an item name" << endl;
-            return;
+        if (args.size() > 1) {
+            cout << "Error: usage is stats [reset|trace <file>|trace off]\n";
+            return false;
         }
         
-        // Join all arguments to handle spaces in names
-        string itemName = args[1];
-        for (size_t i = 2; i < args.size(); i++) {
-            itemName += " " + args[i];
+        ios::fmtflags flags = cout.flags();
+        streamsize precision = cout.precision();
+        auto row = [this](const string& label, uint64_t calls, uint64_t failures, double millis, double maxMillis,
+                          const Metrics::Snapshot& counters) {
+            cout << left << setw(10) << label << right << setw(7) << calls << setw(7) << failures
+                 << fixed << setprecision(2) << setw(11) << millis << setw(10) << maxMillis
+                 << setw(11) << explorer.formatFileSize(counters[static_cast<size_t>(Metric::BytesRead)])
+                 << setw(11) << explorer.formatFileSize(counters[static_cast<size_t>(Metric::BytesWritten)])
+                 << setw(10) << counters[static_cast<size_t>(Metric::EntriesVisited)]
+                 << setw(9) << counters[static_cast<size_t>(Metric::StatCalls)]
+                 << setw(11) << explorer.formatFileSize(counters[static_cast<size_t>(Metric::OutputBytes)]) << "\n";
+        };
+        
+        cout << "\n" << left << setw(10) << "Command" << right << setw(7) << "Calls" << setw(7) << "Failed" << setw(11) << "Total ms"
+             << setw(10) << "Max ms" << setw(11) << "Read" << setw(11) << "Written" << setw(10) << "Entries"
+             << setw(9) << "Stats" << setw(11) << "Output" << "\n";
+        for (const auto& command : profile.commands()) {
+            const CommandProfile::Totals& totals = command.second;
+            row(command.first, totals.calls, totals.failures, totals.millis, totals.maxMillis, totals.counters);
         }
         
-        explorer.deleteItem(itemName);
+        if (!profile.lastCommand().empty()) {
+            cout << "\nLast command: " << profile.lastCommand() << "\n";
+            row("", 1, profile.lastCommandStatus() != 0, profile.lastCommandMillis(), profile.lastCommandMillis(),
+                profile.lastCommandCounters());
+        }
+        cout << "\nTrace: " << (profile.traceFile().empty() ? "off" : profile.traceFile()) << "\n\n";
+        cout.flags(flags);
+        cout.precision(precision);
+        return true;
     }
     
-    void handleEdit(const vector<string>& args) {
+    bool handleEdit(const vector<string>& args) {
         if (args.size() < 2) {
-            cout << "Error: edit command requires a file name" << endl;
-            return;
+            cout << "Error: edit command requires a file name\n";
+            return false;
         }
         
         // Join all arguments to handle spaces in file names
@@ -859,14 +8946,16 @@ private:
         }
         
         if (!explorer.editFile(fileName)) {
-            cout << "Error: Could not edit file '" << fileName << "'" << endl;
+            cout << "Error: Could not edit file '" << fileName << "'\n";
+            return false;
         }
+        return true;
     }
     
-    void handleCopy(const vector<string>& args) {
+    bool handleCopy(const vector<string>& args) {
         if (args.size() < 2) {
-            cout << "Error: copy command requires an item name" << endl;
-            return;
+            cout << "Error: copy command requires an item name\n";
+            return false;
         }
         
         // Join all arguments to handle spaces in names
@@ -876,14 +8965,16 @@ private:
         }
         
         if (!explorer.copyItem(itemName)) {
-            cout << "Error: Could not copy '" << itemName << "'" << endl;
+            cout << "Error: Could not copy '" << itemName << "'\n";
+            return false;
         }
+        return true;
     }
     
-    void handleCut(const vector<string>& args) {
+    bool handleCut(const vector<string>& args) {
         if (args.size() < 2) {
-            cout << "Error: cut command requires an item name" << endl;
-            return;
+            cout << "Error: cut command requires an item name\n";
+            return false;
         }
         
         // Join all arguments to handle spaces in names
@@ -893,20 +8984,38 @@ private:
         }
         
         if (!explorer.cutItem(itemName)) {
-            cout << "Error: Could not cut '" << itemName << "'" << endl;
+            cout << "Error: Could not cut '" << itemName << "'\n";
+            return false;
         }
+        return true;
     }
     
-    void handlePaste(const vector<string>& args) {
-        if (!explorer.pasteItem()) {
-            cout << "Error: Could not paste item" << endl;
+    bool handlePaste(const vector<string>& args, bool background) {
+        bool verify = false;
+        string manifest;
+        for (size_t i = 1; i < args.size(); i++) {
+            if (args[i] == "--verify") {
+                verify = true;
+            } else if (args[i] == "--manifest" && i + 1 < args.size()) {
+                verify = true;
+                manifest = args[++i];
+            } else {
+                cout << "Usage: paste [--verify] [--manifest <file>] [&]\n";
+                return false;
+            }
+        }
+        
+        if (!explorer.pasteItem(background, verify, manifest)) {
+            cout << "Error: Could not paste item\n";
+            return false;
         }
+        return true;
     }
     
-    void handleMkdir(const vector<string>& args) {
+    bool handleMkdir(const vector<string>& args) {
         if (args.size() < 2) {
-            cout << "Error: mkdir command requires a directory name" << endl;
-            return;
+            cout << "Error: mkdir command requires a directory name\n";
+            return false;
         }
         
         // Join all arguments to handle spaces in directory names
@@ -915,13 +9024,13 @@ private:
             dirName += " " + args[i];
         }
         
-        explorer.createDirectory(dirName);
+        return explorer.createDirectory(dirName);
     }
     
-    void handleTouch(const vector<string>& args) {
+    bool handleTouch(const vector<string>& args) {
         if (args.size() < 2) {
-            cout << "Error: touch command requires a file name" << endl;
-            return;
+            cout << "Error: touch command requires a file name\n";
+            return false;
         }
         
         // Join all arguments to handle spaces in file names
@@ -930,15 +9039,132 @@ private:
             fileName += " " + args[i];
         }
         
-        explorer.createFile(fileName);
+        return explorer.createFile(fileName);
+    }
+    
+    // Job ids are accepted with or without a shell-style % prefix
+    static bool parseJobId(const string& text, size_t& id) {
+        string digits = (!text.empty() && text[0] == '%') ? text.substr(1) : text;
+        if (digits.empty() || digits.find_first_not_of("0123456789") != string::npos) {
+            return false;
+        }
+        // Out-of-range ids are rejected like any other bad id, never thrown
+        errno = 0;
+        unsigned long long value = strtoull(digits.c_str(), nullptr, 10);
+        if (errno == ERANGE || value > numeric_limits<size_t>::max()) {
+            return false;
+        }
+        id = static_cast<size_t>(value);
+        return id > 0;
+    }
+    
+    bool handleVerify(const vector<string>& args) {
+        if (args.size() < 2) {
+            cout << "Error: verify command requires a manifest file\n";
+            return false;
+        }
+        
+        // Join all arguments to handle spaces in names
+        string manifest = args[1];
+        for (size_t i = 2; i < args.size(); i++) {
+            manifest += " " + args[i];
+        }
+        return explorer.verifyManifest(manifest);
+    }
+    
+    bool handleDupes(const vector<string>& args) {
+        // Join all arguments to handle spaces in names
+        string rootName;
+        for (size_t i = 1; i < args.size(); i++) {
+            rootName += (i > 1 ? " " : "") + args[i];
+        }
+        return explorer.findDuplicates(rootName);
+    }
+    
+    bool handleSync(const vector<string>& args) {
+        vector<string> names;
+        bool byChecksum = false;
+        bool deleteExtras = false;
+        bool dryRun = false;
+        for (size_t i = 1; i < args.size(); i++) {
+            if (args[i] == "--checksum" || args[i] == "-c") {
+                byChecksum = true;
+            } else if (args[i] == "--delete") {
+                deleteExtras = true;
+            } else if (args[i] == "--dry-run" || args[i] == "-n") {
+                dryRun = true;
+            } else {
+                names.push_back(args[i]);
+            }
+        }
+        if (names.size() != 2) {
+            cout << "Usage: sync <source> <destination> [--checksum] [--delete] [--dry-run]\n";
+            return false;
+        }
+        return explorer.syncTrees(names[0], names[1], byChecksum, deleteExtras, dryRun);
+    }
+    
+    bool handlePack(const vector<string>& args) {
+        if (args.size() != 3) {
+            cout << "Usage: pack <directory> <archive>\n";
+            return false;
+        }
+        return explorer.packDirectory(args[1], args[2]);
+    }
+    
+    bool handleUnpack(const vector<string>& args) {
+        vector<string> names;
+        string member;
+        bool listOnly = false;
+        for (size_t i = 1; i < args.size(); i++) {
+            if (args[i] == "--list" || args[i] == "-l") {
+                listOnly = true;
+            } else if (args[i] == "--only" && i + 1 < args.size()) {
+                member = args[++i];
+            } else {
+                names.push_back(args[i]);
+            }
+        }
+        if (names.empty() || names.size() > 2) {
+            cout << "Usage: unpack <archive> [directory] [--only <member>] [--list]\n";
+            return false;
+        }
+        return explorer.unpackArchive(names[0], names.size() > 1 ? names[1] : "", member, listOnly);
+    }
+    
+    bool handleJobs(const vector<string>&) {
+        return explorer.listJobs();
+    }
+    
+    bool handleFg(const vector<string>& args) {
+        size_t id = 0;
+        if (args.size() > 1 && !parseJobId(args[1], id)) {
+            cout << "Error: fg expects a job number\n";
+            return false;
+        }
+        return explorer.foregroundJob(id);
     }
     
-    void handleExit(const vector<string>& args) {
+    bool handleCancel(const vector<string>& args) {
+        size_t id = 0;
+        if (args.size() < 2 || !parseJobId(args[1], id)) {
+            cout << "Error: cancel command requires a job number\n";
+            return false;
+        }
+        return explorer.cancelJob(id);
+    }
+    
+    bool handleExit(const vector<string>& args) {
+        size_t active = explorer.activeJobs();
+        if (active > 0) {
+            cout << "Cancelling " << active << " background job" << (active == 1 ? "" : "s") << "...\n";
+        }
         running = false;
-        cout << "Exiting file explorer..." << endl;
+        cout << "Exiting file explorer...\n";
+        return true;
     }
     
-    void handleHelp(const vector<string>& args) {
+    bool handleHelp(const vector<string>& args) {
         if (args.size() > 1) {
             string command = args[1];
             if (command == "cd") {
@@ -947,8 +9173,77 @@ private:
                 cout << "cd ~ - Navigate to home directory\n";
             } else if (command == "view") {
                 cout << "view <file_name> - Open file with system application\n";
+                cout << "  Option 3 pages through the file: Enter next, b back, g <n> line, G end, q quit\n";
             } else if (command == "delete") {
                 cout << "delete <name> - Delete a file or directory\n";
+                cout << "delete <name> & - Delete a directory as a background job (see help jobs)\n";
+                cout << "  In --batch mode the confirmation is answered by --yes, and refused without it\n";
+                cout << "  With trash mode on (the default) the item is moved to the trash instead\n";
+            } else if (command == "trash") {
+                cout << "trash - List trashed items, newest first\n";
+                cout << "trash on|off - Move deleted items to the trash, or delete them permanently\n";
+                cout << "  Trashed items are purged in the background after 10 minutes\n";
+            } else if (command == "restore") {
+                cout << "restore <name> - Move the most recently trashed <name> back to its folder\n";
+            } else if (command == "du") {
+                cout << "du [-d depth] [-n count] [directory] - Show disk usage of a directory tree\n";
+                cout << "  Prints apparent and allocated size per directory down to depth (default 1)\n";
+                cout << "  -n lists the largest files; hard-linked files are counted once\n";
+            } else if (command == "find") {
+                cout << "find [directory] [options] - Search a directory tree\n";
+                cout << "  -name <glob>           Name matches a wildcard pattern (*, ?, [a-z])\n";
+                cout << "  -regex <expression>    Whole name matches a regular expression\n";
+                cout << "  -type f|d|l            Files, directories or symlinks only\n";
+                cout << "  -size [+|-]N[c|k|M|G]  Size in 512-byte blocks, bytes, KB, MB or GB\n";
+                cout << "  -mtime [+|-]N          Modified N days ago (+ more, - fewer)\n";
+            } else if (command == "grep") {
+                cout << "grep [options] <pattern> [path] - Search file contents below the current folder\n";
+                cout << "  <pattern> is a regular expression, matched line by line\n";
+                cout << "  -i  Ignore case\n";
+                cout << "  -l  Only list the files that match\n";
+                cout << "  -a  Include hidden files and folders\n";
+                cout << "  Binary files are skipped\n";
+            } else if (command == "index") {
+                cout << "index - Show the saved metadata index\n";
+                cout << "index build [directory] - Index a directory tree (replaces the current index)\n";
+                cout << "index update - Rescan only the directories that changed since the last build\n";
+                cout << "index find <glob> [-type f|d|l] - Search names in the index\n";
+                cout << "index du [-d depth] [directory] - Sizes from the index\n";
+                cout << "  The index is kept in ~/.file-explorer-index and loaded at startup\n";
+            } else if (command == "stats") {
+                cout << "stats - Time, I/O, entries read, stat calls and output per command\n";
+                cout << "stats reset - Clear the collected statistics\n";
+                cout << "stats trace <file> - Append one JSON line per command to <file>\n";
+                cout << "stats trace off - Stop tracing\n";
+                cout << "  FILE_EXPLORER_TRACE=<file> starts tracing at startup\n";
+            } else if (command == "verify") {
+                cout << "verify <manifest> - Re-read and hash every file listed in a manifest\n";
+                cout << "  written by paste --manifest; paths are relative to the manifest\n";
+            } else if (command == "sync") {
+                cout << "sync <source> <destination> - Make destination a copy of source, transferring\n";
+                cout << "  only new and changed files (same size and mtime means unchanged)\n";
+                cout << "sync ... --checksum - Compare files of the same size by content instead\n";
+                cout << "sync ... --delete - Also delete what is not in source\n";
+                cout << "sync ... --dry-run - Only print what would be done\n";
+                cout << "  Changed files of 1 MB and more are patched with a rolling-checksum\n";
+                cout << "  block delta, so only the changed parts are written\n";
+            } else if (command == "pack" || command == "unpack") {
+                cout << "pack <directory> <archive> - Pack a directory tree into one archive file\n";
+                cout << "unpack <archive> [directory] - Extract into a directory (default: here)\n";
+                cout << "unpack ... --only <member> - Extract one file or directory from the archive\n";
+                cout << "unpack <archive> --list - List the archive without extracting it\n";
+                cout << "  Files are read and compressed (built-in LZ) in 1 MB chunks on all\n";
+                cout << "  cores; the index at the end lets unpack read only the chunks it needs\n";
+            } else if (command == "dupes") {
+                cout << "dupes [path] - Find files with identical content under a directory\n";
+                cout << "  Files are compared by size first, then by a hash of their first and\n";
+                cout << "  last 4 KB, and only then hashed in full (XXH64) on all cores\n";
+            } else if (command == "jobs" || command == "fg" || command == "cancel") {
+                cout << "paste & / delete <name> & - Run the paste or delete as a background job\n";
+                cout << "jobs - List background jobs with files, bytes, rate and ETA\n";
+                cout << "fg [id] - Watch a job (default: the newest) until it ends\n";
+                cout << "cancel <id> - Stop a job; a copy keeps only complete files and\n";
+                cout << "  a move removes only sources whose copies are complete\n";
             } else if (command == "edit") {
                 cout << "edit <file_name> - Open file with system application\n";
             } else if (command == "copy") {
@@ -957,6 +9252,10 @@ private:
                 cout << "cut <name> - Cut a file or directory\n";
             } else if (command == "paste") {
                 cout << "paste - Paste copied item into current directory\n";
+                cout << "paste & - Paste as a background job (see help jobs)\n";
+                cout << "paste --verify - Hash every file while it is copied, and sync it to disk\n";
+                cout << "paste --manifest <file> - Same, and save the checksums to <file> for verify\n";
+                cout << "  In --batch mode an existing target is overwritten only with --yes, or kept with --no-clobber\n";
             } else if (command == "mkdir") {
                 cout << "mkdir <name> - Create a new directory\n";
             } else if (command == "touch") {
@@ -976,6 +9275,13 @@ private:
                 cout << "  ls -la  - All files with details\n";
                 cout << "  ls -d   - Directories only\n";
                 cout << "  ls -R   - Recursive listing\n";
+                cout << "  ls -S   - Sort by size, largest first\n";
+                cout << "  ls -t   - Sort by modification time, newest first\n";
+                cout << "  ls -X   - Sort by extension\n";
+                cout << "  ls -v   - Natural order (file2 before file10)\n";
+                cout << "  ls -r   - Reverse the sort order\n";
+                cout << "  ls --limit N - Only the first N entries in sort order (e.g. ls -S --limit 10)\n";
+                cout << "  ls --stream  - Print entries unsorted as they are read (huge directories)\n";
             } else if (command == "dir") {
                 cout << "dir [options] - List files and folders (Windows-style)\n";
                 cout << "  dir      - Basic listing\n";
@@ -983,6 +9289,7 @@ private:
                 cout << "  dir /ad  - Show directories only\n";
                 cout << "  dir /s   - Recursive (subdirectories)\n";
                 cout << "  dir /q   - Detailed list (permissions, size, date)\n";
+                cout << "  dir /on /os /od /oe - Sort by name, size, date or extension\n";
                 cout << "Can combine with ls flags: dir -la, dir /a /q\n";
             } else {
                 cout << "No help available for '" << command << "'\n";
@@ -996,9 +9303,24 @@ private:
             cout << "║ view <file>       - Open file with system app                     ║\n";
             cout << "║ edit <file>       - Edit file with system app                     ║\n";
             cout << "║ delete <name>     - Delete file or directory                      ║\n";
+            cout << "║ trash [on|off]    - List trash or toggle trash mode               ║\n";
+            cout << "║ restore <name>    - Restore item from trash                       ║\n";
+            cout << "║ du [options]      - Show disk usage of a directory tree           ║\n";
+            cout << "║ find [options]    - Search for files and folders                  ║\n";
+            cout << "║ grep <pattern>    - Search file contents                          ║\n";
+            cout << "║ dupes [path]      - Find duplicate files                          ║\n";
+            cout << "║ index [action]    - Build or query the metadata index             ║\n";
+            cout << "║ stats [action]    - Per-command timings, I/O and trace file       ║\n";
+            cout << "║ jobs              - List background paste/delete jobs             ║\n";
+            cout << "║ fg [id]           - Watch a background job until it ends          ║\n";
+            cout << "║ cancel <id>       - Stop a background job                         ║\n";
             cout << "║ copy <name>       - Copy file or directory                        ║\n";
             cout << "║ cut <name>        - Cut file or directory                         ║\n";
             cout << "║ paste             - Paste copied/cut item                         ║\n";
+            cout << "║ verify <manifest> - Check files against a paste manifest          ║\n";
+            cout << "║ sync <src> <dst>  - Copy only what changed between trees          ║\n";
+            cout << "║ pack <dir> <file> - Pack a directory into an archive              ║\n";
+            cout << "║ unpack <file>     - Extract or list an archive                    ║\n";
             cout << "║ mkdir <name>      - Create new directory                          ║\n";
             cout << "║ touch <name>      - Create new file                               ║\n";
             cout << "║ clear             - Clear screen                                  ║\n";
@@ -1006,25 +9328,43 @@ private:
             cout << "║ help [command]    - Show help for specific command                ║\n";
             cout << "╚═══════════════════════════════════════════════════════════════════╝\n";
         }
+        return true;
     }
     
-    void handleClear(const vector<string>& args) {
+    bool handleClear(const vector<string>& args) {
         clearScreen();
         drawBoxHeader("Console Based File Explorer");
+        return true;
     }
     
-    void handleLs(const vector<string>& args) {
+    bool handleLs(const vector<string>& args) {
         bool showHidden = false;
         bool longFormat = false;
         bool dirsOnly = false;
         bool recursive = false;
+        bool streaming = false;
+        size_t limit = SIZE_MAX;
+        SortOptions order;
         
         // Parse flags - support both Linux (-) and Windows (/) style
         for (size_t i = 1; i < args.size(); i++) {
             string arg = args[i];
             
+            // Long options for very large directories
+            if (arg == "--stream") {
+                streaming = true;
+            } else if (arg == "--limit") {
+                char* end = nullptr;
+                long long value = i + 1 < args.size() ? strtoll(args[i + 1].c_str(), &end, 10) : -1;
+                if (value < 0 || *end != '\0') {
+                    cout << "Error: --limit expects a number\n";
+                    return false;
+                }
+                limit = static_cast<size_t>(value);
+                i++;
+            }
             // Linux-style flags (e.g., -la, -al, -R)
-            if (arg[0] == '-' && arg.length() > 1) {
+            else if (arg[0] == '-' && arg.length() > 1) {
                 for (size_t j = 1; j < arg.length(); j++) {
                     switch (arg[j]) {
                         case 'a':
@@ -1039,9 +9379,24 @@ private:
                         case 'R':
                             recursive = true;
                             break;
+                        case 'S':
+                            order.mode = SortMode::Size;
+                            break;
+                        case 't':
+                            order.mode = SortMode::Time;
+                            break;
+                        case 'X':
+                            order.mode = SortMode::Extension;
+                            break;
+                        case 'v':
+                            order.mode = SortMode::Natural;
+                            break;
+                        case 'r':
+                            order.reverse = true;
+                            break;
                         default:
-                            cout << "Unknown option: -" << arg[j] << endl;
-                            return;
+                            cout << "Unknown option: -" << arg[j] << "\n";
+                            return false;
                     }
                 }
             }
@@ -1058,55 +9413,132 @@ private:
                     recursive = true;
                 } else if (flag == "q") {
                     longFormat = true;
+                } else if (flag == "on" || flag == "os" || flag == "od" || flag == "oe") {
+                    // dir sorts sizes and dates ascending, ls descending
+                    order.mode = flag == "os" ? SortMode::Size : flag == "od" ? SortMode::Time :
+                                 flag == "oe" ? SortMode::Extension : SortMode::Name;
+                    order.reverse = flag == "os" || flag == "od";
                 } else {
-                    cout << "Unknown option: /" << arg.substr(1) << endl;
-                    return;
+                    cout << "Unknown option: /" << arg.substr(1) << "\n";
+                    return false;
                 }
             }
         }
         
-        explorer.listDirectory(showHidden, longFormat, dirsOnly, recursive);
+        if (recursive && (streaming || limit != SIZE_MAX)) {
+            cout << "Error: --stream and --limit apply to a single directory, not -R\n";
+            return false;
+        }
+        return explorer.listDirectory(showHidden, longFormat, dirsOnly, recursive, order, limit, streaming);
     }
     
 public:
-    CommandHandler(FileExplorer& explorer) : explorer(explorer), running(true) {}
+    CommandHandler(FileExplorer& explorer) : explorer(explorer), running(true) {
+        // Lets a whole session be traced without typing `stats trace`
+        const char* tracePath = getenv("FILE_EXPLORER_TRACE");
+        if (tracePath && *tracePath && !profile.openTrace(tracePath)) {
+            setConsoleColor(COLOR_RED);
+            cout << "Error: cannot open trace file " << tracePath << "\n";
+            setConsoleColor(COLOR_RESET);
+        }
+    }
     
-    void processCommand(const string& commandLine) {
+    // Exit status of one command: 0 on success, 1 when it failed and 127
+    // when there is no such command (the shell conventions)
+    int processCommand(const string& commandLine) {
         vector<string> args = splitString(commandLine, ' ');
         if (args.empty()) {
-            return;
+            return 0;
+        }
+        
+        // A trailing & starts the command as a background job
+        bool background = args.size() > 1 && args.back() == "&";
+        if (background) {
+            args.pop_back();
+        }
+        
+        auto start = chrono::steady_clock::now();
+        Metrics::Snapshot before = Metrics::snapshot();
+        int status = dispatch(args, background);
+        if (status != 127) {
+            double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            profile.record(args[0], commandLine, status, millis, Metrics::since(before));
+        }
+        return status;
+    }
+    
+    // Runs one command and returns its exit status; only paste and delete
+    // can be started in the background
+    int dispatch(const vector<string>& args, bool background) {
+        const string& command = args[0];
+        bool succeeded = true;
+        bool isDelete = command == "delete" || command == "del" || command == "rm";
+        if (background && command != "paste" && !isDelete) {
+            cout << "Error: '" << command << "' cannot run in the background\n";
+            return 1;
         }
         
-        string command = args[0];
         if (command == "cd") {
-            handleCd(args);
+            succeeded = handleCd(args);
         } else if (command == "view") {
-            handleView(args);
+            succeeded = handleView(args);
         } else if (command == "delete" || command == "del" || command == "rm") {
-            handleDelete(args);
+            succeeded = handleDelete(args, background);
+        } else if (command == "trash") {
+            succeeded = handleTrash(args);
+        } else if (command == "restore") {
+            succeeded = handleRestore(args);
+        } else if (command == "du") {
+            succeeded = handleDu(args);
+        } else if (command == "find") {
+            succeeded = handleFind(args);
+        } else if (command == "grep") {
+            succeeded = handleGrep(args);
+        } else if (command == "dupes") {
+            succeeded = handleDupes(args);
+        } else if (command == "verify") {
+            succeeded = handleVerify(args);
+        } else if (command == "sync") {
+            succeeded = handleSync(args);
+        } else if (command == "pack") {
+            succeeded = handlePack(args);
+        } else if (command == "unpack") {
+            succeeded = handleUnpack(args);
+        } else if (command == "index") {
+            succeeded = handleIndex(args);
         } else if (command == "edit") {
-            handleEdit(args);
+            succeeded = handleEdit(args);
         } else if (command == "copy" || command == "cp") {
-            handleCopy(args);
+            succeeded = handleCopy(args);
         } else if (command == "cut") {
-            handleCut(args);
+            succeeded = handleCut(args);
         } else if (command == "paste") {
-            handlePaste(args);
+            succeeded = handlePaste(args, background);
         } else if (command == "mkdir") {
-            handleMkdir(args);
+            succeeded = handleMkdir(args);
         } else if (command == "touch") {
-            handleTouch(args);
+            succeeded = handleTouch(args);
         } else if (command == "exit" || command == "quit") {
-            handleExit(args);
+            succeeded = handleExit(args);
         } else if (command == "help") {
-            handleHelp(args);
+            succeeded = handleHelp(args);
         } else if (command == "clear" || command == "cls") {
-            handleClear(args);
+            succeeded = handleClear(args);
         } else if (command == "ls" || command == "dir") {
-            handleLs(args);
+            succeeded = handleLs(args);
+        } else if (command == "stats") {
+            succeeded = handleStats(args);
+        } else if (command == "jobs") {
+            succeeded = handleJobs(args);
+        } else if (command == "fg") {
+            succeeded = handleFg(args);
+        } else if (command == "cancel") {
+            succeeded = handleCancel(args);
         } else {
-            cout << "Unknown command: " << command << ". Type 'help' for available commands." << endl;
+            cout << "Unknown command: " << command << ". Type 'help' for available commands.\n";
+            return 127;
         }
+        return succeeded ? 0 : 1;
     }
     
     bool isRunning() const { return running; }
@@ -1115,11 +9547,19 @@ public:
         string command;
         
         while (running) {
+            explorer.reportFinishedJobs();
+            
             setConsoleColor(COLOR_YELLOW);
             cout << explorer.getCurrentPath() << "> ";
             setConsoleColor(COLOR_RED);
             
-            getline(cin, command);
+            // End of input (Ctrl+D, or a pipe that ran dry) ends the session
+            if (!getline(cin, command)) {
+                setConsoleColor(COLOR_RESET);
+                cout << "\n";
+                running = false;
+                break;
+            }
             
             setConsoleColor(COLOR_RESET);
             
@@ -1128,9 +9568,496 @@ public:
             }
         }
     }
+    
+    // Runs commands from `input` with no prompt, one per line; empty lines
+    // and lines starting with # are skipped. Every command's status goes to
+    // stderr as "<line>\t<status>\t<command>". Returns 0 when all commands
+    // succeeded, otherwise the status of the last one that failed.
+    int runBatch(istream& input, bool stopOnError) {
+        string command;
+        size_t lineNumber = 0;
+        int result = 0;
+        
+        while (running && getline(input, command)) {
+            lineNumber++;
+            if (!command.empty() && command.back() == '\r') command.pop_back();
+            if (command.empty() || command[0] == '#') {
+                continue;
+            }
+            
+            explorer.reportFinishedJobs();
+            int status = processCommand(command);
+            cerr << lineNumber << '\t' << status << '\t' << command << '\n';
+            if (status != 0) {
+                result = status;
+                if (stopOnError) break;
+            }
+        }
+        
+        // Background jobs belong to the script: wait for them, unless it ended with exit
+        if (running && !explorer.waitForJobs() && result == 0) {
+            result = 1;
+        }
+        cout.flush();
+        return result;
+    }
+};
+
+// Discards everything written to it, so benchmarks time the work and not the terminal
+class NullBuffer : public streambuf {
+protected:
+    int_type overflow(int_type ch) override { return traits_type::not_eof(ch); }
+    streamsize xsputn(const char*, streamsize count) override { return count; }
+};
+
+// Peak resident set size of the process. Linux can reset the peak, so each
+// benchmark reports its own; elsewhere the value only ever grows.
+class PeakMemory {
+public:
+    static void reset() {
+        #ifdef __linux__
+        int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            if (::write(fd, "5", 1) < 0) {
+                // Older kernels: the peak just keeps growing
+            }
+            close(fd);
+        }
+        #endif
+    }
+    
+    static uint64_t kilobytes() {
+        #if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return counters.PeakWorkingSetSize / 1024;
+        }
+        return 0;
+        #elif defined(__linux__)
+        ifstream status("/proc/self/status");
+        string line;
+        while (getline(status, line)) {
+            if (line.compare(0, 6, "VmHWM:") == 0) {
+                return stoull(line.substr(6));
+            }
+        }
+        return 0;
+        #else
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        #ifdef __APPLE__
+        return static_cast<uint64_t>(usage.ru_maxrss) / 1024;    // bytes on macOS
+        #else
+        return static_cast<uint64_t>(usage.ru_maxrss);
+        #endif
+        #endif
+    }
+};
+
+// Writes one JSON document with a record per benchmark: ops/sec over the
+// timed work only, p50/p99 latency and peak RSS while it ran. Records are
+// flushed as they finish, so a long run shows progress.
+class BenchmarkReport {
+private:
+    ostream out;
+    bool first = true;
+    
+    static double percentile(const vector<double>& sorted, double fraction) {
+        size_t rank = static_cast<size_t>(ceil(fraction * static_cast<double>(sorted.size())));
+        return sorted[rank > 0 ? rank - 1 : 0];
+    }
+    
+public:
+    BenchmarkReport(streambuf* target, const string& program, int scale, const fs::path& root) : out(target) {
+        out << "{\n  \"program\": " << jsonQuote(program) << ",\n  \"scale\": " << scale
+            << ",\n  \"root\": " << jsonQuote(root.string()) << ",\n  \"benchmarks\": [";
+    }
+    
+    void add(const string& name, vector<double> millis, uint64_t peakKilobytes) {
+        if (millis.empty()) {
+            return;
+        }
+        sort(millis.begin(), millis.end());
+        double total = 0;
+        for (double sample : millis) total += sample;
+        double opsPerSecond = total > 0 ? static_cast<double>(millis.size()) * 1000.0 / total : 0;
+        
+        out << (first ? "\n" : ",\n") << "    {\"name\": " << jsonQuote(name) << ", \"ops\": " << millis.size()
+            << fixed << setprecision(1) << ", \"ops_per_sec\": " << opsPerSecond
+            << setprecision(3) << ", \"p50_ms\": " << percentile(millis, 0.50) << ", \"p99_ms\": " << percentile(millis, 0.99)
+            << ", \"peak_rss_kb\": " << peakKilobytes << "}";
+        out.flush();
+        first = false;
+    }
+    
+    // Pass/fail record of a syscall budget
+    void addCheck(const string& name, uint64_t statCalls, uint64_t budget, uint64_t entries) {
+        out << (first ? "\n" : ",\n") << "    {\"name\": " << jsonQuote(name) << ", \"entries\": " << entries
+            << ", \"stat_calls\": " << statCalls << ", \"budget\": " << budget
+            << ", \"passed\": " << (statCalls <= budget ? "true" : "false") << "}";
+        out.flush();
+        first = false;
+    }
+    
+    void finish() {
+        out << "\n  ]\n}\n";
+        out.flush();
+    }
+};
+
+// --bench: builds reproducible synthetic trees (wide, deep, many tiny files,
+// a few huge ones) in a temporary directory and times the explorer on them.
+// Answers to prompts are fed through cin and output is discarded while an
+// operation is timed. JSON goes to stdout, progress to stderr. The stat
+// calls of the listings are checked against fixed budgets, and a run that
+// exceeds one exits with status 1.
+class BenchmarkSuite {
+private:
+    fs::path root;
+    int scale;
+    string filter;
+    mt19937_64 random{42};      // fixed seed: every run builds the same trees
+    NullBuffer nullBuffer;
+    istringstream answers;
+    BenchmarkReport report;
+    string deepPath;
+    bool overBudget = false;
+    
+    bool selected(const string& name) const {
+        return filter.empty() || name.find(filter) != string::npos;
+    }
+    
+    // Lines of random lowercase letters, `bytes` long in total
+    void writeFile(const fs::path& path, uint64_t bytes) {
+        ofstream file(path, ios::binary);
+        if (!file) {
+            throw fs::filesystem_error("Cannot create file", path, error_code(errno, system_category()));
+        }
+        string line;
+        uint64_t written = 0;
+        while (written < bytes) {
+            size_t length = static_cast<size_t>(min<uint64_t>(20 + random() % 81, bytes - written));
+            line.resize(length);
+            for (size_t i = 0; i + 1 < length; i++) line[i] = static_cast<char>('a' + random() % 26);
+            line[length - 1] = '\n';
+            file.write(line.data(), static_cast<streamsize>(length));
+            written += length;
+        }
+    }
+    
+    void generate() {
+        fs::path wide = root / "wide";
+        fs::create_directories(wide);
+        for (int i = 0; i < 20000 * scale; i++) {
+            writeFile(wide / ("file" + to_string(i) + ".txt"), random() % 4096);
+        }
+        
+        fs::path deep = root / "deep";
+        deepPath = "deep";
+        for (int level = 0; level < 200; level++) {
+            deep /= "level" + to_string(level);
+            deepPath += "/level" + to_string(level);
+            fs::create_directories(deep);
+            writeFile(deep / "a.txt", 256);
+            writeFile(deep / "b.txt", 256);
+        }
+        
+        for (int i = 0; i < 20 * scale; i++) {
+            fs::path dir = root / "tiny" / ("dir" + to_string(i));
+            fs::create_directories(dir);
+            for (int j = 0; j < 500; j++) {
+                writeFile(dir / ("note" + to_string(j) + ".txt"), 64 + random() % 960);
+            }
+        }
+        
+        fs::create_directories(root / "huge");
+        for (int i = 0; i < 4; i++) {
+            writeFile(root / "huge" / ("big" + to_string(i) + ".txt"), static_cast<uint64_t>(scale) * 16 * 1024 * 1024);
+        }
+        
+        fs::create_directories(root / "scratch");
+    }
+    
+    // Runs one operation with output discarded and `answer` as its input
+    template <typename Operation>
+    double timed(Operation&& operation, const char* answer = "") {
+        struct Redirect {
+            streambuf* output;
+            streambuf* input;
+            ~Redirect() {
+                cout.rdbuf(output);
+                cin.rdbuf(input);
+            }
+        };
+        answers.str(answer);
+        answers.clear();
+        Redirect redirect{cout.rdbuf(&nullBuffer), cin.rdbuf(answers.rdbuf())};
+        
+        auto start = chrono::steady_clock::now();
+        operation();
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+    
+    template <typename Operation>
+    void measure(const string& name, int iterations, Operation&& operation, const char* answer = "") {
+        if (!selected(name)) {
+            return;
+        }
+        cerr << "  " << name << "\n";
+        PeakMemory::reset();
+        vector<double> samples;
+        for (int i = 0; i < iterations; i++) {
+            samples.push_back(timed(operation, answer));
+        }
+        report.add(name, move(samples), PeakMemory::kilobytes());
+    }
+    
+    // Whether getdents reports entry types here; without them every entry
+    // needs a stat just to tell files from directories
+    static bool reportsTypes(const fs::path& directory) {
+        #ifdef _WIN32
+        (void)directory;
+        return true;
+        #else
+        int dirfd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirfd < 0) return false;
+        bool typed = true;
+        DirectoryReader::scan(dirfd, directory, [&](const char*, unsigned char type) {
+            typed = type != DT_UNKNOWN;
+            return typed;
+        });
+        close(dirfd);
+        return typed;
+        #endif
+    }
+    
+    // One listing may stat each entry at most `perEntry` times, plus once for
+    // the directory itself (the listing cache checks its identity)
+    template <typename Operation>
+    void checkStats(const string& name, uint64_t entries, uint64_t perEntry, Operation&& operation) {
+        if (!selected(name)) {
+            return;
+        }
+        cerr << "  " << name << "\n";
+        Metrics::Snapshot before = Metrics::snapshot();
+        timed(operation);
+        uint64_t statCalls = Metrics::since(before)[static_cast<size_t>(Metric::StatCalls)];
+        uint64_t budget = entries * perEntry + 1;
+        report.addCheck(name, statCalls, budget, entries);
+        if (statCalls > budget) {
+            cerr << "  " << name << " made " << statCalls << " stat calls, budget " << budget << "\n";
+            overBudget = true;
+        }
+    }
+    
+    // Runs before anything is cached. Each listing of `wide` asks for more
+    // than the one before it, so none is answered by the listing cache.
+    void checkListingStats(FileExplorer& explorer) {
+        uint64_t typeStats = reportsTypes(root / "wide") ? 0 : 1;
+        explorer.navigate("tiny");
+        checkStats("statCalls/ls-directories", 20ull * scale, typeStats, [&] { explorer.listDirectory(); });
+        explorer.navigate("~");
+        
+        uint64_t files = 20000ull * scale;
+        explorer.navigate("wide");
+        checkStats("statCalls/ls-d", files, typeStats, [&] { explorer.listDirectory(false, false, true); });
+        checkStats("statCalls/ls", files, 1, [&] { explorer.listDirectory(); });
+        checkStats("statCalls/ls-l", files, 1, [&] { explorer.listDirectory(false, true); });
+        explorer.navigate("~");
+    }
+    
+    void benchListing(FileExplorer& explorer) {
+        explorer.navigate("wide");
+        measure("listDirectory/wide", 30, [&] { explorer.listDirectory(); });
+        measure("listDirectory/wide-long", 10, [&] { explorer.listDirectory(false, true); });
+        measure("listDirectory/wide-top100-by-size", 10, [&] {
+            explorer.listDirectory(false, false, false, false, SortOptions{SortMode::Size, false}, 100);
+        });
+        explorer.navigate("~");
+        
+        explorer.navigate("tiny");
+        measure("listDirectory/tiny-recursive", 10, [&] { explorer.listDirectory(false, false, false, true); });
+        explorer.navigate("~");
+    }
+    
+    void benchNavigation(FileExplorer& explorer) {
+        measure("navigate/deep", 100, [&] {
+            explorer.navigate(deepPath);
+            explorer.navigate("~");
+        });
+        explorer.navigate(deepPath);
+        measure("navigate/parent", 150, [&] { explorer.navigate(".."); });
+        explorer.navigate("~");
+    }
+    
+    // Every round pastes a copy into the empty scratch directory and removes
+    // it again; deleteItem and plain remove_all are timed on the same trees
+    void benchTransfers(FileExplorer& explorer) {
+        const int rounds = 5;
+        fs::path copy = root / "scratch" / "tiny";
+        timed([&] { explorer.copyItem("tiny"); });
+        explorer.navigate("scratch");
+        
+        if (selected("pasteItem/tiny") || selected("deleteItem/tiny")) {
+            cerr << "  pasteItem/tiny, deleteItem/tiny\n";
+            PeakMemory::reset();
+            vector<double> pasted, deleted;
+            for (int i = 0; i < rounds; i++) {
+                pasted.push_back(timed([&] { explorer.pasteItem(); }));
+                deleted.push_back(timed([&] { explorer.deleteItem("tiny"); }, "y\n"));
+            }
+            uint64_t peak = PeakMemory::kilobytes();
+            if (selected("pasteItem/tiny")) report.add("pasteItem/tiny", move(pasted), peak);
+            if (selected("deleteItem/tiny")) report.add("deleteItem/tiny", move(deleted), peak);
+        }
+        
+        if (selected("remove_all/tiny")) {
+            cerr << "  remove_all/tiny\n";
+            PeakMemory::reset();
+            vector<double> removed;
+            for (int i = 0; i < rounds; i++) {
+                timed([&] { explorer.pasteItem(); });
+                removed.push_back(timed([&] { fs::remove_all(copy); }));
+            }
+            report.add("remove_all/tiny", move(removed), PeakMemory::kilobytes());
+        }
+        
+        explorer.navigate("~");
+        timed([&] { explorer.copyItem("huge"); });
+        explorer.navigate("scratch");
+        if (selected("pasteItem/huge")) {
+            cerr << "  pasteItem/huge\n";
+            PeakMemory::reset();
+            vector<double> pasted;
+            for (int i = 0; i < 3; i++) {
+                pasted.push_back(timed([&] { explorer.pasteItem(); }));
+                fs::remove_all(root / "scratch" / "huge");
+            }
+            report.add("pasteItem/huge", move(pasted), PeakMemory::kilobytes());
+        }
+        explorer.navigate("~");
+    }
+    
+    void benchViewing(FileExplorer& explorer) {
+        explorer.navigate("huge");
+        measure("viewFile/huge", 3, [&] { explorer.viewFile("big0.txt"); }, "1\n");
+        explorer.navigate("~");
+    }
+    
+public:
+    BenchmarkSuite(const fs::path& root, int scale, const string& filter)
+        : root(root), scale(scale), filter(filter), report(cout.rdbuf(), "FileExplorer", scale, root) {}
+    
+    int run() {
+        try {
+            cerr << "Generating trees in " << root.string() << "\n";
+            generate();
+            
+            // The explorer starts in the bench root, and its trash and index
+            // files land there too
+            #ifdef _WIN32
+            _putenv_s("USERPROFILE", root.string().c_str());
+            #else
+            setenv("HOME", root.c_str(), 1);
+            #endif
+            FileExplorer explorer;
+            timed([&] { explorer.setTrashMode(false); });
+            
+            checkListingStats(explorer);
+            benchListing(explorer);
+            benchNavigation(explorer);
+            benchTransfers(explorer);
+            benchViewing(explorer);
+        } catch (const exception& e) {
+            cerr << "Benchmark failed: " << e.what() << "\n";
+            report.finish();
+            error_code ignored;
+            fs::remove_all(root, ignored);
+            return 1;
+        }
+        report.finish();
+        fs::remove_all(root);
+        return overBudget ? 1 : 0;
+    }
 };
 
-int main() {
+int runBenchmarks(int argc, char* argv[]) {
+    int scale = 1;
+    string filter;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--scale" && i + 1 < argc) {
+            scale = max(1, atoi(argv[++i]));
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            cerr << "Usage: " << argv[0] << " --bench [--scale N] [--filter NAME]\n";
+            return 2;
+        }
+    }
+    
+    fs::path root = fs::temp_directory_path() /
+                    ("file-explorer-bench-" + to_string(chrono::steady_clock::now().time_since_epoch().count()));
+    BenchmarkSuite suite(root, scale, filter);
+    return suite.run();
+}
+
+// --batch: runs commands from a script (or stdin) without prompts or the
+// banner. The exit status is 0 only when every command succeeded.
+int runBatchMode(int argc, char* argv[]) {
+    string scriptPath;
+    bool assumeYes = false;
+    bool noClobber = false;
+    bool stopOnError = false;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--yes" || arg == "-y") {
+            assumeYes = true;
+        } else if (arg == "--no-clobber") {
+            noClobber = true;
+        } else if (arg == "--stop-on-error") {
+            stopOnError = true;
+        } else if (scriptPath.empty() && (arg == "-" || arg[0] != '-')) {
+            scriptPath = arg;
+        } else {
+            cerr << "Usage: " << argv[0] << " --batch [script|-] [--yes] [--no-clobber] [--stop-on-error]\n";
+            return 2;
+        }
+    }
+    
+    // Commands are read line by line with no prompt to flush in between
+    ios::sync_with_stdio(false);
+    cin.tie(nullptr);
+    
+    ifstream script;
+    if (!scriptPath.empty() && scriptPath != "-") {
+        script.open(scriptPath);
+        if (!script) {
+            cerr << "Error: Could not open script '" << scriptPath << "'\n";
+            return 2;
+        }
+    }
+    
+    setupConsole();
+    
+    FileExplorer explorer;
+    explorer.setBatchMode(assumeYes, noClobber);
+    
+    CommandHandler handler(explorer);
+    int status = handler.runBatch(script.is_open() ? static_cast<istream&>(script) : cin, stopOnError);
+    setConsoleColor(COLOR_RESET);
+    cout.flush();
+    return status;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        return runBenchmarks(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--batch") {
+        return runBatchMode(argc, argv);
+    }
+    
     setupConsole();
     clearScreen();
     
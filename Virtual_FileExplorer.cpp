@@ -6,57 +6,210 @@
 #include <cstdlib>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <cerrno>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <random>
 
+namespace fs = std::filesystem;
 using namespace std;
 
 // Cross-platform console color codes
 #ifdef _WIN32
     #include <windows.h>
+    #include <psapi.h>
     #include <direct.h>
+    #include <io.h>
+    #ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+    #define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+    #endif
     #define mkdir_p(path) _mkdir(path)
     
-    void setConsoleColor(int color) {
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-        SetConsoleTextAttribute(hConsole, color);
-    }
     #define COLOR_RESET 15
     #define COLOR_GREEN 10
     #define COLOR_RED 12
     #define COLOR_YELLOW 14
     #define COLOR_CYAN 11
-    void setupConsole() {
-        SetConsoleOutputCP(CP_UTF8);
-        SetConsoleCP(CP_UTF8);
-    }
-    void clearScreen() {
-        system("cls");
-    }
 #else
+    #include <unistd.h>
+    #include <sys/resource.h>
     #define mkdir_p(path) mkdir(path, 0777)
     
-    // ANSI color codes for Linux/Unix
-    void setConsoleColor(int color) {
-        switch(color) {
-            case 10: cout << "\033[1;32m"; break; // Green
-            case 12: cout << "\033[1;31m"; break; // Red
-            case 14: cout << "\033[1;33m"; break; // Yellow
-            case 11: cout << "\033[1;36m"; break; // Cyan
-            case 15: cout << "\033[0m"; break;    // Reset
-            default: cout << "\033[0m"; break;
-        }
-    }
     #define COLOR_RESET 15
     #define COLOR_GREEN 10
     #define COLOR_RED 12
     #define COLOR_YELLOW 14
     #define COLOR_CYAN 11
-    void setupConsole() {
-        // UTF-8 is typically default on Linux
+#endif
+
+// Stream buffer installed under cout. Output accumulates in one reusable
+// buffer and reaches the terminal in a single write when cout is flushed
+// (cin is tied to cout, so that happens once per prompt or pager page).
+// Color changes are applied lazily, so back-to-back switches collapse into
+// one escape, and escapes are dropped when stdout is not a terminal.
+class ConsoleRenderer : public streambuf {
+private:
+    static constexpr size_t flushThreshold = 64 * 1024;
+    
+    string buffer;
+    streambuf* original = nullptr;
+    int pendingColor = COLOR_RESET;
+    int activeColor = -1;
+    bool colorsEnabled = false;
+    #ifdef _WIN32
+    bool useConsoleApi = false;     // console without ANSI escape support
+    #endif
+    
+    static const char* escapeFor(int color) {
+        switch (color) {
+            case COLOR_GREEN: return "\033[1;32m";
+            case COLOR_RED: return "\033[1;31m";
+            case COLOR_YELLOW: return "\033[1;33m";
+            case COLOR_CYAN: return "\033[1;36m";
+            default: return "\033[0m";
+        }
     }
-    void clearScreen() {
-        system("clear");
+    
+    void applyColor() {
+        if (pendingColor == activeColor) {
+            return;
+        }
+        activeColor = pendingColor;
+        if (!colorsEnabled) {
+            return;
+        }
+        
+        #ifdef _WIN32
+        if (useConsoleApi) {
+            writeBuffer();
+            SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), static_cast<WORD>(activeColor));
+            return;
+        }
+        #endif
+        buffer += escapeFor(activeColor);
     }
-#endif
+    
+    void writeBuffer() {
+        if (buffer.empty()) {
+            return;
+        }
+        
+        #ifdef _WIN32
+        fwrite(buffer.data(), 1, buffer.size(), stdout);
+        fflush(stdout);
+        #else
+        const char* data = buffer.data();
+        size_t remaining = buffer.size();
+        while (remaining > 0) {
+            ssize_t written = ::write(STDOUT_FILENO, data, remaining);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            data += written;
+            remaining -= static_cast<size_t>(written);
+        }
+        #endif
+        buffer.clear();     // keeps its capacity for the next command
+    }
+    
+protected:
+    int_type overflow(int_type ch) override {
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            applyColor();
+            buffer += traits_type::to_char_type(ch);
+            if (buffer.size() >= flushThreshold) writeBuffer();
+        }
+        return traits_type::not_eof(ch);
+    }
+    
+    streamsize xsputn(const char* text, streamsize count) override {
+        applyColor();
+        buffer.append(text, static_cast<size_t>(count));
+        if (buffer.size() >= flushThreshold) writeBuffer();
+        return count;
+    }
+    
+    int sync() override {
+        // Flush points are where the user sees the terminal, so the pending
+        // color (e.g. red for typed input) has to be in effect there
+        applyColor();
+        writeBuffer();
+        return 0;
+    }
+    
+public:
+    ConsoleRenderer() {
+        buffer.reserve(flushThreshold);
+    }
+    
+    ~ConsoleRenderer() {
+        uninstall();
+    }
+    
+    static ConsoleRenderer& instance() {
+        static ConsoleRenderer renderer;
+        return renderer;
+    }
+    
+    void install() {
+        if (original) {
+            return;
+        }
+        #ifdef _WIN32
+        colorsEnabled = _isatty(_fileno(stdout)) != 0;
+        DWORD mode = 0;
+        HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+        if (colorsEnabled && GetConsoleMode(console, &mode)) {
+            useConsoleApi = !SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+        }
+        #else
+        colorsEnabled = isatty(STDOUT_FILENO) != 0;
+        #endif
+        original = cout.rdbuf(this);
+    }
+    
+    void uninstall() {
+        if (original) {
+            pendingColor = COLOR_RESET;
+            sync();
+            cout.rdbuf(original);
+            original = nullptr;
+        }
+    }
+    
+    void setColor(int color) {
+        pendingColor = color;
+    }
+    
+    bool isTerminal() const { return colorsEnabled; }
+};
+
+void setConsoleColor(int color) {
+    ConsoleRenderer::instance().setColor(color);
+}
+
+void setupConsole() {
+    #ifdef _WIN32
+    SetConsoleOutputCP(CP_UTF8);
+    SetConsoleCP(CP_UTF8);
+    #endif
+    ConsoleRenderer::instance().install();
+}
+
+void clearScreen() {
+    #ifdef _WIN32
+    cout.flush();
+    system("cls");
+    #else
+    // Same sequence `clear` emits, without starting a process
+    if (ConsoleRenderer::instance().isTerminal()) {
+        cout << "\033[H\033[2J\033[3J";
+    }
+    #endif
+}
 
 // Helper function to create directory recursively
 bool createDirectoryRecursive(const string& path) {
@@ -141,7 +294,7 @@ public:
     void setContent(const string& newContent) { content = newContent; }
     
     void display() const override {
-        cout << "📄  " << name << extension << endl;
+        cout << "📄  " << name << extension << "\n";
     }
     
     void viewContent() const {
@@ -149,8 +302,8 @@ public:
         cout << setfill('=') << setw(50) << "" << "\n";
         cout << setfill(' ') << setw(25) << "Content of " << name << extension << "\n";
         cout << setfill('=') << setw(50) << "" << "\n";
-        cout << content << endl;
-        cout << "================== End of file ===================" << endl;
+        cout << content << "\n";
+        cout << "================== End of file ===================\n";
         setConsoleColor(COLOR_RESET);
     }
     
@@ -170,7 +323,7 @@ public:
         if (lastSlash != string::npos) {
             string dirPath = fullPath.substr(0, lastSlash);
             if (!createDirectoryRecursive(dirPath)) {
-                cout << "Error: Could not create directory for " << fullPath << endl;
+                cout << "Error: Could not create directory for " << fullPath << "\n";
                 return;
             }
         }
@@ -180,9 +333,9 @@ public:
         if (file.is_open()) {
             file << content;
             file.close();
-            cout << "Saved: " << fullPath << endl;
+            cout << "Saved: " << fullPath << "\n";
         } else {
-            cout << "Error: Could not save file " << fullPath << endl;
+            cout << "Error: Could not save file " << fullPath << "\n";
         }
     }
 };
@@ -270,11 +423,11 @@ public:
             index++;
             item->display();
         }
-        cout << endl;
+        cout << "\n";
     }
     
     void display() const override {
-        cout << "📁  " << name << endl;
+        cout << "📁  " << name << "\n";
     }
     
     FileSystemObject* clone() const override {
@@ -295,13 +448,13 @@ public:
     
     void saveHierarchy(ofstream& file, int depth = 0) const {
         string indent(depth * 2, ' ');
-        file << indent << "📁 " << name << endl;
+        file << indent << "📁 " << name << "\n";
         for (auto item : contents) {
             if (item->isDirectory()) {
                 Directory* dir = static_cast<Directory*>(item);
                 dir->saveHierarchy(file, depth + 1);
             } else {
-                file << indent << "  📄 " << item->getName() << endl;
+                file << indent << "  📄 " << item->getName() << "\n";
             }
         }
     }
@@ -319,9 +472,13 @@ private:
         
         while (true) {
             setConsoleColor(COLOR_CYAN);
-            getline(cin, line);
+            bool gotLine = static_cast<bool>(getline(cin, line));
             setConsoleColor(COLOR_RESET);
             
+            // Input ran out before a save command: keep the old content
+            if (!gotLine) {
+                return file->getContent();
+            }
             if (line == ":w" || line == ":save") {
                 return newContent;
             } else if (line == ":q" || line == ":quit") {
@@ -350,13 +507,13 @@ public:
     
     void editContent() {
         setConsoleColor(COLOR_RED);
-        cout << endl << "Editing " << file->getName() << file->getExtension() << endl;
+        cout << "\n" << "Editing " << file->getName() << file->getExtension() << "\n";
         setConsoleColor(COLOR_YELLOW);
         cout << setfill('=') << setw(50) << "" << "\n";
         cout << setfill(' ') << setw(30) << "Current Content of " << file->getName() << file->getExtension() << "\n";
         cout << setfill('=') << setw(50) << "" << "\n";
-        cout << file->getContent() << endl;
-        cout << "================== End of file ===================" << endl;
+        cout << file->getContent() << "\n";
+        cout << "================== End of file ===================\n";
         setConsoleColor(COLOR_RESET);
         
         string newContent = readMultilineInput();
@@ -370,6 +527,24 @@ private:
     Directory* rootDirectory;
     Directory* currentDirectory;
     FileSystemObject* copyBuffer;
+    bool batchMode = false;    // no prompts: confirmations take the policy below
+    bool assumeYes = false;
+    bool noClobber = false;
+    
+    // Asks a yes/no question; in batch mode the answer is --yes
+    bool confirm(const string& question) const {
+        if (batchMode) {
+            if (!assumeYes) {
+                cout << question << " no (pass --yes to confirm in batch mode)\n";
+            }
+            return assumeYes;
+        }
+        cout << question << " (y/n): ";
+        char choice = 0;
+        cin >> choice;
+        cin.ignore();
+        return choice == 'y' || choice == 'Y';
+    }
 public:
     FileExplorer() {
         rootDirectory = new Directory("root", "");
@@ -413,6 +588,14 @@ public:
         Documents->addItem(picFile);
     }
     
+    // Batch mode never reads answers from the command stream: prompts are
+    // confirmed only with `yes`, and `skipExisting` leaves paste targets alone
+    void setBatchMode(bool yes, bool skipExisting) {
+        batchMode = true;
+        assumeYes = yes;
+        noClobber = skipExisting;
+    }
+    
     void displayCurrentDirectory() const {
         currentDirectory->displayContents();
     }
@@ -450,14 +633,10 @@ public:
     bool deleteItem(const string& itemName) {
         FileSystemObject* item = currentDirectory->findItem(itemName);
         if (!item) {
-            cout << "Error: Item '" << itemName << "' not found." << endl;
+            cout << "Error: Item '" << itemName << "' not found.\n";
             return false;
         }
-        cout << "Are you sure you want to delete '" << itemName << "'? (y/n): ";
-        char choice;
-        cin >> choice;
-        cin.ignore();
-        if (choice == 'y' || choice == 'Y') {
+        if (confirm("Are you sure you want to delete '" + itemName + "'?")) {
             return currentDirectory->removeItem(item->getName());
         }
         return false;
@@ -481,7 +660,7 @@ public:
                 delete copyBuffer;
             }
             copyBuffer = item->clone();
-            cout << "Copied: " << itemName << endl;
+            cout << "Copied: " << itemName << "\n";
             return true;
         }
         return false;
@@ -494,7 +673,7 @@ public:
                 delete copyBuffer;
             }
             copyBuffer = item->clone();
-            cout << "Cut: " << itemName << endl;
+            cout << "Cut: " << itemName << "\n";
             return true;
         }
         return false;
@@ -502,13 +681,22 @@ public:
     
     bool pasteItem() {
         if (!copyBuffer) {
-            cout << "Error: Nothing to paste." << endl;
+            cout << "Error: Nothing to paste.\n";
             return false;
         }
         string itemName = copyBuffer->getName();
         FileSystemObject* existingItem = currentDirectory->findItem(itemName);
         
-        if (existingItem) {
+        if (existingItem && batchMode) {
+            if (noClobber) {
+                cout << "Skipped: '" << itemName << "' already exists\n";
+                return true;
+            }
+            if (!confirm("'" + itemName + "' already exists. Overwrite?")) {
+                return false;
+            }
+            currentDirectory->removeItem(itemName);
+        } else if (existingItem) {
             cout << "'" << itemName << "' already exists. Overwrite? (y/n/rename): ";
             string choice;
             getline(cin, choice);
@@ -532,12 +720,12 @@ public:
     
     bool createDirectory(const string& dirName) {
         if (currentDirectory->findItem(dirName)) {
-            cout << "Error: An item named '" << dirName << "' already exists." << endl;
+            cout << "Error: An item named '" << dirName << "' already exists.\n";
             return false;
         }
         Directory* newDir = new Directory(dirName, currentDirectory->getFullPath());
         currentDirectory->addItem(newDir);
-        cout << "Directory created: " << dirName << endl;
+        cout << "Directory created: " << dirName << "\n";
         return true;
     }
     
@@ -550,12 +738,12 @@ public:
             extension = fileName.substr(dotPos);
         }
         if (currentDirectory->findItem(baseName)) {
-            cout << "Error: An item named '" << baseName << "' already exists." << endl;
+            cout << "Error: An item named '" << baseName << "' already exists.\n";
             return false;
         }
         File* newFile = new File(baseName, currentDirectory->getFullPath(), extension);
         currentDirectory->addItem(newFile);
-        cout << "File created: " << fileName << endl;
+        cout << "File created: " << fileName << "\n";
         return true;
     }
     
@@ -564,16 +752,16 @@ public:
         if (file.is_open()) {
             rootDirectory->saveHierarchy(file);
             file.close();
-            cout << "Hierarchy saved to hierarchy.txt" << endl;
+            cout << "Hierarchy saved to hierarchy.txt\n";
         } else {
-            cerr << "Error: Could not save hierarchy" << endl;
+            cerr << "Error: Could not save hierarchy\n";
         }
     }
     
     void saveAllFiles() const {
         cout << "\nSaving all files to disk...\n";
         rootDirectory->saveContentToFile();
-        cout << "All files saved successfully!\n" << endl;
+        cout << "All files saved successfully!\n\n";
     }
     
     string getCurrentPath() const {
@@ -603,117 +791,134 @@ class CommandHandler {
 private:
     FileExplorer& explorer;
     bool running;
+    bool showListing;          // redraw the directory after every command
     
-    void handleCd(const vector<string>& args) {
+    bool handleCd(const vector<string>& args) {
         if (args.size() < 2) {
-            cout << "Error: cd command requires a directory name" << endl;
-            return;
+            cout << "Error: cd command requires a directory name\n";
+            return false;
         }
         
         string target = args[1];
         if (!explorer.navigate(target)) {
             if (!explorer.viewFile(target)) {
-                cout << "Error: '" << target << "' is not a valid directory or file" << endl;
+                cout << "Error: '" << target << "' is not a valid directory or file\n";
+                return false;
             }
         }
+        return true;
     }
     
-    void handleView(const vector<string>& args) {
+    bool handleView(const vector<string>& args) {
         if (args.size() < 2) {
-            cout << "Error: view command requires a file name" << endl;
-            return;
+            cout << "Error: view command requires a file name\n";
+            return false;
         }
         
         string fileName = args[1];
         if (!explorer.viewFile(fileName)) {
-            cout << "Error: Could not view file '" << fileName << "'" << endl;
+            cout << "Error: Could not view file '" << fileName << "'\n";
+            return false;
         }
+        return true;
     }
     
-    void handleDelete(const vector<string>& args) {
+    bool handleDelete(const vector<string>& args) {
         if (args.size() < 2) {
-            cout << "Error: delete command requires an item name" << endl;
-            return;
+            cout << "Error: delete command requires an item name\n";
+            return false;
         }
         
         string itemName = args[1];
         if (!explorer.deleteItem(itemName)) {
-            cout << "Error: Could not delete '" << itemName << "'" << endl;
+            cout << "Error: Could not delete '" << itemName << "'\n";
+            return false;
         }
+        return true;
     }
     
-    void handleEdit(const vector<string>& args) {
+    bool handleEdit(const vector<string>& args) {
         if (args.size() < 2) {
-            cout << "Error: edit command requires a file name" << endl;
-            return;
+            cout << "Error: edit command requires a file name\n";
+            return false;
         }
         
         string fileName = args[1];
         if (!explorer.editFile(fileName)) {
-            cout << "Error: Could not edit file '" << fileName << "'" << endl;
+            cout << "Error: Could not edit file '" << fileName << "'\n";
+            return false;
         }
+        return true;
     }
     
-    void handleCopy(const vector<string>& args) {
+    bool handleCopy(const vector<string>& args) {
         if (args.size() < 2) {
-            cout << "Error: copy command requires an item name" << endl;
-            return;
+            cout << "Error: copy command requires an item name\n";
+            return false;
         }
         
         string itemName = args[1];
         if (!explorer.copyItem(itemName)) {
-            cout << "Error: Could not copy '" << itemName << "'" << endl;
+            cout << "Error: Could not copy '" << itemName << "'\n";
+            return false;
         }
+        return true;
     }
     
-    void handleCut(const vector<string>& args) {
+    bool handleCut(const vector<string>& args) {
         if (args.size() < 2) {
-            cout << "Error: cut command requires an item name" << endl;
-            return;
+            cout << "Error: cut command requires an item name\n";
+            return false;
         }
         string itemName = args[1];
         if (!explorer.cutItem(itemName)) {
-            cout << "Error: Could not cut '" << itemName << "'" << endl;
+            cout << "Error: Could not cut '" << itemName << "'\n";
+            return false;
         }
         if (!explorer.deleteItem(itemName)) {
-            cout << "Error: Could not delete '" << itemName << "'" << endl;
+            cout << "Error: Could not delete '" << itemName << "'\n";
+            return false;
         }
+        return true;
     }
     
-    void handlePaste(const vector<string>& args) {
+    bool handlePaste(const vector<string>& args) {
         if (!explorer.pasteItem()) {
-            cout << "Error: Paste operation failed" << endl;
+            cout << "Error: Paste operation failed\n";
+            return false;
         }
+        return true;
     }
     
-    void handleMkdir(const vector<string>& args) {
+    bool handleMkdir(const vector<string>& args) {
         if (args.size() < 2) {
-            cout << "Error: mkdir command requires a directory name" << endl;
-            return;
+            cout << "Error: mkdir command requires a directory name\n";
+            return false;
         }
         
         string dirName = args[1];
-        explorer.createDirectory(dirName);
+        return explorer.createDirectory(dirName);
     }
     
-    void handleTouch(const vector<string>& args) {
+    bool handleTouch(const vector<string>& args) {
         if (args.size() < 2) {
-            cout << "Error: touch command requires a file name" << endl;
-            return;
+            cout << "Error: touch command requires a file name\n";
+            return false;
         }
         
         string fileName = args[1];
-        explorer.createFile(fileName);
+        return explorer.createFile(fileName);
     }
     
-    void handleExit(const vector<string>& args) {
+    bool handleExit(const vector<string>& args) {
         explorer.saveHierarchy();
         explorer.saveAllFiles();
         running = false;
-        cout << "Exiting file explorer..." << endl;
+        cout << "Exiting file explorer...\n";
+        return true;
     }
     
-    void handleHelp(const vector<string>& args) {
+    bool handleHelp(const vector<string>& args) {
         if (args.size() > 1) {
             string command = args[1];
             if (command == "cd") {
@@ -724,6 +929,7 @@ private:
                 cout << "view <file_name> - Display file content\n";
             } else if (command == "delete") {
                 cout << "delete <name> - Delete a file or directory\n";
+                cout << "  In --batch mode the confirmation is answered by --yes, and refused without it\n";
             } else if (command == "edit") {
                 cout << "edit <file_name> - Edit file content\n";
                 cout << "In editor: :w or :save - Save changes\n";
@@ -735,6 +941,7 @@ private:
                 cout << "cut <name> - Cut a file or directory\n";
             } else if (command == "paste") {
                 cout << "paste - Paste copied item into current directory\n";
+                cout << "  In --batch mode an existing item is replaced only with --yes, or kept with --no-clobber\n";
             } else if (command == "mkdir") {
                 cout << "mkdir <name> - Create a new directory\n";
             } else if (command == "touch") {
@@ -748,6 +955,7 @@ private:
                 cout << "clear - Clear the console screen\n";
             } else {
                 cout << "No help available for '" << command << "'\n";
+                return false;
             }
         } else {
             cout << "\nAvailable commands:\n";
@@ -765,50 +973,89 @@ private:
             cout << "  help [command]\n";
             cout << "\nType 'help <command>' for more details on a specific command.\n";
         }
+        return true;
     }
 public:
-    CommandHandler(FileExplorer& explorer) : explorer(explorer), running(true) {}
+    CommandHandler(FileExplorer& explorer) : explorer(explorer), running(true), showListing(true) {}
     
-    void processCommand(const string& commandLine) {
+    // Exit status of one command: 0 on success, 1 when it failed and 127
+    // when there is no such command (the shell conventions)
+    int processCommand(const string& commandLine) {
         vector<string> args = splitString(commandLine, ' ');
         if (args.empty()) {
-            return;
+            return 0;
         }
         
         string command = args[0];
+        bool succeeded = true;
+        int status = 0;
         if (command == "cd") {
-            handleCd(args);
+            succeeded = handleCd(args);
         } else if (command == "view") {
-            handleView(args);
+            succeeded = handleView(args);
         } else if (command == "delete") {
-            handleDelete(args);
+            succeeded = handleDelete(args);
         } else if (command == "edit") {
-            handleEdit(args);
+            succeeded = handleEdit(args);
         } else if (command == "copy") {
-            handleCopy(args);
+            succeeded = handleCopy(args);
         } else if (command == "cut") {
-            handleCut(args);
+            succeeded = handleCut(args);
         } else if (command == "paste") {
-            handlePaste(args);
+            succeeded = handlePaste(args);
         } else if (command == "mkdir") {
-            handleMkdir(args);
+            succeeded = handleMkdir(args);
         } else if (command == "touch") {
-            handleTouch(args);
+            succeeded = handleTouch(args);
         } else if (command == "exit") {
-            handleExit(args);
+            succeeded = handleExit(args);
         } else if (command == "help") {
-            handleHelp(args);
+            succeeded = handleHelp(args);
         } else if (command == "clear") {
             clearScreen();
-            cout << "========= Virtual File Explorer =========" << endl;
+            cout << "========= Virtual File Explorer =========\n";
         } else if (!command.empty()) {
-            cout << "Unknown command: " << command << endl;
-            cout << "Type 'help' for a list of commands." << endl;
+            cout << "Unknown command: " << command << "\n";
+            cout << "Type 'help' for a list of commands.\n";
+            status = 127;
+        }
+        if (!succeeded) {
+            status = 1;
         }
         
-        if (running) {
+        if (running && showListing) {
             explorer.displayCurrentDirectory();
         }
+        return status;
+    }
+    
+    // Runs commands from `input` with no prompt and no listing after each
+    // one; empty lines and lines starting with # are skipped. Every command's
+    // status goes to stderr as "<n>\t<status>\t<command>", numbering only
+    // command lines (editor content is read from the same stream). Returns 0
+    // when all commands succeeded, otherwise the last failing status.
+    int runBatch(istream& input, bool stopOnError) {
+        string commandLine;
+        size_t commandNumber = 0;
+        int result = 0;
+        showListing = false;
+        
+        while (running && getline(input, commandLine)) {
+            if (!commandLine.empty() && commandLine.back() == '\r') commandLine.pop_back();
+            if (commandLine.empty() || commandLine[0] == '#') {
+                continue;
+            }
+            
+            commandNumber++;
+            int status = processCommand(commandLine);
+            cerr << commandNumber << '\t' << status << '\t' << commandLine << '\n';
+            if (status != 0) {
+                result = status;
+                if (stopOnError) break;
+            }
+        }
+        cout.flush();
+        return result;
     }
     
     bool isRunning() const {
@@ -816,14 +1063,293 @@ public:
     }
 };
 
-int main() {
+// Discards everything written to it, so benchmarks time the work and not the terminal
+class NullBuffer : public streambuf {
+protected:
+    int_type overflow(int_type ch) override { return traits_type::not_eof(ch); }
+    streamsize xsputn(const char*, streamsize count) override { return count; }
+};
+
+// Peak resident set size of the process. Linux can reset the peak, so each
+// benchmark reports its own; elsewhere the value only ever grows.
+class PeakMemory {
+public:
+    static void reset() {
+        #ifdef __linux__
+        ofstream clearRefs("/proc/self/clear_refs");
+        clearRefs << "5";
+        #endif
+    }
+    
+    static unsigned long long kilobytes() {
+        #if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return counters.PeakWorkingSetSize / 1024;
+        }
+        return 0;
+        #elif defined(__linux__)
+        ifstream status("/proc/self/status");
+        string line;
+        while (getline(status, line)) {
+            if (line.compare(0, 6, "VmHWM:") == 0) {
+                return stoull(line.substr(6));
+            }
+        }
+        return 0;
+        #else
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        #ifdef __APPLE__
+        return static_cast<unsigned long long>(usage.ru_maxrss) / 1024;    // bytes on macOS
+        #else
+        return static_cast<unsigned long long>(usage.ru_maxrss);
+        #endif
+        #endif
+    }
+};
+
+// --bench: builds reproducible in-memory trees and times the Directory
+// operations the explorer is made of. Prints one JSON document with a
+// record per benchmark (ops/sec, p50/p99 latency, peak RSS) on stdout.
+class BenchmarkSuite {
+private:
+    int scale;
+    string filter;
+    NullBuffer nullBuffer;
+    bool firstRecord = true;
+    
+    bool selected(const string& name) const {
+        return filter.empty() || name.find(filter) != string::npos;
+    }
+    
+    static File* makeFile(const string& name, size_t bytes) {
+        File* file = new File(name, "", ".txt");
+        file->setContent(string(bytes, 'x'));
+        return file;
+    }
+    
+    // Items are added top-down, since addItem only rewrites the direct child's path
+    static Directory* makeWide(int files) {
+        Directory* dir = new Directory("wide", "");
+        for (int i = 0; i < files; i++) {
+            dir->addItem(makeFile("file" + to_string(i), 64));
+        }
+        return dir;
+    }
+    
+    static Directory* makeDeep(int depth) {
+        Directory* top = new Directory("deep", "");
+        Directory* dir = top;
+        for (int level = 0; level < depth; level++) {
+            Directory* child = new Directory("level" + to_string(level), "", dir);
+            dir->addItem(child);
+            child->addItem(makeFile("a", 256));
+            dir = child;
+        }
+        return top;
+    }
+    
+    static Directory* makeTiny(int dirs, int filesPerDir) {
+        mt19937 random(42);     // fixed seed: every run builds the same tree
+        Directory* top = new Directory("tiny", "");
+        for (int i = 0; i < dirs; i++) {
+            Directory* dir = new Directory("dir" + to_string(i), "", top);
+            top->addItem(dir);
+            for (int j = 0; j < filesPerDir; j++) {
+                dir->addItem(makeFile("note" + to_string(j), 64 + random() % 960));
+            }
+        }
+        return top;
+    }
+    
+    static double percentile(const vector<double>& sorted, double fraction) {
+        size_t rank = static_cast<size_t>(ceil(fraction * static_cast<double>(sorted.size())));
+        return sorted[rank > 0 ? rank - 1 : 0];
+    }
+    
+    void report(const string& name, vector<double> millis, unsigned long long peakKilobytes) {
+        sort(millis.begin(), millis.end());
+        double total = 0;
+        for (double sample : millis) total += sample;
+        double opsPerSecond = total > 0 ? static_cast<double>(millis.size()) * 1000.0 / total : 0;
+        
+        cout << (firstRecord ? "\n" : ",\n") << "    {\"name\": \"" << name << "\", \"ops\": " << millis.size()
+             << fixed << setprecision(1) << ", \"ops_per_sec\": " << opsPerSecond
+             << setprecision(3) << ", \"p50_ms\": " << percentile(millis, 0.50) << ", \"p99_ms\": " << percentile(millis, 0.99)
+             << ", \"peak_rss_kb\": " << peakKilobytes << "}";
+        cout.flush();
+        firstRecord = false;
+    }
+    
+    // Times `operation` with its output discarded; `cleanup` runs untimed after each call
+    template <typename Operation, typename Cleanup>
+    void measure(const string& name, int iterations, Operation&& operation, Cleanup&& cleanup) {
+        if (!selected(name)) {
+            return;
+        }
+        cerr << "  " << name << "\n";
+        PeakMemory::reset();
+        vector<double> samples;
+        for (int i = 0; i < iterations; i++) {
+            streambuf* output = cout.rdbuf(&nullBuffer);
+            auto start = chrono::steady_clock::now();
+            operation();
+            samples.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+            cout.rdbuf(output);
+            cleanup();
+        }
+        report(name, move(samples), PeakMemory::kilobytes());
+    }
+    
+    template <typename Operation>
+    void measure(const string& name, int iterations, Operation&& operation) {
+        measure(name, iterations, operation, [] {});
+    }
+    
+public:
+    BenchmarkSuite(int scale, const string& filter) : scale(scale), filter(filter) {}
+    
+    int run() {
+        cout << "{\n  \"program\": \"Virtual_FileExplorer\",\n  \"scale\": " << scale << ",\n  \"benchmarks\": [";
+        
+        Directory* wide = makeWide(20000 * scale);
+        Directory* deep = makeDeep(200);
+        Directory* tiny = makeTiny(20 * scale, 500);
+        string last = "file" + to_string(20000 * scale - 1);
+        FileSystemObject* found = nullptr;
+        
+        measure("findItem/wide-last", 200, [&] { found = wide->findItem(last); });
+        measure("findItem/wide-extension", 200, [&] { found = wide->findItem(last + ".txt"); });
+        measure("findItem/wide-missing", 200, [&] { found = wide->findItem("missing.txt"); });
+        if (found) {
+            cerr << "findItem returned an item for a missing name\n";
+        }
+        
+        FileSystemObject* copy = nullptr;
+        auto dropCopy = [&] {
+            delete copy;
+            copy = nullptr;
+        };
+        measure("clone/wide", 20, [&] { copy = wide->clone(); }, dropCopy);
+        measure("clone/deep", 100, [&] { copy = deep->clone(); }, dropCopy);
+        measure("clone/tiny", 10, [&] { copy = tiny->clone(); }, dropCopy);
+        
+        // Files are saved relative to the working directory
+        int status = 0;
+        if (selected("saveContentToFile/tiny")) {
+            fs::path original = fs::current_path();
+            fs::path target = fs::temp_directory_path() /
+                              ("virtual-explorer-bench-" + to_string(chrono::steady_clock::now().time_since_epoch().count()));
+            try {
+                fs::create_directories(target);
+                fs::current_path(target);
+                measure("saveContentToFile/tiny", 3, [&] { tiny->saveContentToFile(); },
+                        [&] { fs::remove_all(target / "tiny"); });
+            } catch (const fs::filesystem_error& e) {
+                cerr << "Benchmark failed: " << e.what() << "\n";
+                status = 1;
+            }
+            fs::current_path(original);
+            error_code ignored;
+            fs::remove_all(target, ignored);
+        }
+        
+        delete wide;
+        delete deep;
+        delete tiny;
+        cout << "\n  ]\n}\n";
+        return status;
+    }
+};
+
+int runBenchmarks(int argc, char* argv[]) {
+    int scale = 1;
+    string filter;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--scale" && i + 1 < argc) {
+            scale = max(1, atoi(argv[++i]));
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            cerr << "Usage: " << argv[0] << " --bench [--scale N] [--filter NAME]\n";
+            return 2;
+        }
+    }
+    
+    BenchmarkSuite suite(scale, filter);
+    return suite.run();
+}
+
+// --batch: runs commands from a script (or stdin) on a freshly initialized
+// tree, without prompts or listings. Nothing is saved unless the script
+// ends with `exit`. The exit status is 0 only when every command succeeded.
+int runBatchMode(int argc, char* argv[]) {
+    string scriptPath;
+    bool assumeYes = false;
+    bool noClobber = false;
+    bool stopOnError = false;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--yes" || arg == "-y") {
+            assumeYes = true;
+        } else if (arg == "--no-clobber") {
+            noClobber = true;
+        } else if (arg == "--stop-on-error") {
+            stopOnError = true;
+        } else if (scriptPath.empty() && (arg == "-" || arg[0] != '-')) {
+            scriptPath = arg;
+        } else {
+            cerr << "Usage: " << argv[0] << " --batch [script|-] [--yes] [--no-clobber] [--stop-on-error]\n";
+            return 2;
+        }
+    }
+    
+    ios::sync_with_stdio(false);
+    cin.tie(nullptr);
+    
+    // The editor reads file content from cin, so a script replaces it
+    ifstream script;
+    streambuf* standardInput = cin.rdbuf();
+    if (!scriptPath.empty() && scriptPath != "-") {
+        script.open(scriptPath);
+        if (!script) {
+            cerr << "Error: Could not open script '" << scriptPath << "'\n";
+            return 2;
+        }
+        cin.rdbuf(script.rdbuf());
+    }
+    
     setupConsole();
     
     FileExplorer explorer;
     CommandHandler commandHandler(explorer);
     explorer.initialize();
+    explorer.setBatchMode(assumeYes, noClobber);
     
-    cout << "========= Virtual File Explorer =========" << endl;
+    int status = commandHandler.runBatch(cin, stopOnError);
+    cin.rdbuf(standardInput);
+    setConsoleColor(COLOR_RESET);
+    cout.flush();
+    return status;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        return runBenchmarks(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--batch") {
+        return runBatchMode(argc, argv);
+    }
+    
+    setupConsole();
+    
+    FileExplorer explorer;
+    CommandHandler commandHandler(explorer);
+    explorer.initialize();
+    
+    cout << "========= Virtual File Explorer =========\n";
     explorer.displayCurrentDirectory();
     
     string commandLine;
@@ -831,7 +1357,12 @@ int main() {
         setConsoleColor(COLOR_GREEN);
         cout << explorer.getCurrentPath() << "> ";
         setConsoleColor(COLOR_RED);
-        getline(cin, commandLine);
+        // End of input (Ctrl+D, or a pipe that ran dry) ends the session
+        if (!getline(cin, commandLine)) {
+            setConsoleColor(COLOR_RESET);
+            cout << "\n";
+            break;
+        }
         setConsoleColor(COLOR_RESET);
         commandHandler.processCommand(commandLine);
     }